@@ -0,0 +1,257 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#include <sys/resource.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include "xeus-sql/result_arena.hpp"
+
+#include "alloc_tracker.hpp"
+
+namespace
+{
+    std::atomic<std::size_t> current = {0};
+    std::atomic<std::size_t> peak = {0};
+    std::atomic<std::size_t> count = {0};
+
+    // the size of each block is stored in front of it
+    constexpr std::size_t header_size = alignof(std::max_align_t);
+
+    void add_bytes(std::size_t size)
+    {
+        std::size_t now = current.fetch_add(size, std::memory_order_relaxed) + size;
+        std::size_t prev = peak.load(std::memory_order_relaxed);
+        while (now > prev && !peak.compare_exchange_weak(prev, now, std::memory_order_relaxed))
+        {
+        }
+        count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void* tracked_alloc(std::size_t size) noexcept
+    {
+        void* block = std::malloc(size + header_size);
+        if (block == nullptr)
+        {
+            return nullptr;
+        }
+        *static_cast<std::size_t*>(block) = size;
+        add_bytes(size);
+        return static_cast<char*>(block) + header_size;
+    }
+
+    void tracked_free(void* ptr) noexcept
+    {
+        if (ptr == nullptr)
+        {
+            return;
+        }
+        void* block = static_cast<char*>(ptr) - header_size;
+        current.fetch_sub(*static_cast<std::size_t*>(block), std::memory_order_relaxed);
+        std::free(block);
+    }
+
+    void* tracked_new(std::size_t size)
+    {
+        void* res = tracked_alloc(size);
+        if (res == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        return res;
+    }
+
+    /* Over-aligned blocks (the pools of the result arenas) keep the start
+       of the malloc block and the size in front of the aligned pointer */
+    void* tracked_aligned_alloc(std::size_t size, std::align_val_t alignment) noexcept
+    {
+        const std::size_t align = std::max(static_cast<std::size_t>(alignment), alignof(std::max_align_t));
+        void* block = std::malloc(size + align + 2 * sizeof(void*));
+        if (block == nullptr)
+        {
+            return nullptr;
+        }
+        const std::uintptr_t start = reinterpret_cast<std::uintptr_t>(block) + 2 * sizeof(void*);
+        auto* res = reinterpret_cast<std::size_t*>((start + align - 1) / align * align);
+        res[-1] = size;
+        reinterpret_cast<void**>(res)[-2] = block;
+        add_bytes(size);
+        return res;
+    }
+
+    void tracked_aligned_free(void* ptr) noexcept
+    {
+        if (ptr == nullptr)
+        {
+            return;
+        }
+        current.fetch_sub(static_cast<std::size_t*>(ptr)[-1], std::memory_order_relaxed);
+        std::free(static_cast<void**>(ptr)[-2]);
+    }
+
+    void* tracked_aligned_new(std::size_t size, std::align_val_t alignment)
+    {
+        void* res = tracked_aligned_alloc(size, alignment);
+        if (res == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        return res;
+    }
+
+    void track_mapping(std::ptrdiff_t bytes)
+    {
+        if (bytes > 0)
+        {
+            add_bytes(static_cast<std::size_t>(bytes));
+        }
+        else
+        {
+            current.fetch_sub(static_cast<std::size_t>(-bytes), std::memory_order_relaxed);
+        }
+    }
+
+    [[maybe_unused]] const bool mapping_tracked = (xeus_sql::set_mapping_observer(&track_mapping), true);
+
+#ifdef __linux__
+    /* Value in kB of a line of /proc/self/status */
+    std::size_t status_kb(const std::string& key)
+    {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line))
+        {
+            if (line.compare(0, key.size(), key) == 0)
+            {
+                return std::stoull(line.substr(key.size() + 1)) * 1024;
+            }
+        }
+        return 0;
+    }
+#endif
+}
+
+namespace xeus_sql
+{
+    namespace alloc_tracker
+    {
+        std::size_t current_bytes()
+        {
+            return current.load(std::memory_order_relaxed);
+        }
+
+        std::size_t peak_bytes()
+        {
+            return peak.load(std::memory_order_relaxed);
+        }
+
+        std::size_t allocations()
+        {
+            return count.load(std::memory_order_relaxed);
+        }
+
+        void reset()
+        {
+            peak.store(current.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            count.store(0, std::memory_order_relaxed);
+        }
+
+        std::size_t rss_bytes()
+        {
+#ifdef _WIN32
+            PROCESS_MEMORY_COUNTERS counters;
+            return K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))
+                 ? counters.WorkingSetSize : 0;
+#elif defined(__APPLE__)
+            mach_task_basic_info info;
+            mach_msg_type_number_t size = MACH_TASK_BASIC_INFO_COUNT;
+            return task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+                             reinterpret_cast<task_info_t>(&info), &size) == KERN_SUCCESS
+                 ? info.resident_size : 0;
+#else
+            std::ifstream statm("/proc/self/statm");
+            std::size_t pages = 0, resident = 0;
+            statm >> pages >> resident;
+            return resident * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#endif
+        }
+
+        std::size_t peak_rss_bytes()
+        {
+#ifdef _WIN32
+            PROCESS_MEMORY_COUNTERS counters;
+            return K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))
+                 ? counters.PeakWorkingSetSize : 0;
+#else
+#ifdef __linux__
+            if (std::size_t res = status_kb("VmHWM"))
+            {
+                return res;
+            }
+#endif
+            rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+            return static_cast<std::size_t>(usage.ru_maxrss);
+#else
+            return static_cast<std::size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+        }
+
+        void reset_peak_rss()
+        {
+#ifdef __linux__
+            // "5" resets the peak resident set size of the process
+            std::ofstream clear_refs("/proc/self/clear_refs");
+            clear_refs << "5";
+#endif
+        }
+    }
+}
+
+void* operator new(std::size_t size) { return tracked_new(size); }
+void* operator new[](std::size_t size) { return tracked_new(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return tracked_alloc(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return tracked_alloc(size); }
+void operator delete(void* ptr) noexcept { tracked_free(ptr); }
+void operator delete[](void* ptr) noexcept { tracked_free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { tracked_free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { tracked_free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { tracked_free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { tracked_free(ptr); }
+void* operator new(std::size_t size, std::align_val_t a) { return tracked_aligned_new(size, a); }
+void* operator new[](std::size_t size, std::align_val_t a) { return tracked_aligned_new(size, a); }
+void* operator new(std::size_t size, std::align_val_t a, const std::nothrow_t&) noexcept { return tracked_aligned_alloc(size, a); }
+void* operator new[](std::size_t size, std::align_val_t a, const std::nothrow_t&) noexcept { return tracked_aligned_alloc(size, a); }
+void operator delete(void* ptr, std::align_val_t) noexcept { tracked_aligned_free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { tracked_aligned_free(ptr); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { tracked_aligned_free(ptr); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept { tracked_aligned_free(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { tracked_aligned_free(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { tracked_aligned_free(ptr); }
@@ -0,0 +1,39 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XSQL_ALLOC_TRACKER_HPP
+#define XSQL_ALLOC_TRACKER_HPP
+
+#include <cstddef>
+
+namespace xeus_sql
+{
+    /* Accounting of the memory allocated through the global operator new
+       of the benchmark executables, and of the blocks the result arenas
+       map from the system directly. */
+    namespace alloc_tracker
+    {
+        std::size_t current_bytes();
+        std::size_t peak_bytes();
+        std::size_t allocations();
+
+        /* Sets the peak to the current allocated size and clears the
+           allocation count */
+        void reset();
+
+        /* Resident set size of the process, and its highest value since
+           the last reset_peak_rss() where the system can reset it (Linux),
+           since the start of the process otherwise */
+        std::size_t rss_bytes();
+        std::size_t peak_rss_bytes();
+        void reset_peak_rss();
+    }
+}
+
+#endif
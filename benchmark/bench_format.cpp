@@ -0,0 +1,118 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "xeus-sql/result_set.hpp"
+
+namespace xeus_sql
+{
+    namespace
+    {
+        std::vector<double> doubles(std::size_t n)
+        {
+            std::vector<double> res(n);
+            for (std::size_t i = 0; i != n; ++i)
+            {
+                res[i] = static_cast<double>(i) * 3.14159 / 7.;
+            }
+            return res;
+        }
+
+        constexpr std::size_t values_count = 1 << 16;
+    }
+
+    /* Formatting of numeric cells into a shared buffer */
+    static void BM_append_double(benchmark::State& state)
+    {
+        const auto values = doubles(values_count);
+        std::string out;
+        for (auto _ : state)
+        {
+            out.clear();
+            for (double v : values)
+            {
+                append_double(out, v);
+            }
+            benchmark::DoNotOptimize(out.data());
+        }
+        state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * values_count));
+    }
+
+    /* Reference: the std::to_string based formatting with trailing zeros
+       trimming, one string per cell */
+    static void BM_to_string_double(benchmark::State& state)
+    {
+        const auto values = doubles(values_count);
+        std::vector<std::string> out(values_count);
+        for (auto _ : state)
+        {
+            for (std::size_t i = 0; i != values_count; ++i)
+            {
+                std::string cell = std::to_string(values[i]);
+                cell.erase(cell.find_last_not_of('0') + 1, std::string::npos);
+                if (cell.back() == '.')
+                {
+                    cell.pop_back();
+                }
+                out[i] = std::move(cell);
+            }
+            benchmark::DoNotOptimize(out.data());
+        }
+        state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * values_count));
+    }
+
+    static void BM_append_integer(benchmark::State& state)
+    {
+        std::string out;
+        for (auto _ : state)
+        {
+            out.clear();
+            for (long long i = 0; i != static_cast<long long>(values_count); ++i)
+            {
+                append_integer(out, i * 2654435761LL);
+            }
+            benchmark::DoNotOptimize(out.data());
+        }
+        state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * values_count));
+    }
+
+    static void BM_append_date(benchmark::State& state)
+    {
+        std::tm when = {};
+        when.tm_year = 120;
+        when.tm_mon = 5;
+        when.tm_mday = 17;
+        when.tm_hour = 13;
+        when.tm_min = 4;
+        when.tm_sec = 59;
+        std::string out;
+        for (auto _ : state)
+        {
+            out.clear();
+            for (std::size_t i = 0; i != values_count; ++i)
+            {
+                when.tm_sec = static_cast<int>(i % 60);
+                append_date(out, when);
+            }
+            benchmark::DoNotOptimize(out.data());
+        }
+        state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * values_count));
+    }
+
+    BENCHMARK(BM_append_double);
+    BENCHMARK(BM_to_string_double);
+    BENCHMARK(BM_append_integer);
+    BENCHMARK(BM_append_date);
+}
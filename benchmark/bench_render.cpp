@@ -0,0 +1,75 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <cstdint>
+#include <string>
+
+#include "benchmark/benchmark.h"
+
+#include "xeus-sql/result_set.hpp"
+#include "xeus-sql/text_renderer.hpp"
+
+namespace xeus_sql
+{
+    namespace
+    {
+        /* id, value, label columns */
+        result_set make_result(std::size_t rows)
+        {
+            result_set result;
+            result.add_column("id", soci::dt_long_long);
+            result.add_column("value", soci::dt_double);
+            result.add_column("label", soci::dt_string);
+            std::string cell;
+            for (std::size_t i = 0; i != rows; ++i)
+            {
+                cell.clear();
+                append_integer(cell, static_cast<long long>(i));
+                result.append_cell(cell);
+                cell.clear();
+                append_double(cell, static_cast<double>(i) / 7.);
+                result.append_cell(cell);
+                result.append_cell(i % 3 == 0 ? "a rather long label that will be truncated by the renderer"
+                                              : "short");
+            }
+            return result;
+        }
+    }
+
+    /* Every row rendered, the worst case of the text/plain output */
+    static void BM_render_text_all_rows(benchmark::State& state)
+    {
+        const auto rows = static_cast<std::size_t>(state.range(0));
+        const result_set result = make_result(rows);
+        text_table_options options;
+        options.max_rows = 0;
+        for (auto _ : state)
+        {
+            std::string out = render_text_table(result, options);
+            benchmark::DoNotOptimize(out.data());
+        }
+        state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * rows));
+    }
+
+    /* Default options, head and tail rows only */
+    static void BM_render_text_elided(benchmark::State& state)
+    {
+        const auto rows = static_cast<std::size_t>(state.range(0));
+        const result_set result = make_result(rows);
+        for (auto _ : state)
+        {
+            std::string out = render_text_table(result);
+            benchmark::DoNotOptimize(out.data());
+        }
+        state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * rows));
+    }
+
+    BENCHMARK(BM_render_text_all_rows)->Arg(1000)->Arg(100000)->Unit(benchmark::kMillisecond);
+    BENCHMARK(BM_render_text_elided)->Arg(1000)->Arg(100000)->Unit(benchmark::kMicrosecond);
+}
@@ -0,0 +1,197 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <cstdint>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "alloc_tracker.hpp"
+#include "in_process_kernel.hpp"
+
+namespace xeus_sql
+{
+    namespace
+    {
+        struct table_shape
+        {
+            const char* name;
+            // column declarations and the SQLite expressions generating them from i
+            std::vector<std::pair<std::string, std::string>> columns;
+        };
+
+        std::vector<std::pair<std::string, std::string>> wide_columns()
+        {
+            std::vector<std::pair<std::string, std::string>> res;
+            for (int c = 0; c != 8; ++c)
+            {
+                std::string n = std::to_string(c);
+                res.emplace_back("i" + n + " INTEGER", "i * " + std::to_string(c + 3) + " % 100003");
+                res.emplace_back("r" + n + " REAL", "i / " + std::to_string(c + 7) + ".0");
+                res.emplace_back("t" + n + " TEXT", "'value_' || (i % " + std::to_string(10 + c * 100) + ")");
+            }
+            return res;
+        }
+
+        const std::vector<table_shape>& shapes()
+        {
+            static const std::vector<table_shape> res = {
+                {"narrow", {{"id INTEGER", "i"}, {"value REAL", "i * 0.25"}}},
+                {"wide", wide_columns()},
+                {"numeric", {{"id INTEGER", "i"},
+                             {"qty INTEGER", "i % 1000"},
+                             {"big INTEGER", "i * 2654435761"},
+                             {"price REAL", "(i % 10000) / 100.0"},
+                             {"ratio REAL", "1.0 / (i + 1)"},
+                             {"score REAL", "i * 3.14159"}}},
+                {"text", {{"name TEXT", "printf('customer_%08d', i)"},
+                          {"country TEXT", "'country_' || (i % 50)"},
+                          {"status TEXT", "CASE i % 3 WHEN 0 THEN 'open' WHEN 1 THEN 'closed' ELSE 'pending' END"},
+                          {"email TEXT", "printf('user%d@example.com', i)"},
+                          {"comment TEXT", "'lorem ipsum dolor sit amet ' || i"},
+                          {"code TEXT", "hex(i * 7919)"}}},
+                {"date", {{"id INTEGER", "i"},
+                          {"created DATETIME", "datetime(946684800 + i * 3600, 'unixepoch')"},
+                          {"updated DATETIME", "datetime(946684800 + i * 5400, 'unixepoch')"},
+                          {"shipped DATE", "date(946684800 + i * 86400 % 315360000, 'unixepoch')"},
+                          {"paid TIMESTAMP", "datetime(978307200 + i * 60, 'unixepoch')"}}}
+            };
+            return res;
+        }
+
+        in_process_kernel& kernel()
+        {
+            static in_process_kernel k;
+            static const bool loaded = (k.execute("%LOAD sqlite3 db=:memory:"), true);
+            (void)loaded;
+            return k;
+        }
+
+        /* Tables are generated on first use, one per shape and size */
+        std::string table_name(std::size_t shape, std::int64_t rows)
+        {
+            static std::set<std::string> created;
+            const table_shape& s = shapes()[shape];
+            std::string name = std::string(s.name) + "_" + std::to_string(rows);
+            if (created.insert(name).second)
+            {
+                std::stringstream create, insert;
+                create << "CREATE TABLE " << name << " (";
+                insert << "WITH RECURSIVE seq(i) AS (SELECT 0 UNION ALL SELECT i + 1 FROM seq WHERE i + 1 < "
+                       << rows << ") INSERT INTO " << name << " SELECT ";
+                for (std::size_t c = 0; c != s.columns.size(); ++c)
+                {
+                    create << (c ? ", " : "") << s.columns[c].first;
+                    insert << (c ? ", " : "") << s.columns[c].second;
+                }
+                create << ")";
+                insert << " FROM seq";
+                kernel().execute(create.str());
+                kernel().execute(insert.str());
+            }
+            return name;
+        }
+
+        std::string first_column(std::size_t shape)
+        {
+            const std::string& decl = shapes()[shape].columns[0].first;
+            return decl.substr(0, decl.find(' '));
+        }
+
+        std::string second_column(std::size_t shape)
+        {
+            const std::string& decl = shapes()[shape].columns[1].first;
+            return decl.substr(0, decl.find(' '));
+        }
+
+        void run_cell(benchmark::State& state, const std::string& code, std::int64_t rows)
+        {
+            in_process_kernel& k = kernel();
+            k.reset_counters();
+            alloc_tracker::reset();
+            alloc_tracker::reset_peak_rss();
+            const std::size_t baseline = alloc_tracker::current_bytes();
+            const std::size_t rss_before = alloc_tracker::rss_bytes();
+
+            for (auto _ : state)
+            {
+                k.execute(code);
+            }
+
+            const auto iterations = static_cast<std::int64_t>(state.iterations());
+            state.SetItemsProcessed(iterations * rows);
+            state.SetBytesProcessed(static_cast<std::int64_t>(k.published_bytes()));
+            state.counters["peak_alloc_bytes"] =
+                static_cast<double>(alloc_tracker::peak_bytes() - baseline);
+            /* Growth of the resident memory during the iterations and what
+               is left of it afterwards, which the allocation count misses
+               when freed pages stay in the heap. The tables of the previous
+               benchmarks are resident before, hence the differences. */
+            state.counters["peak_rss"] = static_cast<double>(alloc_tracker::peak_rss_bytes())
+                                       - static_cast<double>(rss_before);
+            state.counters["rss_after"] = static_cast<double>(alloc_tracker::rss_bytes())
+                                        - static_cast<double>(rss_before);
+            state.counters["allocs_per_row"] = benchmark::Counter(
+                static_cast<double>(alloc_tracker::allocations()) / static_cast<double>(iterations * rows));
+        }
+    }
+
+    /* Text and HTML tables, as published for a SELECT cell */
+    static void BM_select(benchmark::State& state)
+    {
+        const auto shape = static_cast<std::size_t>(state.range(0));
+        const std::int64_t rows = state.range(1);
+        std::string code = "SELECT * FROM " + table_name(shape, rows);
+        state.SetLabel(shapes()[shape].name);
+        run_cell(state, code, rows);
+    }
+
+    /* Chart data published by %XVEGA_PLOT */
+    static void BM_xvega(benchmark::State& state)
+    {
+        const auto shape = static_cast<std::size_t>(state.range(0));
+        const std::int64_t rows = state.range(1);
+        std::string table = table_name(shape, rows);
+        std::string code = "%XVEGA_PLOT X_FIELD " + first_column(shape)
+                         + " Y_FIELD " + second_column(shape)
+                         + " MARK circle WIDTH 300 HEIGHT 300 <> SELECT * FROM " + table;
+        state.SetLabel(shapes()[shape].name);
+        run_cell(state, code, rows);
+    }
+
+    static void BM_complete(benchmark::State& state)
+    {
+        static const std::vector<std::string> prefixes = {
+            "", "S", "SEL", "SELECT * FROM t WHERE a = 1 AND C"
+        };
+        const std::string& code = prefixes[static_cast<std::size_t>(state.range(0))];
+        in_process_kernel& k = kernel();
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(k.complete(code, static_cast<int>(code.size())));
+        }
+        state.SetLabel("\"" + code + "\"");
+    }
+
+    BENCHMARK(BM_select)
+        ->ArgsProduct({{0, 1, 2, 3, 4}, {1000, 10000, 100000, 1000000}})
+        ->Unit(benchmark::kMillisecond);
+    BENCHMARK(BM_select)
+        ->Args({0, 10000000})
+        ->Unit(benchmark::kMillisecond)
+        ->Iterations(1);
+    BENCHMARK(BM_xvega)
+        ->ArgsProduct({{0, 2, 4}, {1000, 10000, 100000, 1000000}})
+        ->Unit(benchmark::kMillisecond);
+    BENCHMARK(BM_complete)->DenseRange(0, 3)->Unit(benchmark::kMicrosecond);
+}
@@ -0,0 +1,108 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XSQL_IN_PROCESS_KERNEL_HPP
+#define XSQL_IN_PROCESS_KERNEL_HPP
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+#include "nlohmann/json.hpp"
+#include "xeus/xinterpreter.hpp"
+
+#include "xeus-sql/xeus_sql_interpreter.hpp"
+
+namespace nl = nlohmann;
+
+namespace xeus_sql
+{
+    /* Drives an interpreter without any ZMQ server: execute requests are
+       sent directly to the interpreter and published messages are only
+       measured, as a frontend would receive them. */
+    class in_process_kernel
+    {
+    public:
+
+        in_process_kernel()
+        {
+            m_interpreter.register_publisher(
+                [this](const std::string& /*msg_type*/,
+                       nl::json /*metadata*/,
+                       nl::json content,
+                       xeus::buffer_sequence /*buffers*/)
+                {
+                    ++m_published_messages;
+                    m_published_bytes += payload_size(content);
+                });
+            m_interpreter.configure();
+        }
+
+        /* Executes a cell, throws if the kernel replied with an error */
+        nl::json execute(const std::string& code)
+        {
+            nl::json reply;
+            m_interpreter.execute_request(xeus::xrequest_context(),
+                                          [&reply](nl::json r) { reply = std::move(r); },
+                                          code,
+                                          xeus::execute_request_config{false, false, false},
+                                          nl::json::object());
+            if (reply.value("status", "") == "error")
+            {
+                throw std::runtime_error(reply.value("evalue", std::string("execution failed")));
+            }
+            return reply;
+        }
+
+        nl::json complete(const std::string& code, int cursor_pos)
+        {
+            return m_interpreter.complete_request(code, cursor_pos);
+        }
+
+        std::size_t published_bytes() const
+        {
+            return m_published_bytes;
+        }
+
+        std::size_t published_messages() const
+        {
+            return m_published_messages;
+        }
+
+        void reset_counters()
+        {
+            m_published_bytes = 0;
+            m_published_messages = 0;
+        }
+
+    private:
+
+        static std::size_t payload_size(const nl::json& content)
+        {
+            auto data = content.find("data");
+            if (data == content.end())
+            {
+                return 0;
+            }
+            std::size_t res = 0;
+            for (const auto& mime : data->items())
+            {
+                res += mime.value().is_string() ? mime.value().get_ref<const std::string&>().size()
+                                                : mime.value().dump().size();
+            }
+            return res;
+        }
+
+        interpreter m_interpreter;
+        std::size_t m_published_bytes = 0;
+        std::size_t m_published_messages = 0;
+    };
+}
+
+#endif
@@ -0,0 +1,45 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+/* Results are written as JSON to xsql_bench.json unless another output
+   is requested on the command line, so that runs can be compared across
+   releases with benchmark's compare.py. */
+int main(int argc, char** argv)
+{
+    std::vector<char*> args(argv, argv + argc);
+    bool has_out = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        has_out = has_out || std::strncmp(argv[i], "--benchmark_out=", 16) == 0;
+    }
+
+    std::string out = "--benchmark_out=xsql_bench.json";
+    std::string out_format = "--benchmark_out_format=json";
+    if (!has_out)
+    {
+        args.push_back(&out[0]);
+        args.push_back(&out_format[0]);
+    }
+
+    int args_count = static_cast<int>(args.size());
+    benchmark::Initialize(&args_count, args.data());
+    if (benchmark::ReportUnrecognizedArguments(args_count, args.data()))
+    {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
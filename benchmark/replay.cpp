@@ -0,0 +1,299 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+/* xsql-replay executes the cells of a notebook or of a SQL script with an
+   in-process interpreter, several times, and reports the latency of each
+   cell, the number of bytes published and the peak resident memory.
+
+   usage: xsql-replay [--runs N] [--json report.json] file.ipynb|file.sql
+
+   Relative paths in the cells (e.g. the database of a %LOAD magic) are
+   resolved from the directory of the replayed file. */
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "nlohmann/json.hpp"
+
+#include "in_process_kernel.hpp"
+
+namespace fs = std::filesystem;
+namespace nl = nlohmann;
+
+namespace
+{
+    std::size_t peak_rss_bytes()
+    {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters;
+        GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+        return counters.PeakWorkingSetSize;
+#else
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        return static_cast<std::size_t>(usage.ru_maxrss);
+#else
+        return static_cast<std::size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+    }
+
+    std::string read_file(const fs::path& path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in.good())
+        {
+            throw std::runtime_error("can't read " + path.string());
+        }
+        std::stringstream ss;
+        ss << in.rdbuf();
+        return ss.str();
+    }
+
+    bool is_blank(const std::string& s)
+    {
+        return std::all_of(s.begin(), s.end(), [](unsigned char c) { return std::isspace(c); });
+    }
+
+    std::vector<std::string> notebook_cells(const std::string& content)
+    {
+        std::vector<std::string> cells;
+        nl::json notebook = nl::json::parse(content);
+        for (const auto& cell : notebook.at("cells"))
+        {
+            if (cell.value("cell_type", "") != "code")
+            {
+                continue;
+            }
+            std::string source;
+            const auto& src = cell.at("source");
+            if (src.is_array())
+            {
+                for (const auto& line : src)
+                {
+                    source += line.get<std::string>();
+                }
+            }
+            else
+            {
+                source = src.get<std::string>();
+            }
+            if (!is_blank(source))
+            {
+                cells.push_back(source);
+            }
+        }
+        return cells;
+    }
+
+    /* Cells of a SQL script are separated by "-- %%" lines when there are
+       some, otherwise by lines ending with a semicolon. */
+    std::vector<std::string> script_cells(const std::string& content)
+    {
+        const bool has_markers = content.find("-- %%") != std::string::npos;
+        std::vector<std::string> cells;
+        std::string current;
+        std::istringstream iss(content);
+        std::string line;
+
+        auto push = [&]() {
+            if (!is_blank(current))
+            {
+                cells.push_back(current);
+            }
+            current.clear();
+        };
+
+        while (std::getline(iss, line))
+        {
+            if (has_markers && line.compare(0, 5, "-- %%") == 0)
+            {
+                push();
+                continue;
+            }
+            current += line + "\n";
+            auto last = line.find_last_not_of(" \t\r");
+            if (!has_markers && last != std::string::npos && line[last] == ';')
+            {
+                push();
+            }
+        }
+        push();
+        return cells;
+    }
+
+    struct cell_report
+    {
+        std::string source;
+        std::vector<double> seconds;
+        std::size_t errors = 0;
+        std::string last_error;
+    };
+
+    double percentile(std::vector<double> values, double q)
+    {
+        if (values.empty())
+        {
+            return 0.;
+        }
+        std::sort(values.begin(), values.end());
+        auto rank = static_cast<std::size_t>(q * static_cast<double>(values.size() - 1) + 0.5);
+        return values[rank];
+    }
+
+    void usage()
+    {
+        std::cerr << "usage: xsql-replay [--runs N] [--json report.json] file.ipynb|file.sql" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int runs = 5;
+    std::string json_path;
+    std::string input;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--runs" && i + 1 < argc)
+        {
+            runs = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg == "--json" && i + 1 < argc)
+        {
+            json_path = fs::absolute(argv[++i]).string();
+        }
+        else if (arg == "-h" || arg == "--help")
+        {
+            usage();
+            return 0;
+        }
+        else
+        {
+            input = arg;
+        }
+    }
+    if (input.empty())
+    {
+        usage();
+        return 1;
+    }
+
+    fs::path path = fs::absolute(input);
+    std::string content = read_file(path);
+    std::vector<std::string> sources = path.extension() == ".ipynb" ? notebook_cells(content)
+                                                                     : script_cells(content);
+    fs::current_path(path.parent_path());
+
+    std::vector<cell_report> cells(sources.size());
+    std::vector<double> run_seconds;
+    std::vector<std::size_t> run_bytes;
+    for (std::size_t c = 0; c != sources.size(); ++c)
+    {
+        cells[c].source = sources[c];
+    }
+
+    using clock = std::chrono::steady_clock;
+    for (int run = 0; run != runs; ++run)
+    {
+        // a fresh kernel per run, as a user restarting it would get
+        xeus_sql::in_process_kernel kernel;
+        const auto run_start = clock::now();
+        for (auto& cell : cells)
+        {
+            const auto start = clock::now();
+            try
+            {
+                kernel.execute(cell.source);
+            }
+            catch (const std::exception& e)
+            {
+                ++cell.errors;
+                cell.last_error = e.what();
+            }
+            cell.seconds.push_back(std::chrono::duration<double>(clock::now() - start).count());
+        }
+        run_seconds.push_back(std::chrono::duration<double>(clock::now() - run_start).count());
+        run_bytes.push_back(kernel.published_bytes());
+    }
+
+    const std::size_t peak_rss = peak_rss_bytes();
+
+    std::cout << std::fixed << std::setprecision(3)
+              << "Replayed " << cells.size() << " cells of " << path.filename().string()
+              << " " << runs << " times\n\n"
+              << std::setw(5) << "cell" << std::setw(12) << "min (ms)" << std::setw(12) << "p50 (ms)"
+              << std::setw(12) << "p90 (ms)" << std::setw(12) << "max (ms)" << std::setw(8) << "errors"
+              << "  source\n";
+
+    nl::json report_cells = nl::json::array();
+    for (std::size_t c = 0; c != cells.size(); ++c)
+    {
+        const cell_report& cell = cells[c];
+        std::string first_line = cell.source.substr(0, cell.source.find('\n'));
+        if (first_line.size() > 50)
+        {
+            first_line = first_line.substr(0, 47) + "...";
+        }
+        std::cout << std::setw(5) << c
+                  << std::setw(12) << percentile(cell.seconds, 0.) * 1e3
+                  << std::setw(12) << percentile(cell.seconds, 0.5) * 1e3
+                  << std::setw(12) << percentile(cell.seconds, 0.9) * 1e3
+                  << std::setw(12) << percentile(cell.seconds, 1.) * 1e3
+                  << std::setw(8) << cell.errors
+                  << "  " << first_line << "\n";
+        report_cells.push_back({
+            {"source", cell.source},
+            {"seconds", cell.seconds},
+            {"p50", percentile(cell.seconds, 0.5)},
+            {"p90", percentile(cell.seconds, 0.9)},
+            {"errors", cell.errors},
+            {"last_error", cell.last_error}
+        });
+    }
+
+    std::cout << "\ntotal p50: " << percentile(run_seconds, 0.5) * 1e3 << " ms"
+              << ", published: " << (run_bytes.empty() ? 0 : run_bytes.back()) << " bytes per run"
+              << ", peak RSS: " << peak_rss / (1024 * 1024) << " MiB" << std::endl;
+
+    if (!json_path.empty())
+    {
+        nl::json report = {
+            {"file", path.string()},
+            {"runs", runs},
+            {"cells", report_cells},
+            {"run_seconds", run_seconds},
+            {"published_bytes", run_bytes},
+            {"peak_rss_bytes", peak_rss}
+        };
+        std::ofstream out(json_path);
+        out << report.dump(2) << std::endl;
+    }
+
+    const bool failed = std::any_of(cells.begin(), cells.end(),
+                                    [](const cell_report& c) { return c.errors != 0; });
+    return failed ? 2 : 0;
+}
@@ -0,0 +1,21 @@
+# - Find DuckDB
+# Find the DuckDB C API header and library
+#
+#  DUCKDB_INCLUDE_DIR - where to find duckdb.h
+#  DUCKDB_LIBRARIES   - List of libraries when using DuckDB.
+#  DUCKDB_FOUND       - True if DuckDB found.
+
+FIND_PATH(DUCKDB_INCLUDE_DIR duckdb.h)
+FIND_LIBRARY(DUCKDB_LIBRARY NAMES duckdb)
+
+INCLUDE(FindPackageHandleStandardArgs)
+FIND_PACKAGE_HANDLE_STANDARD_ARGS(DuckDB DEFAULT_MSG DUCKDB_LIBRARY DUCKDB_INCLUDE_DIR)
+
+IF (DUCKDB_FOUND)
+  SET(DUCKDB_LIBRARIES ${DUCKDB_LIBRARY})
+ENDIF (DUCKDB_FOUND)
+
+MARK_AS_ADVANCED(
+  DUCKDB_LIBRARY
+  DUCKDB_INCLUDE_DIR
+  )
@@ -0,0 +1,72 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XEUS_SQL_COLUMN_SUMMARY_HPP
+#define XEUS_SQL_COLUMN_SUMMARY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "xeus_sql_config.hpp"
+#include "result_set.hpp"
+
+namespace xeus_sql
+{
+    /* Approximate count of distinct values in 4 KiB of registers, with a
+       standard error of about 1.6% */
+    class XEUS_SQL_API hyperloglog
+    {
+    public:
+
+        static constexpr unsigned precision = 12;
+
+        hyperloglog();
+
+        /* The hash must be uniformly distributed over its 64 bits */
+        void add(std::uint64_t hash);
+        double estimate() const;
+
+    private:
+
+        std::vector<std::uint8_t> m_registers;
+    };
+
+    struct column_summary
+    {
+        std::string name;
+        bool numeric = false;
+        /* Number of non NULL cells */
+        std::size_t count = 0;
+        std::size_t nulls = 0;
+        /* Infinite values, counted in count but left out of the bounds,
+           the moments and the histogram. NaN values count as NULL. */
+        std::size_t non_finite = 0;
+        double distinct = 0.;
+        std::string min;
+        std::string max;
+        /* Numeric columns only */
+        double mean = 0.;
+        double stddev = 0.;
+        /* Counts of equal width bins between min and max, numeric columns only */
+        std::vector<std::size_t> histogram;
+    };
+
+    /* Statistics of every column of a result. Cells are read once: numeric
+       cells are parsed into a contiguous array of doubles, on which the
+       moments, the bounds and the histogram are computed. */
+    XEUS_SQL_API std::vector<column_summary> summarize_columns(const result_set& result,
+                                                               std::size_t bins = 10);
+
+    /* One row per column, the histogram being drawn with block characters */
+    XEUS_SQL_API result_set summary_table(const std::vector<column_summary>& summaries);
+}
+
+#endif
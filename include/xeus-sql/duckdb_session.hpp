@@ -0,0 +1,50 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XEUS_SQL_DUCKDB_SESSION_HPP
+#define XEUS_SQL_DUCKDB_SESSION_HPP
+
+#include <memory>
+#include <string>
+
+#include "xeus_sql_config.hpp"
+#include "query_profile.hpp"
+#include "result_set.hpp"
+
+namespace xeus_sql
+{
+    /* In-process DuckDB database, used instead of a SOCI session. Results
+       are read one data chunk at a time and each column vector is formatted
+       by a function chosen once for its type, without going through
+       soci::row. Throws when xeus-sql is built without DuckDB. */
+    class XEUS_SQL_API duckdb_session
+    {
+    public:
+
+        /* An empty path or ":memory:" opens an in-memory database */
+        explicit duckdb_session(const std::string& path);
+        ~duckdb_session();
+
+        duckdb_session(const duckdb_session&) = delete;
+        duckdb_session& operator=(const duckdb_session&) = delete;
+
+        /* Runs a query and appends its rows to `result`, which is described
+           from the columns of the query */
+        void query(const std::string& sql, result_set& result, query_profile& profile);
+        /* Runs a statement and discards its result */
+        void execute(const std::string& sql);
+
+    private:
+
+        struct impl;
+        std::unique_ptr<impl> m_impl;
+    };
+}
+
+#endif
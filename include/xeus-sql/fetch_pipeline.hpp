@@ -0,0 +1,55 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XEUS_SQL_FETCH_PIPELINE_HPP
+#define XEUS_SQL_FETCH_PIPELINE_HPP
+
+#include <cstddef>
+
+#include "soci/soci.h"
+
+#include "xeus_sql_config.hpp"
+#include "query_profile.hpp"
+#include "result_set.hpp"
+
+namespace xeus_sql
+{
+    struct fetch_options
+    {
+        /* Threads formatting the fetched rows, taken from a pool kept
+           across queries. 0 formats them on the fetching thread. */
+        std::size_t format_threads = 0;
+        /* Rows handed at once to a formatting thread */
+        std::size_t batch_rows = 1024;
+        /* Batches waiting for each formatting thread before the fetch
+           blocks, which bounds the memory of the rows in flight */
+        std::size_t queue_depth = 4;
+    };
+
+    /* Number of formatting threads from the XSQL_FORMAT_THREADS environment
+       variable, by default 2 or less on machines with few cores */
+    XEUS_SQL_API std::size_t default_format_threads();
+
+    /* Fetches the rows of a query into `result`.
+
+       Rows are fetched on the calling thread, which is the only one using
+       the session. The first batch is formatted inline so that small
+       results don't pay for the threads; the next ones are copied out of
+       the SOCI row into batches that are formatted by the worker threads
+       while the next rows are being fetched, then appended to `result` in
+       order. Time spent fetching (including waiting for a worker when all
+       the queues are full) goes to the fetch phase of `profile`, time spent
+       waiting for the last batches goes to the format phase. */
+    XEUS_SQL_API void fetch_rows(soci::rowset<soci::row>& rows,
+                                 result_set& result,
+                                 const fetch_options& options,
+                                 query_profile& profile);
+}
+
+#endif
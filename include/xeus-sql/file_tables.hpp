@@ -0,0 +1,114 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XEUS_SQL_FILE_TABLES_HPP
+#define XEUS_SQL_FILE_TABLES_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "soci/soci.h"
+
+#include "xeus_sql_config.hpp"
+
+namespace xeus_sql
+{
+    /* Read-only memory mapping of a whole file */
+    class XEUS_SQL_API mapped_file
+    {
+    public:
+
+        explicit mapped_file(const std::string& path);
+        ~mapped_file();
+
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+
+        std::string_view data() const;
+
+    private:
+
+        const char* m_data = nullptr;
+        std::size_t m_size = 0;
+#ifdef _WIN32
+        void* m_file = nullptr;
+        void* m_mapping = nullptr;
+#endif
+    };
+
+    enum class csv_type
+    {
+        integer,
+        real,
+        text
+    };
+
+    struct csv_schema
+    {
+        char delimiter = ',';
+        std::vector<std::string> names;
+        std::vector<csv_type> types;
+        /* Offset of the first row after the header */
+        std::size_t data_offset = 0;
+    };
+
+    /* Reads the header of a CSV file and infers the type of the columns from
+       the first `sample_rows` rows: a column is an integer or a real when all
+       its non empty sampled cells are. The delimiter is the most frequent of
+       , ; tab and | in the header. */
+    XEUS_SQL_API csv_schema infer_csv_schema(std::string_view data, std::size_t sample_rows = 1000);
+
+    /* Forward-only cursor over the rows of a CSV buffer. Fields are split
+       lazily, up to the last one requested, and the rest of a row is only
+       scanned for its end. */
+    class XEUS_SQL_API csv_reader
+    {
+    public:
+
+        csv_reader(std::string_view data, char delimiter, std::size_t offset = 0);
+
+        /* Moves to the next row, false at the end of the data */
+        bool next();
+        /* Offset of the current row in the data */
+        std::size_t row_offset() const;
+        /* Raw field of the current row, quotes included, empty when the row
+           has less fields */
+        std::string_view field(std::size_t column);
+        /* Number of fields of the current row */
+        std::size_t field_count();
+
+        /* Removes the quotes of a raw field and unescapes "" */
+        static std::string_view unquote(std::string_view field, std::string& buffer);
+
+    private:
+
+        bool split_field();
+
+        std::string_view m_data;
+        char m_delimiter;
+        std::size_t m_next = 0;
+        std::size_t m_row = 0;
+        // position of the next field to split in the current row,
+        // npos once the end of the row is reached
+        std::size_t m_pos = 0;
+        std::vector<std::pair<std::size_t, std::size_t>> m_fields;
+    };
+
+    /* Exposes the CSV and TSV files of a directory as read-only virtual
+       tables of a SQLite session, named after the files. Returns the names
+       of the tables. */
+    XEUS_SQL_API std::vector<std::string> load_file_tables(soci::session& session,
+                                                           const std::string& directory);
+}
+
+#endif
@@ -0,0 +1,130 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XEUS_SQL_QUERY_METRICS_HPP
+#define XEUS_SQL_QUERY_METRICS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+
+#include "nlohmann/json.hpp"
+
+#include "xeus_sql_config.hpp"
+
+namespace nl = nlohmann;
+
+namespace xeus_sql
+{
+    /* Normalizes a SQL statement so that queries differing only by their
+       literals, comments, case or whitespace share the same fingerprint.
+       e.g. "SELECT * FROM t WHERE id = 42" -> "select * from t where id = ?" */
+    XEUS_SQL_API std::string fingerprint(const std::string& sql);
+
+    /* Log-linear latency histogram in the spirit of HdrHistogram: values are
+       recorded in microseconds into 16 sub-buckets per power of two, which
+       bounds the relative error to ~6%. Recording is wait-free. */
+    class XEUS_SQL_API latency_histogram
+    {
+    public:
+
+        static constexpr std::size_t sub_buckets = 16;
+        static constexpr std::size_t magnitudes = 40;
+        static constexpr std::size_t bucket_count = sub_buckets * (magnitudes + 1);
+
+        latency_histogram() = default;
+
+        void record(std::uint64_t micros);
+        std::uint64_t count() const;
+        std::uint64_t sum() const;
+        std::uint64_t max() const;
+        std::uint64_t percentile(double q) const;
+        void reset();
+
+        static std::size_t bucket_index(std::uint64_t micros);
+        static std::uint64_t bucket_value(std::size_t index);
+
+    private:
+
+        std::array<std::atomic<std::uint64_t>, bucket_count> m_buckets = {};
+        std::atomic<std::uint64_t> m_count = {0};
+        std::atomic<std::uint64_t> m_sum = {0};
+        std::atomic<std::uint64_t> m_max = {0};
+    };
+
+    /* Counters kept for every query fingerprint */
+    struct XEUS_SQL_API query_stats
+    {
+        std::atomic<std::uint64_t> queries = {0};
+        std::atomic<std::uint64_t> rows = {0};
+        std::atomic<std::uint64_t> bytes = {0};
+        std::atomic<std::uint64_t> errors = {0};
+        std::atomic<std::uint64_t> cache_hits = {0};
+        latency_histogram latency;
+
+        void reset();
+    };
+
+    class XEUS_SQL_API query_metrics
+    {
+    public:
+
+        using duration = std::chrono::steady_clock::duration;
+
+        /* Beyond this number of fingerprints, queries are accounted in a
+           single "other" entry to bound memory and label cardinality. */
+        static constexpr std::size_t max_fingerprints = 1000;
+
+        query_metrics() = default;
+        ~query_metrics();
+
+        query_metrics(const query_metrics&) = delete;
+        query_metrics& operator=(const query_metrics&) = delete;
+
+        void record_query(const std::string& sql,
+                          duration elapsed,
+                          std::size_t rows,
+                          std::size_t bytes);
+        void record_error(const std::string& sql);
+        void record_cache_hit(const std::string& sql);
+        void reset();
+
+        /* Plain text and HTML tables shown by the %STATS magic */
+        nl::json to_bundle() const;
+        std::string to_prometheus() const;
+
+        /* Periodically writes the prometheus exposition to `path` from a
+           background thread. An interval of zero disables the dump. */
+        void start_dump(const std::string& path, std::chrono::seconds interval);
+        void stop_dump();
+        void dump(const std::string& path) const;
+
+    private:
+
+        query_stats& stats_for(const std::string& sql);
+
+        mutable std::shared_mutex m_mutex;
+        std::map<std::string, std::unique_ptr<query_stats>> m_stats;
+
+        std::thread m_dump_thread;
+        std::mutex m_dump_mutex;
+        std::condition_variable m_dump_cv;
+        bool m_stop_dump = false;
+    };
+}
+
+#endif
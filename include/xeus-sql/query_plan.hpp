@@ -0,0 +1,114 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XEUS_SQL_QUERY_PLAN_HPP
+#define XEUS_SQL_QUERY_PLAN_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "soci/soci.h"
+
+#include "xeus_sql_config.hpp"
+
+namespace xeus_sql
+{
+    /* What the planner of the database expects from a query */
+    struct plan_estimate
+    {
+        double rows = 0.;
+        /* In the units of the planner, 0 if it doesn't report one */
+        double cost = 0.;
+    };
+
+    /* One operation of a query plan, the values unknown to the backend
+       are negative */
+    struct plan_node
+    {
+        std::string operation;
+        /* Conditions, keys and other details of the operation */
+        std::string detail;
+        double estimated_rows = -1.;
+        double cost = -1.;
+        /* Rows per loop, times for all the loops including the children,
+           measured by EXPLAIN ANALYZE */
+        double actual_rows = -1.;
+        double loops = -1.;
+        double time_ms = -1.;
+        /* Pages read from the cache or the disk */
+        double buffers = -1.;
+        std::vector<plan_node> children;
+    };
+
+    struct query_plan
+    {
+        plan_node root;
+        double planning_ms = -1.;
+        double execution_ms = -1.;
+    };
+
+    /* Output of EXPLAIN (FORMAT JSON) with or without ANALYZE and BUFFERS */
+    XEUS_SQL_API query_plan parse_postgresql_plan(const std::string& json);
+    /* Output of EXPLAIN FORMAT=JSON */
+    XEUS_SQL_API query_plan parse_mysql_plan(const std::string& json);
+    /* Output of EXPLAIN ANALYZE, which MySQL only writes as a tree of
+       "-> operation  (cost=... rows=...) (actual time=...)" lines */
+    XEUS_SQL_API query_plan parse_mysql_analyze(const std::string& tree);
+    /* Rows of EXPLAIN QUERY PLAN: id, parent and detail */
+    struct sqlite_plan_row
+    {
+        long long id;
+        long long parent;
+        std::string detail;
+    };
+    XEUS_SQL_API query_plan parse_sqlite_plan(const std::vector<sqlite_plan_row>& rows);
+
+    /* Runs the EXPLAIN command of the backend of `session`. ANALYZE runs
+       the query, SQLite only measures the whole query. */
+    XEUS_SQL_API query_plan explain_query(soci::session& session, const std::string& sql, bool analyze);
+
+    /* Indented tree, and nested collapsible HTML lists where the nodes
+       taking the largest share of the time (or of the cost without
+       ANALYZE) are highlighted */
+    XEUS_SQL_API std::string plan_to_text(const query_plan& plan);
+    XEUS_SQL_API std::string plan_to_html(const query_plan& plan);
+
+    /* Output of EXPLAIN (FORMAT JSON) */
+    XEUS_SQL_API plan_estimate parse_postgresql_estimate(const std::string& json);
+    /* Output of EXPLAIN FORMAT=JSON, the rows are the largest number of
+       rows produced by a join */
+    XEUS_SQL_API plan_estimate parse_mysql_estimate(const std::string& json);
+    /* Tables read in full according to the detail column of EXPLAIN QUERY
+       PLAN ("SCAN table"), SQLite doesn't estimate rows. The aliases that
+       SQLite reports are resolved to tables with the FROM and JOIN clauses
+       of `sql`. */
+    XEUS_SQL_API std::vector<std::string> sqlite_scanned_tables(const std::vector<std::string>& details,
+                                                                const std::string& sql = "");
+
+    /* Runs the EXPLAIN command of the backend of `session`. SQLite rows
+       are the product of the largest rowids of the tables read in full.
+       Throws for the backends without estimates. */
+    XEUS_SQL_API plan_estimate estimate_query(soci::session& session, const std::string& sql);
+
+    /* `sql` returning at most `rows` rows */
+    XEUS_SQL_API std::string limit_query(const std::string& sql, std::size_t rows);
+
+    /* Runaway SELECT statements are limited or confirmed before they run */
+    struct guard_options
+    {
+        enum action_type { limit, ask };
+
+        /* 0 disables the guard */
+        std::size_t max_rows = 0;
+        action_type action = limit;
+    };
+}
+
+#endif
@@ -0,0 +1,172 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XEUS_SQL_QUERY_PROFILE_HPP
+#define XEUS_SQL_QUERY_PROFILE_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#include "nlohmann/json.hpp"
+
+namespace nl = nlohmann;
+
+namespace xeus_sql
+{
+    /* Phases of a cell execution, in the order they happen */
+    enum class query_phase : std::size_t
+    {
+        execute = 0,
+        fetch,
+        format,
+        render_text,
+        render_html,
+        count
+    };
+
+    inline const char* phase_name(query_phase phase)
+    {
+        static const std::array<const char*, static_cast<std::size_t>(query_phase::count)> names =
+        {
+            "execute", "fetch", "format", "render_text", "render_html"
+        };
+        return names[static_cast<std::size_t>(phase)];
+    }
+
+    /* Wall time spent in each phase of a query plus the volume of data
+       that went through the kernel. */
+    struct query_profile
+    {
+        using clock = std::chrono::steady_clock;
+
+        std::array<double, static_cast<std::size_t>(query_phase::count)> seconds = {};
+        std::size_t rows = 0;
+        std::size_t bytes_formatted = 0;
+        std::size_t bytes_held = 0;
+        std::size_t peak_bytes = 0;
+        /* Memory obtained by the arena of the result, at the end of the
+           fetch and at its highest, and the part of it in spill files */
+        std::size_t arena_bytes = 0;
+        std::size_t arena_peak_bytes = 0;
+        std::size_t spilled_bytes = 0;
+        /* The result was read from the disk cache */
+        bool cached = false;
+
+        void add(query_phase phase, clock::duration d)
+        {
+            seconds[static_cast<std::size_t>(phase)] +=
+                std::chrono::duration<double>(d).count();
+        }
+
+        double get(query_phase phase) const
+        {
+            return seconds[static_cast<std::size_t>(phase)];
+        }
+
+        /* Accounts for memory kept alive until the end of the cell */
+        void hold(std::size_t bytes)
+        {
+            bytes_held += bytes;
+            peak_bytes = std::max(peak_bytes, bytes_held);
+        }
+
+        double total() const
+        {
+            double res = 0.;
+            for (double s : seconds)
+            {
+                res += s;
+            }
+            return res;
+        }
+
+        double rows_per_second() const
+        {
+            double fetch_time = get(query_phase::fetch) + get(query_phase::format);
+            return fetch_time > 0. ? static_cast<double>(rows) / fetch_time : 0.;
+        }
+
+        /* Human readable summary appended to the result footer */
+        std::string footer() const
+        {
+            std::stringstream ss;
+            ss << std::fixed << std::setprecision(4) << "Profile:";
+            for (std::size_t i = 0; i != seconds.size(); ++i)
+            {
+                ss << " " << phase_name(static_cast<query_phase>(i)) << "=" << seconds[i] << "s";
+            }
+            ss << std::setprecision(0)
+               << " | " << rows_per_second() << " rows/sec"
+               << " | " << bytes_formatted << " bytes formatted"
+               << " | " << peak_bytes << " peak bytes held"
+               << " | " << arena_bytes << " arena bytes (" << arena_peak_bytes << " peak, "
+               << spilled_bytes << " spilled)";
+            if (cached)
+            {
+                ss << " | from cache";
+            }
+            return ss.str();
+        }
+
+        nl::json to_json() const
+        {
+            nl::json phases = nl::json::object();
+            for (std::size_t i = 0; i != seconds.size(); ++i)
+            {
+                phases[phase_name(static_cast<query_phase>(i))] = seconds[i];
+            }
+            return {
+                {"phases", phases},
+                {"total", total()},
+                {"rows", rows},
+                {"rows_per_second", rows_per_second()},
+                {"bytes_formatted", bytes_formatted},
+                {"peak_bytes", peak_bytes},
+                {"arena_bytes", arena_bytes},
+                {"arena_peak_bytes", arena_peak_bytes},
+                {"spilled_bytes", spilled_bytes},
+                {"cached", cached}
+            };
+        }
+    };
+
+    /* Adds the lifetime of the timer to one phase of a profile */
+    class phase_timer
+    {
+    public:
+
+        phase_timer(query_profile& profile, query_phase phase)
+            : m_profile(profile)
+            , m_phase(phase)
+            , m_start(query_profile::clock::now())
+        {
+        }
+
+        ~phase_timer()
+        {
+            m_profile.add(m_phase, query_profile::clock::now() - m_start);
+        }
+
+        phase_timer(const phase_timer&) = delete;
+        phase_timer& operator=(const phase_timer&) = delete;
+
+    private:
+
+        query_profile& m_profile;
+        query_phase m_phase;
+        query_profile::clock::time_point m_start;
+    };
+}
+
+#endif
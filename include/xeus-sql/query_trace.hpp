@@ -0,0 +1,82 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XEUS_SQL_QUERY_TRACE_HPP
+#define XEUS_SQL_QUERY_TRACE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "xeus_sql_config.hpp"
+
+namespace xeus_sql
+{
+    /* Opt-in tracing of the kernel in the Chrome trace-event format.
+       Spans are recorded into a lock-free ring buffer owned by the
+       recording thread; when a buffer is full, new spans are dropped
+       until the next flush. */
+
+    XEUS_SQL_API void set_tracing(bool enabled);
+    XEUS_SQL_API bool tracing_enabled();
+
+    /* Returns the current time of the trace clock in microseconds */
+    XEUS_SQL_API std::int64_t trace_now();
+
+    /* Records a complete span. `name` must have static storage duration. */
+    XEUS_SQL_API void record_span(const char* name,
+                                  std::int64_t start,
+                                  std::int64_t end,
+                                  std::int64_t arg = -1);
+
+    /* Drains the buffers of all threads into a JSON file loadable in
+       chrome://tracing or Perfetto. Returns the number of spans written. */
+    XEUS_SQL_API std::size_t write_trace(const std::string& path);
+
+    /* Number of thread buffers held: the buffer of an exited thread is
+       released once its spans are written */
+    XEUS_SQL_API std::size_t trace_buffers();
+
+    /* Records the lifetime of the object as a span when tracing is on */
+    class trace_span
+    {
+    public:
+
+        explicit trace_span(const char* name, std::int64_t arg = -1)
+            : m_name(name)
+            , m_arg(arg)
+            , m_start(tracing_enabled() ? trace_now() : -1)
+        {
+        }
+
+        ~trace_span()
+        {
+            if (m_start >= 0)
+            {
+                record_span(m_name, m_start, trace_now(), m_arg);
+            }
+        }
+
+        void set_arg(std::int64_t arg)
+        {
+            m_arg = arg;
+        }
+
+        trace_span(const trace_span&) = delete;
+        trace_span& operator=(const trace_span&) = delete;
+
+    private:
+
+        const char* m_name;
+        std::int64_t m_arg;
+        std::int64_t m_start;
+    };
+}
+
+#endif
@@ -0,0 +1,100 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XEUS_SQL_RESULT_ARENA_HPP
+#define XEUS_SQL_RESULT_ARENA_HPP
+
+#include <cstddef>
+#include <memory_resource>
+#include <string>
+#include <unordered_set>
+
+#include "xeus_sql_config.hpp"
+
+namespace xeus_sql
+{
+    /* Once the memory mapped by the arenas of the kernel exceeds `budget`
+       bytes, the next large blocks are mapped from unlinked temporary files
+       of `directory`: the system writes their pages to the file under
+       memory pressure and reads them back when the cells are accessed. */
+    struct spill_options
+    {
+        // 0 never spills
+        std::size_t budget = 0;
+        // default_spill_directory() when empty
+        std::string directory;
+    };
+
+    /* The directory of the result cache ($XDG_CACHE_HOME/xeus-sql or
+       ~/.cache/xeus-sql) rather than the temporary directory, which is
+       often a tmpfs: files mapped from a tmpfs stay in memory. */
+    XEUS_SQL_API std::string default_spill_directory();
+
+    /* Called with the size of every block mapped (positive) or unmapped
+       (negative) by the arenas, which bypass operator new: tools counting
+       the allocations, such as the benchmarks, add them to their count */
+    using mapping_observer = void (*)(std::ptrdiff_t bytes);
+    XEUS_SQL_API void set_mapping_observer(mapping_observer observer);
+
+    /* Returns a warning when spilling is enabled to a directory which
+       doesn't relieve the memory (a tmpfs), an empty string otherwise */
+    XEUS_SQL_API std::string set_spill_options(const spill_options& options);
+    XEUS_SQL_API spill_options get_spill_options();
+    /* Bytes held in memory by all the arenas, spilled blocks excluded */
+    XEUS_SQL_API std::size_t resident_arena_bytes();
+
+    /* Memory of one result. Small blocks are pooled, blocks of 64 KiB and
+       more are mapped from the system directly: they don't go through the
+       heap, so they are returned to the system as soon as the result is
+       dropped or a buffer outgrows them, whatever the state of the heap. */
+    class XEUS_SQL_API result_arena
+    {
+    public:
+
+        static constexpr std::size_t mapping_threshold = std::size_t(64) << 10;
+
+        result_arena();
+
+        result_arena(const result_arena&) = delete;
+        result_arena& operator=(const result_arena&) = delete;
+
+        std::pmr::memory_resource* resource();
+
+        /* Bytes currently obtained from the system */
+        std::size_t reserved() const;
+        /* Highest value of reserved() */
+        std::size_t peak() const;
+        /* Part of reserved() mapped from spill files */
+        std::size_t spilled() const;
+
+    private:
+
+        class system_resource : public std::pmr::memory_resource
+        {
+        public:
+
+            std::size_t reserved = 0;
+            std::size_t peak = 0;
+            std::size_t spilled = 0;
+
+        private:
+
+            void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+            void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+            bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+            std::unordered_set<void*> m_spilled_blocks;
+        };
+
+        system_resource m_system;
+        std::pmr::unsynchronized_pool_resource m_pool;
+    };
+}
+
+#endif
@@ -0,0 +1,80 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XEUS_SQL_RESULT_CACHE_HPP
+#define XEUS_SQL_RESULT_CACHE_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "xeus_sql_config.hpp"
+#include "result_set.hpp"
+
+namespace xeus_sql
+{
+    /* Collapses the whitespace outside of quotes and drops the trailing
+       semicolons, so that reformatting a query doesn't miss the cache */
+    XEUS_SQL_API std::string normalize_sql(std::string_view sql);
+
+    /* "90", "90s", "15m", "1h" or "2d" */
+    XEUS_SQL_API std::chrono::seconds parse_ttl(const std::string& ttl);
+
+    /* Results kept on disk across kernel restarts, one file per query
+       keyed by the connection and the normalized query. A file holds the
+       expiry date, the key and the image of the result (see
+       result_set::write): a hit maps the file and copies the image into a
+       new result.
+
+       The files of the least recently used queries are removed once the
+       directory exceeds `capacity` bytes. Several kernels can share the
+       directory, files are written aside and renamed. */
+    class XEUS_SQL_API result_cache
+    {
+    public:
+
+        static constexpr std::size_t default_capacity = std::size_t(1024) << 20;
+
+        /* XSQL_CACHE_DIR, $XDG_CACHE_HOME/xeus-sql or ~/.cache/xeus-sql */
+        static std::string default_directory();
+
+        result_cache();
+
+        void configure(const std::string& directory, std::size_t capacity);
+
+        const std::string& directory() const;
+        std::size_t capacity() const;
+
+        /* The cached result of a query, nullptr if it is missing or expired */
+        std::shared_ptr<const result_set> load(const std::string& connection,
+                                               const std::string& sql) const;
+        void store(const std::string& connection,
+                   const std::string& sql,
+                   const result_set& result,
+                   std::chrono::seconds ttl);
+
+        /* Number of files and bytes in the directory */
+        std::size_t entries() const;
+        std::size_t size() const;
+        /* Removes every cached result, returns the number of bytes freed */
+        std::size_t clear();
+
+    private:
+
+        std::string path_of(const std::string& key) const;
+        void evict();
+
+        std::string m_directory;
+        std::size_t m_capacity;
+    };
+}
+
+#endif
@@ -0,0 +1,74 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XEUS_SQL_RESULT_DIFF_HPP
+#define XEUS_SQL_RESULT_DIFF_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "xeus_sql_config.hpp"
+#include "result_set.hpp"
+
+namespace xeus_sql
+{
+    struct row_change
+    {
+        enum kind_type { added, changed, removed } kind;
+        /* Row of the new result, or of the previous one for removed rows */
+        std::size_t row;
+    };
+
+    /* Changes between successive results of a query. Rows are identified
+       by the hash of their key columns and compared by the hash of all
+       their cells: the values of dictionary-encoded columns are hashed
+       once, so a refresh costs one pass over the cells and one lookup per
+       row. Rows whose key appears several times are matched in order. */
+    class XEUS_SQL_API result_diff
+    {
+    public:
+
+        /* Without key, a row is identified by all its cells and an update
+           shows as a removed and an added row */
+        explicit result_diff(std::vector<std::string> key = {});
+
+        /* Compares `result` with the result of the previous call, the
+           first result only has added rows */
+        std::vector<row_change> update(std::shared_ptr<const result_set> result);
+
+        /* The changed rows, preceded by a "change" column of +, ~ or - */
+        result_set changes_table(const std::vector<row_change>& changes) const;
+
+    private:
+
+        struct row_entry
+        {
+            std::uint64_t hash;
+            std::size_t row;
+        };
+
+        using row_map = std::unordered_map<std::uint64_t, row_entry>;
+
+        /* Hashes of the key columns and of all the columns of each row */
+        void hash_rows(const result_set& result,
+                       std::vector<std::uint64_t>& keys,
+                       std::vector<std::uint64_t>& hashes) const;
+
+        std::vector<std::string> m_key;
+        std::shared_ptr<const result_set> m_previous;
+        std::shared_ptr<const result_set> m_current;
+        row_map m_rows;
+    };
+}
+
+#endif
@@ -0,0 +1,113 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XEUS_SQL_RESULT_GRID_HPP
+#define XEUS_SQL_RESULT_GRID_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+#include "xeus/xcomm.hpp"
+
+#include "xeus_sql_config.hpp"
+#include "result_set.hpp"
+
+namespace nl = nlohmann;
+
+namespace xeus_sql
+{
+    struct grid_filter
+    {
+        std::size_t column;
+        /* One of contains, =, !=, <, <=, >, >= */
+        std::string op;
+        std::string value;
+    };
+
+    /* Sorted and filtered rows of a result set held by the kernel. Numeric
+       columns are compared as numbers, the other ones as strings. */
+    class XEUS_SQL_API result_view
+    {
+    public:
+
+        explicit result_view(std::shared_ptr<const result_set> result);
+
+        /* A negative column restores the order of the query */
+        void sort_by(long column, bool ascending);
+        void set_filters(std::vector<grid_filter> filters);
+
+        /* Number of rows left by the filters */
+        std::size_t size() const;
+        const result_set& result() const;
+
+        /* Name and type of the columns */
+        nl::json schema() const;
+        /* Cells of the rows [start, start + count) of the view, as an array
+           of rows */
+        nl::json window(std::size_t start, std::size_t count) const;
+
+    private:
+
+        void sort();
+        void filter();
+
+        std::shared_ptr<const result_set> m_result;
+        std::vector<grid_filter> m_filters;
+        long m_sort_column = -1;
+        bool m_ascending = true;
+        // indices in m_result of the rows in the sort order, empty when
+        // the view is not sorted, so that filtering doesn't sort again
+        std::vector<std::size_t> m_order;
+        // indices in m_result of the rows of the view
+        std::vector<std::size_t> m_rows;
+    };
+
+    /* Serves windows of a result view to the frontend over a comm, so that
+       only the visible rows of a large result are sent.
+
+       Requests sent by the frontend:
+         {"request": "window", "start": 0, "count": 100}
+         {"request": "sort", "column": 2, "ascending": false, ...}
+         {"request": "filter", "filters": [{"column": 0, "op": ">", "value": "10"}], ...}
+       Each request is answered with the requested window of the view:
+         {"response": "window", "start": 0, "total": 42, "rows": [[...], ...]} */
+    class XEUS_SQL_API result_grid
+    {
+    public:
+
+        static constexpr const char* target_name = "xsql_grid";
+        static constexpr const char* mime_type = "application/vnd.xsql.grid+json";
+        /* Maximum number of rows sent in a single message */
+        static constexpr std::size_t max_window = 1000;
+
+        result_grid(xeus::xcomm&& comm, std::shared_ptr<const result_set> result);
+
+        result_grid(const result_grid&) = delete;
+        result_grid& operator=(const result_grid&) = delete;
+
+        /* Content of the display data referencing the comm */
+        nl::json model() const;
+        bool closed() const;
+        void close();
+
+    private:
+
+        void handle_message(const xeus::xmessage& message);
+        nl::json reply(std::size_t start, std::size_t count) const;
+
+        xeus::xcomm m_comm;
+        result_view m_view;
+        bool m_closed = false;
+    };
+}
+
+#endif
@@ -0,0 +1,222 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XEUS_SQL_RESULT_SET_HPP
+#define XEUS_SQL_RESULT_SET_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <memory_resource>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "soci/soci.h"
+#include "xvega-bindings/xvega_bindings.hpp"
+
+#include "xeus_sql_config.hpp"
+#include "result_arena.hpp"
+
+namespace xeus_sql
+{
+    /* Cells are written in the arena of their result */
+    using cell_buffer = std::pmr::string;
+
+    /* Allocation-free formatting of cell values, appended to `out` */
+    XEUS_SQL_API void append_integer(std::string& out, long long value);
+    XEUS_SQL_API void append_integer(cell_buffer& out, long long value);
+    XEUS_SQL_API void append_unsigned(std::string& out, unsigned long long value);
+    XEUS_SQL_API void append_unsigned(cell_buffer& out, unsigned long long value);
+    /* Shortest representation that round-trips, e.g. 0.1 -> "0.1" */
+    XEUS_SQL_API void append_double(std::string& out, double value);
+    XEUS_SQL_API void append_double(cell_buffer& out, double value);
+    /* Parses the whole of `text` as a decimal number, NaN when it is not
+       one. Hexadecimal numbers and surrounding spaces are rejected. */
+    XEUS_SQL_API double parse_number(std::string_view text);
+    /* YYYY-MM-DD HH:MM:SS */
+    XEUS_SQL_API void append_date(std::string& out, const std::tm& value);
+    XEUS_SQL_API void append_date(cell_buffer& out, const std::tm& value);
+
+    XEUS_SQL_API bool is_numeric(soci::data_type type);
+
+    /* Formats the i-th value of a row, chosen once per column */
+    using cell_formatter = void (*)(cell_buffer& out, const soci::row& r, std::size_t i);
+
+    struct column_info
+    {
+        std::string name;
+        soci::data_type type;
+        cell_formatter format;
+    };
+
+    /* Interned values of a text column. Values are stored once in a single
+       buffer and looked up through an open addressing table of codes. */
+    class XEUS_SQL_API string_dictionary
+    {
+    public:
+
+        explicit string_dictionary(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+        /* Code of `value`, which is added if it is not known yet */
+        std::uint32_t intern(std::string_view value);
+        std::string_view value(std::uint32_t code) const;
+
+        std::size_t size() const;
+        /* Number of bytes of the values */
+        std::size_t bytes() const;
+        std::size_t memory() const;
+
+    private:
+
+        // images of results are read and written by result_set
+        friend class result_set;
+
+        void rehash(std::size_t slot_count);
+
+        std::pmr::string m_values;
+        std::pmr::vector<std::size_t> m_offsets;
+        std::pmr::vector<std::uint32_t> m_slots;
+    };
+
+    /* The formatted cells of a query result. Cells are stored row-major in a
+       single buffer, column metadata and formatters are resolved once when
+       the first row is described.
+
+       Text columns start dictionary-encoded: their cells are codes into a
+       dictionary of the distinct values, kept out of the row-major buffer.
+       A column whose number of distinct values exceeds 1024 and half of
+       its rows is moved back to the buffer.
+
+       The cells are allocated in an arena owned by the result, which is
+       released at once with it. Results can be moved but not copied. */
+    class XEUS_SQL_API result_set
+    {
+    public:
+
+        result_set();
+        result_set(result_set&& other);
+        result_set& operator=(result_set&& other);
+
+        /* Resolves the columns from the first fetched row */
+        void describe(const soci::row& r);
+        /* Uses the columns of another result set */
+        void describe(const std::vector<column_info>& columns);
+        /* Formats a row, describe must have been called before. The cells
+           of the leading columns that are not in the row, if any, are
+           appended with append_cell before. */
+        void append(const soci::row& r);
+
+        /* Builds a result set from already formatted values, cells being
+           appended row by row. */
+        void add_column(const std::string& name, soci::data_type type);
+        void append_cell(std::string_view value);
+
+        /* Appends a cell written by `write(cell_buffer& out)` */
+        template <class F>
+        void emplace_cell(F&& write);
+
+        /* Copies the rows of a result set with the same columns at the end
+           of this one */
+        void append_rows(const result_set& other);
+
+        bool described() const;
+        std::size_t rows() const;
+        std::size_t columns() const;
+        const column_info& column(std::size_t col) const;
+        const std::vector<column_info>& column_infos() const;
+        std::string_view cell(std::size_t row, std::size_t col) const;
+
+        /* Dictionary of a column, nullptr if its cells are not encoded */
+        const string_dictionary* dictionary(std::size_t col) const;
+        /* Codes of the cells of a dictionary-encoded column */
+        const std::pmr::vector<std::uint32_t>& codes(std::size_t col) const;
+
+        /* Number of bytes of formatted cells, distinct values being counted
+           once */
+        std::size_t bytes() const;
+        /* Number of bytes allocated for the result, including offsets */
+        std::size_t memory() const;
+        const result_arena& arena() const;
+
+        void to_data_frame(xv::df_type& df) const;
+
+        /* Binary image of the result. It mirrors the layout in memory, the
+           buffer, the offsets and the dictionaries being written as they
+           are, so that reading it back from a mapped file is a few bulk
+           copies. */
+        void write(std::ostream& out) const;
+        /* Throws if `image` is truncated or inconsistent */
+        static result_set read(std::string_view image);
+
+    private:
+
+        static constexpr std::size_t encoded = static_cast<std::size_t>(-1);
+
+        struct encoded_column
+        {
+            explicit encoded_column(std::pmr::memory_resource* resource);
+
+            string_dictionary dictionary;
+            std::pmr::vector<std::uint32_t> codes;
+        };
+
+        /* Everything allocated in the arena, kept behind a pointer so that
+           moving a result doesn't move the containers away from it */
+        struct storage
+        {
+            storage();
+
+            result_arena arena;
+            cell_buffer buffer;
+            // offset of the start of each cell, plus the end of the last one
+            std::pmr::vector<std::size_t> offsets;
+            std::vector<encoded_column> encoded;
+        };
+
+        void reset_layout();
+        void swap(result_set& other);
+        void end_cell();
+        void append_code(std::string_view value);
+        void end_row();
+        void check_cardinality();
+        void decode(std::size_t col);
+
+        std::vector<column_info> m_columns;
+        // position of each column among the cells of a row of the buffer,
+        // or `encoded`
+        std::vector<std::size_t> m_layout;
+        std::size_t m_plain_columns = 0;
+        std::unique_ptr<storage> m_storage;
+        std::size_t m_rows = 0;
+        // column of the next appended cell
+        std::size_t m_next_column = 0;
+        cell_buffer m_scratch;
+    };
+
+    template <class F>
+    inline void result_set::emplace_cell(F&& write)
+    {
+        if (m_layout[m_next_column] == encoded)
+        {
+            m_scratch.clear();
+            write(m_scratch);
+            append_code(m_scratch);
+        }
+        else
+        {
+            write(m_storage->buffer);
+            end_cell();
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,86 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XEUS_SQL_SCRATCH_DB_HPP
+#define XEUS_SQL_SCRATCH_DB_HPP
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "soci/soci.h"
+
+#include "xeus_sql_config.hpp"
+
+namespace xeus_sql
+{
+    /* `text` between `quote` characters, the ones it contains being
+       doubled: an identifier with '"', a string literal with '\'' */
+    XEUS_SQL_API std::string quote_sql(const std::string& text, char quote = '"');
+
+    /* Columns compared by the joins of a query, as (table, column) pairs:
+       "FROM orders o JOIN customers c ON o.customer_id = c.id" gives
+       {"orders", "customer_id"} and {"customers", "id"}. Equalities between
+       qualified columns of the WHERE clause and USING lists are included. */
+    XEUS_SQL_API std::vector<std::pair<std::string, std::string>> join_keys(const std::string& sql);
+
+    /* Tables referenced by the FROM and JOIN clauses of a query, by lower
+       case alias or name: "FROM orders o" gives {"o", "orders"} and
+       {"orders", "orders"} */
+    XEUS_SQL_API std::map<std::string, std::string> table_aliases(const std::string& sql);
+
+    struct materialize_stats
+    {
+        std::size_t rows = 0;
+        double seconds = 0.;
+
+        double rows_per_second() const
+        {
+            return seconds > 0. ? static_cast<double>(rows) / seconds : 0.;
+        }
+    };
+
+    /* In-memory SQLite database where the results of queries run on
+       different connections are copied, so that they can be joined. */
+    class XEUS_SQL_API scratch_db
+    {
+    public:
+
+        /* Rows inserted by a single execution of the insert statement */
+        static constexpr std::size_t batch_rows = 10000;
+
+        /* Copies the result of `query` run on `source` into `table`,
+           replacing it. Rows are streamed: each batch is bound to a
+           prepared insert statement as column vectors, in a single
+           transaction. */
+        materialize_stats materialize(soci::session& source,
+                                      const std::string& query,
+                                      const std::string& table);
+
+        /* Creates the indexes missing on the join keys of a query */
+        void index_join_keys(const std::string& sql);
+
+        soci::session& session();
+
+        /* Materialized tables and their number of rows */
+        const std::map<std::string, std::size_t>& tables() const;
+
+    private:
+
+        std::unique_ptr<soci::session> m_session;
+        std::map<std::string, std::size_t> m_tables;
+        std::set<std::pair<std::string, std::string>> m_indexes;
+    };
+}
+
+#endif
@@ -0,0 +1,85 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XEUS_SQL_SLOW_QUERY_LOG_HPP
+#define XEUS_SQL_SLOW_QUERY_LOG_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+#include "xeus_sql_config.hpp"
+#include "query_profile.hpp"
+
+namespace xeus_sql
+{
+    struct slow_query_record
+    {
+        std::chrono::system_clock::time_point timestamp;
+        std::string connection;
+        std::string sql;
+        query_profile profile;
+        std::size_t bytes = 0;
+    };
+
+    /* Appends the queries slower than a threshold to a JSONL file.
+       Records are serialized and written by a background thread so that
+       the executing cell only pays for a queue insertion. */
+    class XEUS_SQL_API slow_query_log
+    {
+    public:
+
+        /* Records queued beyond this number are dropped */
+        static constexpr std::size_t max_pending = 10000;
+
+        slow_query_log();
+        ~slow_query_log();
+
+        slow_query_log(const slow_query_log&) = delete;
+        slow_query_log& operator=(const slow_query_log&) = delete;
+
+        /* A negative threshold disables the log */
+        void configure(const std::string& path, std::chrono::milliseconds threshold);
+
+        bool enabled() const;
+        const std::string& path() const;
+        std::chrono::milliseconds threshold() const;
+
+        /* Queues the record if its duration exceeds the threshold */
+        void record(const std::string& connection,
+                    const std::string& sql,
+                    const query_profile& profile,
+                    std::size_t bytes);
+
+        /* Blocks until every queued record is written */
+        void flush();
+
+    private:
+
+        void run();
+        void write(std::ostream& out, const slow_query_record& record);
+
+        std::string m_path;
+        std::chrono::milliseconds m_threshold;
+
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::condition_variable m_flushed_cv;
+        std::deque<slow_query_record> m_pending;
+        bool m_writing = false;
+        bool m_stop = false;
+        std::thread m_writer;
+    };
+}
+
+#endif
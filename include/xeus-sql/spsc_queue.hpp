@@ -0,0 +1,149 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XEUS_SQL_SPSC_QUEUE_HPP
+#define XEUS_SQL_SPSC_QUEUE_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace xeus_sql
+{
+    /* Bounded single producer, single consumer queue. Both ends are
+       lock-free; a full queue makes try_push fail, which is how the
+       producer gets back-pressure. */
+    template <class T>
+    class spsc_queue
+    {
+    public:
+
+        explicit spsc_queue(std::size_t capacity)
+            : m_slots(capacity)
+        {
+        }
+
+        spsc_queue(const spsc_queue&) = delete;
+        spsc_queue& operator=(const spsc_queue&) = delete;
+
+        bool try_push(T& value)
+        {
+            const std::uint64_t h = m_head.load(std::memory_order_relaxed);
+            if (h - m_tail.load(std::memory_order_acquire) >= m_slots.size())
+            {
+                return false;
+            }
+            m_slots[h % m_slots.size()] = std::move(value);
+            m_head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool try_pop(T& value)
+        {
+            const std::uint64_t t = m_tail.load(std::memory_order_relaxed);
+            if (t == m_head.load(std::memory_order_acquire))
+            {
+                return false;
+            }
+            value = std::move(m_slots[t % m_slots.size()]);
+            m_tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        /* Only exact on the side which would fill the queue, for empty(),
+           or empty it, for full() */
+        bool empty() const
+        {
+            return m_tail.load(std::memory_order_acquire) == m_head.load(std::memory_order_acquire);
+        }
+
+        bool full() const
+        {
+            return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire)
+                   >= m_slots.size();
+        }
+
+        std::size_t capacity() const
+        {
+            return m_slots.size();
+        }
+
+    private:
+
+        std::vector<T> m_slots;
+        // kept on separate cache lines, each is written by one side only
+        alignas(64) std::atomic<std::uint64_t> m_head = {0};
+        alignas(64) std::atomic<std::uint64_t> m_tail = {0};
+    };
+
+    /* Waiting strategy of the pipeline threads: spin briefly, then block
+       until the other side changes the state and notifies, so that threads
+       waiting on a slow database sleep. notify() only takes the lock when
+       a thread is blocked. */
+    class wait_event
+    {
+    public:
+
+        static constexpr unsigned default_spins = 16;
+
+        template <class Ready>
+        void wait(Ready ready, unsigned spins = default_spins)
+        {
+            for (unsigned i = 0; i != spins; ++i)
+            {
+                if (ready())
+                {
+                    return;
+                }
+                std::this_thread::yield();
+            }
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_waiters.fetch_add(1, std::memory_order_relaxed);
+            // pairs with the fence of notify(): either the notifier sees the
+            // waiter or `ready` sees the change made before notifying
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            m_cv.wait(lock, ready);
+            m_waiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        void notify()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_waiters.load(std::memory_order_relaxed) != 0)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_cv.notify_all();
+            }
+        }
+
+        /* Applies `update` under the lock, so that a waiter which doesn't
+           spin can only return once this returns: for the last notification
+           before the waiter destroys the event */
+        template <class Update>
+        void notify(Update update)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            update();
+            m_cv.notify_all();
+        }
+
+    private:
+
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::atomic<unsigned> m_waiters = {0};
+    };
+}
+
+#endif
@@ -0,0 +1,50 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XEUS_SQL_TEXT_RENDERER_HPP
+#define XEUS_SQL_TEXT_RENDERER_HPP
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+#include "xeus_sql_config.hpp"
+#include "result_set.hpp"
+
+namespace xeus_sql
+{
+    struct text_table_options
+    {
+        /* Beyond this number of rows, only the first and last
+           max_rows / 2 rows are shown. 0 shows every row. */
+        std::size_t max_rows = 60;
+        /* Wider cells are truncated with an ellipsis. 0 disables truncation. */
+        std::size_t max_cell_width = 50;
+    };
+
+    /* Number of characters of a UTF-8 string */
+    XEUS_SQL_API std::size_t display_width(std::string_view value);
+
+    /* Renders a result set as a fixed-width text table:
+
+       +----+--------+
+       | id | name   |
+       +----+--------+
+       |  1 | first  |
+       |  2 | second |
+       +----+--------+
+
+       Numeric columns are right-aligned. The table is written in a single
+       buffer sized from the column widths, computed in one pass over the
+       displayed cells. */
+    XEUS_SQL_API std::string render_text_table(const result_set& result,
+                                               const text_table_options& options = {});
+}
+
+#endif
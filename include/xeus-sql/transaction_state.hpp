@@ -0,0 +1,131 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XEUS_SQL_TRANSACTION_STATE_HPP
+#define XEUS_SQL_TRANSACTION_STATE_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "soci/soci.h"
+
+#include "xeus_sql_config.hpp"
+#include "duckdb_session.hpp"
+
+namespace xeus_sql
+{
+    /* INSERT, UPDATE, DELETE, REPLACE, MERGE or UPSERT statements */
+    XEUS_SQL_API bool is_dml_statement(const std::string& code);
+
+    /* Limits of the batches grouping consecutive DML statements, the
+       batch is committed when either is reached. Without limit, the
+       statements run in autocommit mode. */
+    struct batch_options
+    {
+        std::size_t statements = 0;
+        std::chrono::seconds interval = std::chrono::seconds(0);
+
+        bool enabled() const;
+    };
+
+    /* The transaction open on the connection of the kernel, either begun
+       by %BEGIN and ended by %COMMIT or %ROLLBACK, or a batch opened by
+       the first DML statement of a series. A batch saves one commit, and
+       the flush of the log of the database, per statement.
+
+       The kernel holds mutex() while a cell runs and calls the methods
+       under it. With an interval, a timer thread takes the same lock to
+       commit the batches left open once it has elapsed, so that an idle
+       notebook doesn't keep the locks of its rows. */
+    class XEUS_SQL_API transaction_state
+    {
+    public:
+
+        using clock = std::chrono::steady_clock;
+
+        transaction_state() = default;
+        ~transaction_state();
+
+        transaction_state(const transaction_state&) = delete;
+        transaction_state& operator=(const transaction_state&) = delete;
+
+        std::mutex& mutex();
+
+        /* Throws if a transaction begun by begin() is already open, commits
+           an open batch first */
+        void begin(std::shared_ptr<soci::session> session);
+        void begin(std::shared_ptr<duckdb_session> session);
+        /* Both return the number of statements of the transaction, 0
+           without transaction */
+        std::size_t commit();
+        std::size_t rollback();
+
+        bool open() const;
+        bool batched() const;
+        std::size_t statements() const;
+
+        void set_batch(const batch_options& options);
+        const batch_options& batch() const;
+
+        /* Called before running a statement on one of the sessions: opens
+           a batch for a DML statement when batching, and commits the batch
+           before other statements, which may commit implicitly. Statements
+           on another connection than the one of the transaction run
+           outside of it. */
+        void before_statement(const std::shared_ptr<soci::session>& session,
+                              const std::shared_ptr<duckdb_session>& duckdb,
+                              bool dml);
+        /* Counts a statement run in the transaction, returns true when it
+           committed a full batch */
+        bool after_statement();
+        /* Commits a batch open for longer than the interval */
+        bool commit_expired_batch();
+        /* The error of the last commit made by the timer, cleared by the
+           call, so that the next cell can report it */
+        std::string timer_error();
+
+        /* "transaction open: 3 statements, 1.2 s", empty without
+           transaction */
+        std::string footer() const;
+
+    private:
+
+        bool owns(const std::shared_ptr<soci::session>& session,
+                  const std::shared_ptr<duckdb_session>& duckdb) const;
+        void start(std::shared_ptr<soci::session> session,
+                   std::shared_ptr<duckdb_session> duckdb,
+                   bool batched);
+        void reset();
+        void run_timer();
+        void stop_timer();
+
+        batch_options m_batch;
+        // the session is kept alive until the transaction ends
+        std::shared_ptr<soci::session> m_session;
+        std::shared_ptr<duckdb_session> m_duckdb;
+        std::unique_ptr<soci::transaction> m_transaction;
+        bool m_open = false;
+        bool m_batched = false;
+        std::size_t m_statements = 0;
+        clock::time_point m_start;
+
+        std::mutex m_mutex;
+        std::condition_variable m_timer_cv;
+        std::thread m_timer;
+        bool m_stop_timer = false;
+        std::string m_timer_error;
+    };
+}
+
+#endif
@@ -0,0 +1,82 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XEUS_SQL_TRANSFORM_HPP
+#define XEUS_SQL_TRANSFORM_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "xeus_sql_config.hpp"
+#include "result_set.hpp"
+
+namespace xeus_sql
+{
+    enum class aggregate_op
+    {
+        count,
+        sum,
+        mean,
+        min,
+        max
+    };
+
+    struct aggregate
+    {
+        aggregate_op op;
+        /* Empty for COUNT */
+        std::string column;
+        std::string name;
+    };
+
+    /* One step of a transform pipeline */
+    struct transform_step
+    {
+        enum kind_type { filter, bin, group, top } kind;
+        /* FILTER column op value, BIN column bins, TOP count column */
+        std::string column;
+        std::string op;
+        std::string value;
+        std::size_t count = 0;
+        bool ascending = false;
+        /* GROUP columns... aggregates... */
+        std::vector<std::string> keys;
+        std::vector<aggregate> aggregates;
+    };
+
+    /* Chart data preparation done by the kernel before the data frame is
+       sent to the frontend. Columns are loaded once into typed arrays,
+       numbers as doubles and text as views on the cells of the result, and
+       every step is a loop over these arrays.
+
+       Steps, applied in order:
+         FILTER column =|!=|<|<=|>|>= value
+         BIN column bins
+         GROUP column... SUM|MEAN|COUNT|MIN|MAX [column] [AS name]...
+         TOP count column [ASC] */
+    class XEUS_SQL_API transform_pipeline
+    {
+    public:
+
+        /* Parses the tokens following the TRANSFORM keyword */
+        static transform_pipeline parse(const std::vector<std::string>& tokens);
+
+        bool empty() const;
+        const std::vector<transform_step>& steps() const;
+
+        result_set apply(const result_set& input) const;
+
+    private:
+
+        std::vector<transform_step> m_steps;
+    };
+}
+
+#endif
@@ -10,6 +10,10 @@
 #ifndef XEUS_SQL_INTERPRETER_HPP
 #define XEUS_SQL_INTERPRETER_HPP
 
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
 #include "nlohmann/json.hpp"
 #include "xeus/xinterpreter.hpp"
 #include "soci/soci.h"
@@ -17,6 +21,19 @@
 
 #include "xeus_sql_interpreter.hpp"
 #include "xeus_sql_config.hpp"
+#include "duckdb_session.hpp"
+#include "fetch_pipeline.hpp"
+#include "query_metrics.hpp"
+#include "query_plan.hpp"
+#include "query_profile.hpp"
+#include "query_trace.hpp"
+#include "result_cache.hpp"
+#include "result_diff.hpp"
+#include "result_grid.hpp"
+#include "scratch_db.hpp"
+#include "slow_query_log.hpp"
+#include "text_renderer.hpp"
+#include "transaction_state.hpp"
 
 
 namespace nl = nlohmann;
@@ -46,11 +63,75 @@ namespace xeus_sql
         nl::json shutdown_request_impl(bool restart) override;
         nl::json interrupt_request_impl() override;
 
+        /* Runs a query, or returns the stored result referenced by a
+           "%FROM name" query */
+        std::shared_ptr<const result_set> fetch_SQL_result(const std::string& code,
+                                                           query_profile& profile);
+        /* The query to run in place of a SELECT statement the planner
+           expects to return more rows than the guard allows */
+        std::string guard_SQL_query(const std::string& code);
+        /* `summarize` appends the statistics of the columns to the output,
+           the data frame is only filled for charts */
         nl::json process_SQL_input(const std::string& code,
-                                   xv::df_type& xv_sqlite_df);
+                                   xv::df_type* xv_sqlite_df,
+                                   query_profile& profile,
+                                   bool summarize = false);
+        void process_SQL_cell(int execution_counter,
+                              const std::string& code,
+                              bool profiling,
+                              bool summarize = false);
+        void process_SQL_grid(int execution_counter,
+                              const std::string& code,
+                              bool profiling);
+        /* %%SWEEP: runs the query of the cell once per value of a
+           parameter, the statement being prepared once */
+        void process_SQL_sweep(int execution_counter,
+                               const std::string& code,
+                               bool profiling);
+        /* Runs a query every `interval` until the kernel is interrupted,
+           the changed rows replace the previous ones in a display */
+        void watch_SQL_result(int execution_counter,
+                              const std::string& code,
+                              const std::vector<std::string>& key,
+                              std::chrono::seconds interval);
+        nl::json stored_results_bundle() const;
+
+        struct stored_result
+        {
+            std::string sql;
+            std::shared_ptr<const result_set> result;
+        };
 
-        std::unique_ptr<soci::session> sql;
+        std::shared_ptr<soci::session> sql;
+        // replaces sql when a DuckDB database is loaded
+        std::shared_ptr<duckdb_session> duckdb;
+        // connections loaded with "AS name"
+        std::map<std::string, std::shared_ptr<soci::session>> connections;
+        scratch_db scratch;
         std::map<std::string, nl::json> specs;
+        std::map<std::string, stored_result> stored_results;
+        bool profile_always = false;
+        bool summary_always = false;
+        query_metrics metrics;
+        std::string trace_path = "xsql_trace.json";
+        slow_query_log slow_log;
+        std::string connection_alias;
+        text_table_options text_options;
+        fetch_options fetch_opts = {default_format_threads()};
+        // results browsed through a comm, the oldest ones are released first
+        std::vector<std::unique_ptr<result_grid>> grids;
+        bool grid_target_registered = false;
+        result_cache cache;
+        // lifetime of the results cached by the running %CACHE cell, 0 outside
+        std::chrono::seconds cache_ttl = std::chrono::seconds(0);
+        // interrupt requests arrive on the control thread while %WATCH runs
+        std::mutex watch_mutex;
+        std::condition_variable watch_cv;
+        bool watch_interrupted = false;
+        guard_options guard;
+        // whether the running cell can ask for confirmations
+        bool allow_stdin = false;
+        transaction_state transaction;
     };
 }
 
@@ -0,0 +1,36 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XEUS_SQL_CELL_HASH_HPP
+#define XEUS_SQL_CELL_HASH_HPP
+
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+/* Hashes of the cells shared by the sources, not installed */
+
+namespace xeus_sql
+{
+    /* Finalizer of splitmix64, std::hash only has to be good enough for
+       hash tables */
+    inline std::uint64_t mix(std::uint64_t h)
+    {
+        h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+        h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+        return h ^ (h >> 31);
+    }
+
+    inline std::uint64_t hash_cell(std::string_view cell)
+    {
+        return mix(std::hash<std::string_view>()(cell));
+    }
+}
+
+#endif
@@ -0,0 +1,277 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string_view>
+
+#include "xeus-sql/column_summary.hpp"
+
+#include "cell_hash.hpp"
+
+namespace xeus_sql
+{
+    namespace
+    {
+        const std::string_view null_cell = "NULL";
+
+        /* Numbers are hashed by value, 1 and 1.0 are the same value */
+        std::uint64_t hash_value(double value)
+        {
+            std::uint64_t bits;
+            value = value == 0. ? 0. : value;
+            std::memcpy(&bits, &value, sizeof(bits));
+            return mix(bits);
+        }
+
+        unsigned leading_zeros(std::uint64_t value)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            return value == 0 ? 64u : static_cast<unsigned>(__builtin_clzll(value));
+#else
+            unsigned res = 0;
+            for (std::uint64_t bit = 1ull << 63; bit != 0 && (value & bit) == 0; bit >>= 1)
+            {
+                ++res;
+            }
+            return res;
+#endif
+        }
+
+        /* Loops over the parsed values of a numeric column. Sums use four
+           independent accumulators: without -ffast-math, this is what lets
+           the compiler keep several additions in flight or in the lanes of
+           a vector register. */
+        void summarize_values(const std::vector<double>& values, std::size_t bins, column_summary& summary)
+        {
+            const std::size_t n = values.size();
+            if (n == 0)
+            {
+                return;
+            }
+            const double* v = values.data();
+
+            double lo = v[0];
+            double hi = v[0];
+            double sum[4] = {0., 0., 0., 0.};
+            std::size_t i = 0;
+            for (; i + 4 <= n; i += 4)
+            {
+                for (std::size_t k = 0; k != 4; ++k)
+                {
+                    lo = v[i + k] < lo ? v[i + k] : lo;
+                    hi = v[i + k] > hi ? v[i + k] : hi;
+                    sum[k] += v[i + k];
+                }
+            }
+            for (; i != n; ++i)
+            {
+                lo = v[i] < lo ? v[i] : lo;
+                hi = v[i] > hi ? v[i] : hi;
+                sum[0] += v[i];
+            }
+            const double mean = (sum[0] + sum[1] + sum[2] + sum[3]) / static_cast<double>(n);
+
+            // squared deviations from the mean, which is stabler than the
+            // difference of the sum of squares and the squared sum
+            double squares[4] = {0., 0., 0., 0.};
+            for (i = 0; i + 4 <= n; i += 4)
+            {
+                for (std::size_t k = 0; k != 4; ++k)
+                {
+                    const double d = v[i + k] - mean;
+                    squares[k] += d * d;
+                }
+            }
+            for (; i != n; ++i)
+            {
+                const double d = v[i] - mean;
+                squares[0] += d * d;
+            }
+            const double variance = n > 1 ? (squares[0] + squares[1] + squares[2] + squares[3])
+                                                / static_cast<double>(n - 1)
+                                          : 0.;
+
+            summary.mean = mean;
+            summary.stddev = std::sqrt(variance);
+            append_double(summary.min, lo);
+            append_double(summary.max, hi);
+
+            summary.histogram.assign(bins, 0);
+            const double scale = hi > lo ? static_cast<double>(bins) / (hi - lo) : 0.;
+            const std::size_t last = bins - 1;
+            for (i = 0; i != n; ++i)
+            {
+                const std::size_t bin = static_cast<std::size_t>((v[i] - lo) * scale);
+                ++summary.histogram[bin < last ? bin : last];
+            }
+        }
+
+        void append_sparkline(cell_buffer& out, const std::vector<std::size_t>& histogram)
+        {
+            static const char* const blocks[] = {"▁", "▂", "▃", "▄",
+                                                 "▅", "▆", "▇", "█"};
+            const std::size_t highest = histogram.empty() ? 0 : *std::max_element(histogram.begin(), histogram.end());
+            for (std::size_t count : histogram)
+            {
+                if (count == 0)
+                {
+                    out += ' ';
+                }
+                else
+                {
+                    out += blocks[count * 7 / highest];
+                }
+            }
+        }
+    }
+
+    hyperloglog::hyperloglog()
+        : m_registers(std::size_t(1) << precision, 0)
+    {
+    }
+
+    void hyperloglog::add(std::uint64_t hash)
+    {
+        const std::size_t index = static_cast<std::size_t>(hash >> (64 - precision));
+        // the sentinel bit bounds the rank when the remaining bits are zeros
+        const std::uint64_t rest = (hash << precision) | (std::uint64_t(1) << (precision - 1));
+        const std::uint8_t rank = static_cast<std::uint8_t>(leading_zeros(rest) + 1);
+        m_registers[index] = std::max(m_registers[index], rank);
+    }
+
+    double hyperloglog::estimate() const
+    {
+        const double m = static_cast<double>(m_registers.size());
+        double sum = 0.;
+        std::size_t zeros = 0;
+        for (std::uint8_t r : m_registers)
+        {
+            sum += std::ldexp(1., -static_cast<int>(r));
+            zeros += r == 0 ? 1 : 0;
+        }
+        const double alpha = 0.7213 / (1. + 1.079 / m);
+        const double raw = alpha * m * m / sum;
+        // linear counting is more accurate for small cardinalities
+        if (raw <= 2.5 * m && zeros != 0)
+        {
+            return m * std::log(m / static_cast<double>(zeros));
+        }
+        return raw;
+    }
+
+    std::vector<column_summary> summarize_columns(const result_set& result, std::size_t bins)
+    {
+        bins = std::max<std::size_t>(bins, 1);
+        std::vector<column_summary> res(result.columns());
+        std::vector<double> values;
+        for (std::size_t col = 0; col != result.columns(); ++col)
+        {
+            column_summary& summary = res[col];
+            summary.name = result.column(col).name;
+            summary.numeric = is_numeric(result.column(col).type);
+
+            hyperloglog distinct;
+            values.clear();
+            std::string_view min;
+            std::string_view max;
+            for (std::size_t row = 0; row != result.rows(); ++row)
+            {
+                const std::string_view cell = result.cell(row, col);
+                const double value = summary.numeric ? parse_number(cell) : 0.;
+                // unparsable cells and NaN count as NULL
+                if (cell == null_cell || std::isnan(value))
+                {
+                    ++summary.nulls;
+                    continue;
+                }
+                if (summary.numeric)
+                {
+                    distinct.add(hash_value(value));
+                    if (std::isinf(value))
+                    {
+                        ++summary.non_finite;
+                    }
+                    else
+                    {
+                        values.push_back(value);
+                    }
+                    ++summary.count;
+                    continue;
+                }
+                distinct.add(hash_cell(cell));
+                if (summary.count == 0)
+                {
+                    min = max = cell;
+                }
+                else
+                {
+                    min = std::min(min, cell);
+                    max = std::max(max, cell);
+                }
+                ++summary.count;
+            }
+
+            summary.distinct = summary.count == 0 ? 0. : std::min(distinct.estimate(), static_cast<double>(summary.count));
+            if (summary.numeric)
+            {
+                summarize_values(values, bins, summary);
+            }
+            else
+            {
+                summary.min = std::string(min);
+                summary.max = std::string(max);
+            }
+        }
+        return res;
+    }
+
+    result_set summary_table(const std::vector<column_summary>& summaries)
+    {
+        result_set table;
+        table.add_column("column", soci::dt_string);
+        table.add_column("count", soci::dt_long_long);
+        table.add_column("nulls", soci::dt_long_long);
+        table.add_column("non-finite", soci::dt_long_long);
+        table.add_column("~distinct", soci::dt_long_long);
+        table.add_column("min", soci::dt_string);
+        table.add_column("max", soci::dt_string);
+        table.add_column("mean", soci::dt_double);
+        table.add_column("stddev", soci::dt_double);
+        table.add_column("histogram", soci::dt_string);
+        for (const column_summary& summary : summaries)
+        {
+            const bool moments = summary.numeric && summary.count > summary.non_finite;
+            table.append_cell(summary.name);
+            table.emplace_cell([&](cell_buffer& out) { append_unsigned(out, summary.count); });
+            table.emplace_cell([&](cell_buffer& out) { append_unsigned(out, summary.nulls); });
+            table.emplace_cell([&](cell_buffer& out) { append_unsigned(out, summary.non_finite); });
+            table.emplace_cell([&](cell_buffer& out) {
+                append_unsigned(out, static_cast<unsigned long long>(std::llround(summary.distinct)));
+            });
+            table.append_cell(summary.min);
+            table.append_cell(summary.max);
+            table.emplace_cell([&](cell_buffer& out) {
+                if (moments)
+                {
+                    append_double(out, summary.mean);
+                }
+            });
+            table.emplace_cell([&](cell_buffer& out) {
+                if (moments)
+                {
+                    append_double(out, summary.stddev);
+                }
+            });
+            table.emplace_cell([&](cell_buffer& out) { append_sparkline(out, summary.histogram); });
+        }
+        return table;
+    }
+}
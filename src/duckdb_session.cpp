@@ -0,0 +1,422 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <cstdint>
+#include <ctime>
+#include <stdexcept>
+#include <vector>
+
+#include "xeus-sql/duckdb_session.hpp"
+
+#ifdef USE_DUCKDB
+#include "duckdb.h"
+#endif
+
+namespace xeus_sql
+{
+#ifdef USE_DUCKDB
+    namespace
+    {
+        /* Formats the value at `row` of a column vector */
+        using vector_formatter = void (*)(cell_buffer& out, const void* data, idx_t row, int scale);
+
+        template <class T>
+        const T& at(const void* data, idx_t row)
+        {
+            return static_cast<const T*>(data)[row];
+        }
+
+        /* Inserts the decimal point `scale` digits from the right of the
+           digits of an absolute value */
+        void append_scaled(cell_buffer& out, bool negative, std::string digits, int scale)
+        {
+            if (negative)
+            {
+                out += '-';
+            }
+            if (scale <= 0)
+            {
+                out += digits;
+                return;
+            }
+            const std::size_t fraction = static_cast<std::size_t>(scale);
+            if (digits.size() <= fraction)
+            {
+                digits.insert(0, fraction + 1 - digits.size(), '0');
+            }
+            out.append(digits, 0, digits.size() - fraction);
+            out += '.';
+            out.append(digits, digits.size() - fraction, fraction);
+        }
+
+        void append_hugeint(cell_buffer& out, const duckdb_hugeint& value, int scale)
+        {
+#ifdef __SIZEOF_INT128__
+            const bool negative = value.upper < 0;
+            unsigned __int128 magnitude = (static_cast<unsigned __int128>(static_cast<std::uint64_t>(value.upper)) << 64)
+                                          | value.lower;
+            if (negative)
+            {
+                magnitude = ~magnitude + 1;
+            }
+            std::string digits;
+            do
+            {
+                digits.insert(digits.begin(), static_cast<char>('0' + static_cast<int>(magnitude % 10)));
+                magnitude /= 10;
+            } while (magnitude != 0);
+            append_scaled(out, negative, std::move(digits), scale);
+#else
+            // without 128-bit integers, the value is rounded to a double
+            double res = duckdb_hugeint_to_double(value);
+            for (int i = 0; i < scale; ++i)
+            {
+                res /= 10.;
+            }
+            append_double(out, res);
+#endif
+        }
+
+        template <class T>
+        void format_signed(cell_buffer& out, const void* data, idx_t row, int)
+        {
+            append_integer(out, at<T>(data, row));
+        }
+
+        template <class T>
+        void format_unsigned(cell_buffer& out, const void* data, idx_t row, int)
+        {
+            append_unsigned(out, at<T>(data, row));
+        }
+
+        template <class T>
+        void format_real(cell_buffer& out, const void* data, idx_t row, int)
+        {
+            append_double(out, at<T>(data, row));
+        }
+
+        template <class T>
+        void format_decimal(cell_buffer& out, const void* data, idx_t row, int scale)
+        {
+            const long long value = at<T>(data, row);
+            const unsigned long long magnitude = value < 0 ? 0ull - static_cast<unsigned long long>(value)
+                                                           : static_cast<unsigned long long>(value);
+            append_scaled(out, value < 0, std::to_string(magnitude), scale);
+        }
+
+        void format_hugeint(cell_buffer& out, const void* data, idx_t row, int scale)
+        {
+            append_hugeint(out, at<duckdb_hugeint>(data, row), scale);
+        }
+
+        void format_boolean(cell_buffer& out, const void* data, idx_t row, int)
+        {
+            out += at<bool>(data, row) ? "true" : "false";
+        }
+
+        void format_varchar(cell_buffer& out, const void* data, idx_t row, int)
+        {
+            duckdb_string_t value = at<duckdb_string_t>(data, row);
+            out.append(duckdb_string_t_data(&value), duckdb_string_t_length(value));
+        }
+
+        /* Printable bytes are kept, the other ones are written as \xHH */
+        void format_blob(cell_buffer& out, const void* data, idx_t row, int)
+        {
+            static const char hex[] = "0123456789ABCDEF";
+            duckdb_string_t value = at<duckdb_string_t>(data, row);
+            const char* bytes = duckdb_string_t_data(&value);
+            for (std::uint32_t i = 0; i != duckdb_string_t_length(value); ++i)
+            {
+                const unsigned char c = static_cast<unsigned char>(bytes[i]);
+                if (c >= 0x20 && c < 0x7F && c != '\\')
+                {
+                    out += static_cast<char>(c);
+                }
+                else
+                {
+                    out += "\\x";
+                    out += hex[c >> 4];
+                    out += hex[c & 0xF];
+                }
+            }
+        }
+
+        void append_fraction(cell_buffer& out, std::int32_t micros)
+        {
+            if (micros != 0)
+            {
+                std::string digits = std::to_string(micros);
+                out += '.';
+                out.append(6 - digits.size(), '0');
+                out += digits;
+            }
+        }
+
+        void format_date(cell_buffer& out, const void* data, idx_t row, int)
+        {
+            const duckdb_date_struct date = duckdb_from_date(at<duckdb_date>(data, row));
+            std::tm value = {};
+            value.tm_year = date.year - 1900;
+            value.tm_mon = date.month - 1;
+            value.tm_mday = date.day;
+            // append_date writes the time as well, it is removed
+            append_date(out, value);
+            out.resize(out.size() - 9);
+        }
+
+        void format_time(cell_buffer& out, const void* data, idx_t row, int)
+        {
+            const duckdb_time_struct time = duckdb_from_time(at<duckdb_time>(data, row));
+            std::tm value = {};
+            value.tm_hour = time.hour;
+            value.tm_min = time.min;
+            value.tm_sec = time.sec;
+            // only the time of the formatted date is kept
+            std::string date;
+            append_date(date, value);
+            out.append(date, date.size() - 8, 8);
+            append_fraction(out, time.micros);
+        }
+
+        /* The scale is the number of units per microsecond as a power of
+           1000: -2 for seconds, -1 for milliseconds, 1 for nanoseconds */
+        void format_timestamp(cell_buffer& out, const void* data, idx_t row, int scale)
+        {
+            std::int64_t micros = at<std::int64_t>(data, row);
+            for (int i = scale; i < 0; ++i)
+            {
+                micros *= 1000;
+            }
+            for (int i = 0; i < scale; ++i)
+            {
+                micros /= 1000;
+            }
+            const duckdb_timestamp_struct timestamp = duckdb_from_timestamp(duckdb_timestamp{micros});
+            std::tm value = {};
+            value.tm_year = timestamp.date.year - 1900;
+            value.tm_mon = timestamp.date.month - 1;
+            value.tm_mday = timestamp.date.day;
+            value.tm_hour = timestamp.time.hour;
+            value.tm_min = timestamp.time.min;
+            value.tm_sec = timestamp.time.sec;
+            append_date(out, value);
+            append_fraction(out, timestamp.time.micros);
+        }
+
+        struct column_reader
+        {
+            vector_formatter format;
+            int scale;
+        };
+
+        /* Chooses the formatter of a column and the SOCI type reported by the
+           result set, so that numeric columns are handled as such */
+        column_reader select_reader(duckdb_result& result, idx_t col, soci::data_type& type)
+        {
+            switch (duckdb_column_type(&result, col))
+            {
+                case DUCKDB_TYPE_BOOLEAN: type = soci::dt_string; return {&format_boolean, 0};
+                case DUCKDB_TYPE_TINYINT: type = soci::dt_long_long; return {&format_signed<std::int8_t>, 0};
+                case DUCKDB_TYPE_SMALLINT: type = soci::dt_long_long; return {&format_signed<std::int16_t>, 0};
+                case DUCKDB_TYPE_INTEGER: type = soci::dt_long_long; return {&format_signed<std::int32_t>, 0};
+                case DUCKDB_TYPE_BIGINT: type = soci::dt_long_long; return {&format_signed<std::int64_t>, 0};
+                case DUCKDB_TYPE_UTINYINT: type = soci::dt_unsigned_long_long; return {&format_unsigned<std::uint8_t>, 0};
+                case DUCKDB_TYPE_USMALLINT: type = soci::dt_unsigned_long_long; return {&format_unsigned<std::uint16_t>, 0};
+                case DUCKDB_TYPE_UINTEGER: type = soci::dt_unsigned_long_long; return {&format_unsigned<std::uint32_t>, 0};
+                case DUCKDB_TYPE_UBIGINT: type = soci::dt_unsigned_long_long; return {&format_unsigned<std::uint64_t>, 0};
+                case DUCKDB_TYPE_HUGEINT: type = soci::dt_long_long; return {&format_hugeint, 0};
+                case DUCKDB_TYPE_FLOAT: type = soci::dt_double; return {&format_real<float>, 0};
+                case DUCKDB_TYPE_DOUBLE: type = soci::dt_double; return {&format_real<double>, 0};
+                case DUCKDB_TYPE_VARCHAR: type = soci::dt_string; return {&format_varchar, 0};
+                case DUCKDB_TYPE_BLOB: type = soci::dt_blob; return {&format_blob, 0};
+                case DUCKDB_TYPE_DATE: type = soci::dt_date; return {&format_date, 0};
+                case DUCKDB_TYPE_TIME: type = soci::dt_string; return {&format_time, 0};
+                case DUCKDB_TYPE_TIMESTAMP_S: type = soci::dt_date; return {&format_timestamp, -2};
+                case DUCKDB_TYPE_TIMESTAMP_MS: type = soci::dt_date; return {&format_timestamp, -1};
+                case DUCKDB_TYPE_TIMESTAMP:
+                case DUCKDB_TYPE_TIMESTAMP_TZ: type = soci::dt_date; return {&format_timestamp, 0};
+                case DUCKDB_TYPE_TIMESTAMP_NS: type = soci::dt_date; return {&format_timestamp, 1};
+                case DUCKDB_TYPE_DECIMAL:
+                {
+                    duckdb_logical_type logical = duckdb_column_logical_type(&result, col);
+                    const int scale = duckdb_decimal_scale(logical);
+                    const duckdb_type internal = duckdb_decimal_internal_type(logical);
+                    duckdb_destroy_logical_type(&logical);
+                    type = soci::dt_double;
+                    switch (internal)
+                    {
+                        case DUCKDB_TYPE_SMALLINT: return {&format_decimal<std::int16_t>, scale};
+                        case DUCKDB_TYPE_INTEGER: return {&format_decimal<std::int32_t>, scale};
+                        case DUCKDB_TYPE_BIGINT: return {&format_decimal<std::int64_t>, scale};
+                        default: return {&format_hugeint, scale};
+                    }
+                }
+                default:
+                    throw std::runtime_error("unsupported DuckDB type for column "
+                                             + std::string(duckdb_column_name(&result, col))
+                                             + ", it can be cast to VARCHAR");
+            }
+        }
+
+        class result_guard
+        {
+        public:
+
+            explicit result_guard(duckdb_result& result)
+                : m_result(result)
+            {
+            }
+
+            ~result_guard()
+            {
+                duckdb_destroy_result(&m_result);
+            }
+
+        private:
+
+            duckdb_result& m_result;
+        };
+
+        class chunk_guard
+        {
+        public:
+
+            explicit chunk_guard(duckdb_data_chunk& chunk)
+                : m_chunk(chunk)
+            {
+            }
+
+            ~chunk_guard()
+            {
+                duckdb_destroy_data_chunk(&m_chunk);
+            }
+
+        private:
+
+            duckdb_data_chunk& m_chunk;
+        };
+    }
+
+    struct duckdb_session::impl
+    {
+        duckdb_database database = nullptr;
+        duckdb_connection connection = nullptr;
+
+        ~impl()
+        {
+            duckdb_disconnect(&connection);
+            duckdb_close(&database);
+        }
+
+        void run(const std::string& sql, duckdb_result& result)
+        {
+            if (duckdb_query(connection, sql.c_str(), &result) == DuckDBError)
+            {
+                std::string message = duckdb_result_error(&result);
+                duckdb_destroy_result(&result);
+                throw std::runtime_error(message);
+            }
+        }
+    };
+
+    duckdb_session::duckdb_session(const std::string& path)
+        : m_impl(std::make_unique<impl>())
+    {
+        const char* file = path.empty() || path == ":memory:" ? nullptr : path.c_str();
+        if (duckdb_open(file, &m_impl->database) == DuckDBError)
+        {
+            throw std::runtime_error("cannot open DuckDB database " + path);
+        }
+        if (duckdb_connect(m_impl->database, &m_impl->connection) == DuckDBError)
+        {
+            throw std::runtime_error("cannot connect to DuckDB database " + path);
+        }
+    }
+
+    duckdb_session::~duckdb_session() = default;
+
+    void duckdb_session::query(const std::string& sql, result_set& result, query_profile& profile)
+    {
+        duckdb_result res;
+        {
+            phase_timer timer(profile, query_phase::execute);
+            m_impl->run(sql, res);
+        }
+        result_guard guard(res);
+
+        phase_timer timer(profile, query_phase::fetch);
+        const idx_t columns = duckdb_column_count(&res);
+        std::vector<column_reader> readers;
+        for (idx_t col = 0; col != columns; ++col)
+        {
+            soci::data_type type;
+            readers.push_back(select_reader(res, col, type));
+            result.add_column(duckdb_column_name(&res, col), type);
+        }
+
+        std::vector<const void*> data(columns);
+        std::vector<std::uint64_t*> validity(columns);
+        for (duckdb_data_chunk chunk = duckdb_fetch_chunk(res); chunk; chunk = duckdb_fetch_chunk(res))
+        {
+            chunk_guard chunk_destroyer(chunk);
+            const idx_t size = duckdb_data_chunk_get_size(chunk);
+            for (idx_t col = 0; col != columns; ++col)
+            {
+                duckdb_vector vector = duckdb_data_chunk_get_vector(chunk, col);
+                data[col] = duckdb_vector_get_data(vector);
+                // no validity mask when the vector has no NULL
+                validity[col] = duckdb_vector_get_validity(vector);
+            }
+            for (idx_t row = 0; row != size; ++row)
+            {
+                for (idx_t col = 0; col != columns; ++col)
+                {
+                    if (validity[col] && !duckdb_validity_row_is_valid(validity[col], row))
+                    {
+                        result.append_cell("NULL");
+                    }
+                    else
+                    {
+                        const column_reader& reader = readers[col];
+                        const void* values = data[col];
+                        result.emplace_cell([&](cell_buffer& out) { reader.format(out, values, row, reader.scale); });
+                    }
+                }
+            }
+        }
+    }
+
+    void duckdb_session::execute(const std::string& sql)
+    {
+        duckdb_result res;
+        m_impl->run(sql, res);
+        duckdb_destroy_result(&res);
+    }
+#else
+    struct duckdb_session::impl
+    {
+    };
+
+    duckdb_session::duckdb_session(const std::string&)
+    {
+        throw std::runtime_error("xeus-sql was built without DuckDB (XSQL_WITH_DUCKDB)");
+    }
+
+    duckdb_session::~duckdb_session() = default;
+
+    void duckdb_session::query(const std::string&, result_set&, query_profile&)
+    {
+    }
+
+    void duckdb_session::execute(const std::string&)
+    {
+    }
+#endif
+}
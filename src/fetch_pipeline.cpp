@@ -0,0 +1,565 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "xeus-sql/fetch_pipeline.hpp"
+#include "xeus-sql/query_trace.hpp"
+#include "xeus-sql/spsc_queue.hpp"
+
+namespace xeus_sql
+{
+    namespace
+    {
+        /* A value copied out of a SOCI row, formatted later by a worker */
+        struct raw_cell
+        {
+            bool null = false;
+            union
+            {
+                long long integer;
+                unsigned long long unsigned_integer;
+                double real;
+                std::tm date;
+            };
+            std::string text;
+
+            raw_cell()
+                : date()
+            {
+            }
+        };
+
+        /* Rows are stored row-major, cells are reused from one batch to the
+           next one so that strings keep their capacity */
+        struct raw_batch
+        {
+            std::vector<raw_cell> cells;
+            std::size_t rows = 0;
+        };
+
+        void extract_row(const soci::row& r, const std::vector<column_info>& columns, raw_cell* out)
+        {
+            for (std::size_t i = 0; i != columns.size(); ++i)
+            {
+                raw_cell& cell = out[i];
+                cell.null = r.get_indicator(i) == soci::i_null;
+                if (cell.null)
+                {
+                    continue;
+                }
+                try
+                {
+                    switch (columns[i].type)
+                    {
+                        case soci::dt_string:
+                            cell.text = r.get<std::string>(i);
+                            break;
+                        case soci::dt_double:
+                            cell.real = r.get<double>(i);
+                            break;
+                        case soci::dt_integer:
+                            cell.integer = r.get<int>(i);
+                            break;
+                        case soci::dt_long_long:
+                            cell.integer = r.get<long long>(i);
+                            break;
+                        case soci::dt_unsigned_long_long:
+                            cell.unsigned_integer = r.get<unsigned long long>(i);
+                            break;
+                        case soci::dt_date:
+                            cell.date = r.get<std::tm>(i);
+                            break;
+                        default:
+                            break;
+                    }
+                }
+                catch (...)
+                {
+                    // values that can't be converted to the column type
+                    cell.null = true;
+                }
+            }
+        }
+
+        void format_cell(cell_buffer& out, const raw_cell& cell, soci::data_type type)
+        {
+            if (cell.null)
+            {
+                out += "NULL";
+                return;
+            }
+            switch (type)
+            {
+                case soci::dt_string:
+                    out += cell.text;
+                    break;
+                case soci::dt_double:
+                    append_double(out, cell.real);
+                    break;
+                case soci::dt_integer:
+                case soci::dt_long_long:
+                    append_integer(out, cell.integer);
+                    break;
+                case soci::dt_unsigned_long_long:
+                    append_unsigned(out, cell.unsigned_integer);
+                    break;
+                case soci::dt_date:
+                    append_date(out, cell.date);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        /* Threads of the kernel running the format workers, started on the
+           first pipelined query and reused by the next ones. A worker runs
+           until its query is fetched, so each task gets a thread of its
+           own: threads are added when fewer are idle than tasks queued. */
+        class format_thread_pool
+        {
+        public:
+
+            static format_thread_pool& instance()
+            {
+                static format_thread_pool pool;
+                return pool;
+            }
+
+            ~format_thread_pool()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_stop = true;
+                }
+                m_cv.notify_all();
+                for (std::thread& thread : m_threads)
+                {
+                    thread.join();
+                }
+            }
+
+            void run(std::vector<std::function<void()>> tasks)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                for (auto& task : tasks)
+                {
+                    m_tasks.push_back(std::move(task));
+                }
+                while (m_idle < m_tasks.size())
+                {
+                    m_threads.emplace_back([this]() { work(); });
+                    ++m_idle;
+                }
+                m_cv.notify_all();
+            }
+
+        private:
+
+            format_thread_pool() = default;
+
+            void work()
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                while (true)
+                {
+                    m_cv.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+                    if (m_stop)
+                    {
+                        return;
+                    }
+                    std::function<void()> task = std::move(m_tasks.front());
+                    m_tasks.pop_front();
+                    --m_idle;
+                    lock.unlock();
+                    task();
+                    task = nullptr;
+                    lock.lock();
+                    ++m_idle;
+                }
+            }
+
+            std::mutex m_mutex;
+            std::condition_variable m_cv;
+            std::deque<std::function<void()>> m_tasks;
+            std::vector<std::thread> m_threads;
+            std::size_t m_idle = 0;
+            bool m_stop = false;
+        };
+
+        /* Batches are dealt round-robin to the workers, each worker has its
+           own queues so that all of them are single producer, single
+           consumer, and the order of the batches is kept by reading the
+           outputs round-robin as well. */
+        struct format_worker
+        {
+            explicit format_worker(std::size_t depth)
+                : input(depth)
+                , output(depth)
+                , recycled(depth + 2)
+            {
+            }
+
+            spsc_queue<raw_batch> input;
+            spsc_queue<result_set> output;
+            // emptied batches given back to the fetching thread
+            spsc_queue<raw_batch> recycled;
+            std::atomic<bool> done = {false};
+            std::exception_ptr error;
+            // notified by the fetching thread
+            wait_event wake;
+        };
+
+        class format_pipeline
+        {
+        public:
+
+            format_pipeline(result_set& result, const fetch_options& options)
+                : m_result(result)
+                , m_columns(result.column_infos())
+                , m_batch_rows(options.batch_rows)
+            {
+                for (std::size_t i = 0; i != options.format_threads; ++i)
+                {
+                    m_workers.push_back(std::make_unique<format_worker>(options.queue_depth));
+                }
+                std::vector<std::function<void()>> tasks;
+                for (auto& w : m_workers)
+                {
+                    format_worker* worker = w.get();
+                    tasks.emplace_back([this, worker]() { run(*worker); });
+                }
+                m_running.store(m_workers.size(), std::memory_order_relaxed);
+                format_thread_pool::instance().run(std::move(tasks));
+            }
+
+            ~format_pipeline()
+            {
+                stop();
+            }
+
+            format_pipeline(const format_pipeline&) = delete;
+            format_pipeline& operator=(const format_pipeline&) = delete;
+
+            /* An empty batch, reused when possible */
+            raw_batch acquire()
+            {
+                raw_batch batch;
+                if (!next_worker(m_submitted).recycled.try_pop(batch))
+                {
+                    batch.cells.resize(m_batch_rows * m_columns.size());
+                }
+                batch.rows = 0;
+                return batch;
+            }
+
+            /* Hands a batch to a worker, waiting while its queue is full */
+            void submit(raw_batch& batch)
+            {
+                format_worker& worker = next_worker(m_submitted);
+                while (!worker.input.try_push(batch))
+                {
+                    if (!merge_ready())
+                    {
+                        m_progress.wait([this, &worker]() {
+                            return !worker.input.full() || mergeable() || m_failed.load(std::memory_order_acquire);
+                        });
+                    }
+                }
+                worker.wake.notify();
+                ++m_submitted;
+                merge_ready();
+            }
+
+            /* Waits for the submitted batches and appends them to the result */
+            void finish()
+            {
+                for (auto& worker : m_workers)
+                {
+                    worker->done.store(true, std::memory_order_release);
+                    worker->wake.notify();
+                }
+                while (m_merged != m_submitted)
+                {
+                    if (!merge_ready())
+                    {
+                        m_progress.wait([this]() {
+                            return mergeable() || m_failed.load(std::memory_order_acquire);
+                        });
+                    }
+                }
+                join();
+            }
+
+        private:
+
+            format_worker& next_worker(std::size_t batch_index)
+            {
+                return *m_workers[batch_index % m_workers.size()];
+            }
+
+            /* Whether the next batch to append is formatted */
+            bool mergeable()
+            {
+                return m_merged != m_submitted && !next_worker(m_merged).output.empty();
+            }
+
+            /* Appends the batches formatted so far, in order */
+            bool merge_ready()
+            {
+                rethrow_failure();
+                bool merged = false;
+                result_set chunk;
+                while (m_merged != m_submitted && next_worker(m_merged).output.try_pop(chunk))
+                {
+                    next_worker(m_merged).wake.notify();
+                    m_result.append_rows(chunk);
+                    ++m_merged;
+                    merged = true;
+                }
+                return merged;
+            }
+
+            void rethrow_failure()
+            {
+                if (!m_failed.load(std::memory_order_acquire))
+                {
+                    return;
+                }
+                stop();
+                for (auto& worker : m_workers)
+                {
+                    if (worker->error)
+                    {
+                        std::rethrow_exception(worker->error);
+                    }
+                }
+            }
+
+            void stop()
+            {
+                m_stop.store(true, std::memory_order_relaxed);
+                for (auto& worker : m_workers)
+                {
+                    worker->wake.notify();
+                }
+                join();
+            }
+
+            /* Waits for the tasks of the workers to return to the pool */
+            void join()
+            {
+                m_progress.wait([this]() { return m_running.load(std::memory_order_acquire) == 0; }, 0);
+            }
+
+            void run(format_worker& worker)
+            {
+                try
+                {
+                    format_batches(worker);
+                }
+                catch (...)
+                {
+                    worker.error = std::current_exception();
+                    m_failed.store(true, std::memory_order_release);
+                }
+                // the pipeline may be destroyed as soon as this is seen
+                m_progress.notify([this]() { m_running.fetch_sub(1, std::memory_order_release); });
+            }
+
+            void format_batches(format_worker& worker)
+            {
+                const std::size_t columns = m_columns.size();
+                raw_batch batch;
+                while (!m_stop.load(std::memory_order_relaxed))
+                {
+                    if (!worker.input.try_pop(batch))
+                    {
+                        if (!worker.done.load(std::memory_order_acquire))
+                        {
+                            worker.wake.wait([this, &worker]() {
+                                return !worker.input.empty() || worker.done.load(std::memory_order_acquire) ||
+                                       m_stop.load(std::memory_order_relaxed);
+                            });
+                            continue;
+                        }
+                        // the batches pushed before done was set are visible
+                        if (!worker.input.try_pop(batch))
+                        {
+                            return;
+                        }
+                    }
+                    m_progress.notify();
+
+                    result_set chunk;
+                    {
+                        trace_span span("format_batch", static_cast<std::int64_t>(batch.rows));
+                        chunk.describe(m_columns);
+                        for (std::size_t i = 0; i != batch.rows * columns; ++i)
+                        {
+                            const raw_cell& cell = batch.cells[i];
+                            const soci::data_type type = m_columns[i % columns].type;
+                            chunk.emplace_cell([&cell, type](cell_buffer& out) {
+                                format_cell(out, cell, type);
+                            });
+                        }
+                    }
+
+                    while (!worker.output.try_push(chunk))
+                    {
+                        if (m_stop.load(std::memory_order_relaxed))
+                        {
+                            return;
+                        }
+                        worker.wake.wait([this, &worker]() {
+                            return !worker.output.full() || m_stop.load(std::memory_order_relaxed);
+                        });
+                    }
+                    m_progress.notify();
+
+                    batch.rows = 0;
+                    // when the fetching thread has enough batches, this one is released
+                    worker.recycled.try_push(batch);
+                }
+            }
+
+            result_set& m_result;
+            const std::vector<column_info> m_columns;
+            const std::size_t m_batch_rows;
+            std::vector<std::unique_ptr<format_worker>> m_workers;
+            std::size_t m_submitted = 0;
+            std::size_t m_merged = 0;
+            std::atomic<bool> m_stop = {false};
+            std::atomic<bool> m_failed = {false};
+            std::atomic<std::size_t> m_running = {0};
+            // notified by the workers
+            wait_event m_progress;
+        };
+    }
+
+    std::size_t default_format_threads()
+    {
+        if (const char* env = std::getenv("XSQL_FORMAT_THREADS"))
+        {
+            return static_cast<std::size_t>(std::max(0, std::atoi(env)));
+        }
+        const unsigned cores = std::thread::hardware_concurrency();
+        return cores > 1 ? std::min(2u, cores - 1) : 0;
+    }
+
+    void fetch_rows(soci::rowset<soci::row>& rows,
+                    result_set& result,
+                    const fetch_options& options,
+                    query_profile& profile)
+    {
+        auto mark = query_profile::clock::now();
+        auto lap = [&mark, &profile](query_phase phase) {
+            auto now = query_profile::clock::now();
+            profile.add(phase, now - mark);
+            mark = now;
+        };
+
+        const bool tracing = tracing_enabled();
+        std::int64_t batch_start = tracing ? trace_now() : 0;
+        auto end_batch = [&](std::size_t batch_rows) {
+            if (tracing)
+            {
+                std::int64_t now = trace_now();
+                record_span("fetch_batch", batch_start, now, static_cast<std::int64_t>(batch_rows));
+                batch_start = now;
+            }
+        };
+
+        const std::size_t batch_rows = std::max<std::size_t>(options.batch_rows, 1);
+        auto it = rows.begin();
+        const auto end = rows.end();
+
+        /* First batch, formatted inline */
+        for (; it != end && result.rows() != batch_rows; ++it)
+        {
+            lap(query_phase::fetch);
+            if (!result.described())
+            {
+                result.describe(*it);
+            }
+            result.append(*it);
+            lap(query_phase::format);
+        }
+        if (it == end)
+        {
+            lap(query_phase::fetch);
+            if (result.rows() != 0)
+            {
+                end_batch(result.rows());
+            }
+            return;
+        }
+        end_batch(batch_rows);
+
+        if (options.format_threads == 0)
+        {
+            for (; it != end; ++it)
+            {
+                lap(query_phase::fetch);
+                result.append(*it);
+                lap(query_phase::format);
+                if (result.rows() % batch_rows == 0)
+                {
+                    end_batch(batch_rows);
+                }
+            }
+            lap(query_phase::fetch);
+            if (result.rows() % batch_rows != 0)
+            {
+                end_batch(result.rows() % batch_rows);
+            }
+            return;
+        }
+
+        /* Next batches, formatted by the workers */
+        fetch_options pipeline_options = options;
+        pipeline_options.batch_rows = batch_rows;
+        pipeline_options.queue_depth = std::max<std::size_t>(options.queue_depth, 1);
+        format_pipeline pipeline(result, pipeline_options);
+        const auto& columns = result.column_infos();
+        raw_batch batch = pipeline.acquire();
+        for (; it != end; ++it)
+        {
+            extract_row(*it, columns, &batch.cells[batch.rows * columns.size()]);
+            if (++batch.rows == batch_rows)
+            {
+                end_batch(batch_rows);
+                pipeline.submit(batch);
+                batch = pipeline.acquire();
+            }
+        }
+        if (batch.rows != 0)
+        {
+            end_batch(batch.rows);
+            pipeline.submit(batch);
+        }
+        lap(query_phase::fetch);
+
+        pipeline.finish();
+        lap(query_phase::format);
+    }
+}
@@ -0,0 +1,597 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <set>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "xeus-sql/file_tables.hpp"
+#include "xeus-sql/result_set.hpp"
+#include "xeus-sql/scratch_db.hpp"
+
+#ifdef USE_SQLITE3
+#include "soci/sqlite3/soci-sqlite3.h"
+#endif
+
+namespace xeus_sql
+{
+    namespace
+    {
+        constexpr std::size_t npos = std::string_view::npos;
+
+        /* Position following the end of the row starting at pos, newlines
+           between quotes belong to the row */
+        std::size_t end_of_row(std::string_view data, std::size_t pos)
+        {
+            bool quoted = false;
+            while (pos < data.size())
+            {
+                const char* begin = data.data() + pos;
+                const void* newline = std::memchr(begin, '\n', data.size() - pos);
+                const std::size_t end = newline ? static_cast<const char*>(newline) - data.data() : data.size();
+                // "" escapes don't change the parity
+                quoted ^= (std::count(begin, data.data() + end, '"') & 1) != 0;
+                if (!quoted)
+                {
+                    return std::min(end + 1, data.size());
+                }
+                pos = end + 1;
+            }
+            return data.size();
+        }
+
+        bool parse_integer(std::string_view value, std::int64_t& res)
+        {
+            const char* end = value.data() + value.size();
+            auto parsed = std::from_chars(value.data() + (value.front() == '+' ? 1 : 0), end, res);
+            return parsed.ec == std::errc() && parsed.ptr == end;
+        }
+
+        /* "nan" is left as text, SQLite would store a NULL */
+        bool parse_real(std::string_view value, double& res)
+        {
+            res = parse_number(value);
+            return !std::isnan(res);
+        }
+    }
+
+    mapped_file::mapped_file(const std::string& path)
+    {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            throw std::runtime_error("cannot open " + path);
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size))
+        {
+            CloseHandle(file);
+            throw std::runtime_error("cannot read the size of " + path);
+        }
+        m_file = file;
+        m_size = static_cast<std::size_t>(size.QuadPart);
+        if (m_size != 0)
+        {
+            m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            m_data = m_mapping ? static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+            if (!m_data)
+            {
+                if (m_mapping)
+                {
+                    CloseHandle(m_mapping);
+                }
+                CloseHandle(file);
+                throw std::runtime_error("cannot map " + path);
+            }
+        }
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error("cannot open " + path + ": " + std::strerror(errno));
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0)
+        {
+            ::close(fd);
+            throw std::runtime_error("cannot read the size of " + path + ": " + std::strerror(errno));
+        }
+        m_size = static_cast<std::size_t>(st.st_size);
+        if (m_size != 0)
+        {
+            void* data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED)
+            {
+                ::close(fd);
+                throw std::runtime_error("cannot map " + path + ": " + std::strerror(errno));
+            }
+            ::madvise(data, m_size, MADV_SEQUENTIAL);
+            m_data = static_cast<const char*>(data);
+        }
+        // the mapping stays valid after the descriptor is closed
+        ::close(fd);
+#endif
+    }
+
+    mapped_file::~mapped_file()
+    {
+#ifdef _WIN32
+        if (m_data)
+        {
+            UnmapViewOfFile(m_data);
+            CloseHandle(m_mapping);
+        }
+        CloseHandle(m_file);
+#else
+        if (m_data)
+        {
+            ::munmap(const_cast<char*>(m_data), m_size);
+        }
+#endif
+    }
+
+    std::string_view mapped_file::data() const
+    {
+        return std::string_view(m_data, m_size);
+    }
+
+    csv_reader::csv_reader(std::string_view data, char delimiter, std::size_t offset)
+        : m_data(data)
+        , m_delimiter(delimiter)
+        , m_next(offset)
+        , m_row(offset)
+        , m_pos(npos)
+    {
+    }
+
+    bool csv_reader::next()
+    {
+        if (m_pos != npos)
+        {
+            m_next = end_of_row(m_data, m_pos);
+        }
+        m_fields.clear();
+        // blank lines are skipped
+        while (m_next < m_data.size() && (m_data[m_next] == '\n' || m_data[m_next] == '\r'))
+        {
+            ++m_next;
+        }
+        if (m_next >= m_data.size())
+        {
+            m_row = m_data.size();
+            m_pos = npos;
+            return false;
+        }
+        m_row = m_next;
+        m_pos = m_row;
+        return true;
+    }
+
+    std::size_t csv_reader::row_offset() const
+    {
+        return m_row;
+    }
+
+    std::string_view csv_reader::field(std::size_t column)
+    {
+        while (m_fields.size() <= column && split_field())
+        {
+        }
+        if (column >= m_fields.size())
+        {
+            return std::string_view();
+        }
+        return m_data.substr(m_fields[column].first, m_fields[column].second - m_fields[column].first);
+    }
+
+    std::size_t csv_reader::field_count()
+    {
+        while (split_field())
+        {
+        }
+        return m_fields.size();
+    }
+
+    bool csv_reader::split_field()
+    {
+        if (m_pos == npos)
+        {
+            return false;
+        }
+        const std::size_t size = m_data.size();
+        const std::size_t start = m_pos;
+        std::size_t pos = start;
+        if (pos < size && m_data[pos] == '"')
+        {
+            // closing quote, "" is an escaped quote
+            for (pos = m_data.find('"', pos + 1); pos != npos; pos = m_data.find('"', pos + 2))
+            {
+                if (pos + 1 >= size || m_data[pos + 1] != '"')
+                {
+                    break;
+                }
+            }
+            pos = pos == npos ? size : pos + 1;
+        }
+        while (pos < size && m_data[pos] != m_delimiter && m_data[pos] != '\n')
+        {
+            ++pos;
+        }
+
+        std::size_t end = pos;
+        if (pos < size && m_data[pos] == m_delimiter)
+        {
+            m_pos = pos + 1;
+        }
+        else
+        {
+            if (end > start && m_data[end - 1] == '\r')
+            {
+                --end;
+            }
+            m_next = std::min(pos + 1, size);
+            m_pos = npos;
+        }
+        m_fields.emplace_back(start, end);
+        return true;
+    }
+
+    std::string_view csv_reader::unquote(std::string_view field, std::string& buffer)
+    {
+        if (field.size() < 2 || field.front() != '"')
+        {
+            return field;
+        }
+        std::string_view inner = field.substr(1, field.back() == '"' ? field.size() - 2 : field.size() - 1);
+        if (inner.find('"') == npos)
+        {
+            return inner;
+        }
+        buffer.clear();
+        for (std::size_t i = 0; i < inner.size(); ++i)
+        {
+            if (inner[i] != '"')
+            {
+                buffer += inner[i];
+            }
+            else if (i + 1 < inner.size() && inner[i + 1] == '"')
+            {
+                buffer += '"';
+                ++i;
+            }
+        }
+        return buffer;
+    }
+
+    csv_schema infer_csv_schema(std::string_view data, std::size_t sample_rows)
+    {
+        csv_schema res;
+        // UTF-8 byte order mark
+        const std::size_t start = data.substr(0, 3) == "\xEF\xBB\xBF" ? 3 : 0;
+        res.data_offset = end_of_row(data, start);
+
+        const std::string_view header = data.substr(start, res.data_offset - start);
+        std::ptrdiff_t most = 0;
+        for (char delimiter : {',', ';', '\t', '|'})
+        {
+            const std::ptrdiff_t count = std::count(header.begin(), header.end(), delimiter);
+            if (count > most)
+            {
+                most = count;
+                res.delimiter = delimiter;
+            }
+        }
+
+        csv_reader reader(data, res.delimiter, start);
+        if (!reader.next())
+        {
+            throw std::runtime_error("the file is empty");
+        }
+        std::string buffer;
+        std::set<std::string> used;
+        const std::size_t columns = reader.field_count();
+        for (std::size_t col = 0; col != columns; ++col)
+        {
+            std::string name(csv_reader::unquote(reader.field(col), buffer));
+            name.erase(0, name.find_first_not_of(" \t"));
+            name.erase(name.find_last_not_of(" \t") + 1);
+            if (name.empty())
+            {
+                name = "column" + std::to_string(col + 1);
+            }
+            // column names are case insensitive in SQLite
+            std::string unique = name;
+            for (int suffix = 2; !used.insert(xv_bindings::to_lower(unique)).second; ++suffix)
+            {
+                unique = name + "_" + std::to_string(suffix);
+            }
+            res.names.push_back(std::move(unique));
+        }
+
+        res.types.assign(columns, csv_type::integer);
+        std::vector<bool> seen(columns, false);
+        for (std::size_t row = 0; row != sample_rows && reader.next(); ++row)
+        {
+            for (std::size_t col = 0; col != columns; ++col)
+            {
+                std::string_view cell = csv_reader::unquote(reader.field(col), buffer);
+                if (cell.empty() || res.types[col] == csv_type::text)
+                {
+                    continue;
+                }
+                seen[col] = true;
+                std::int64_t integer;
+                double real;
+                if (res.types[col] == csv_type::integer && !parse_integer(cell, integer))
+                {
+                    res.types[col] = csv_type::real;
+                }
+                if (res.types[col] == csv_type::real && !parse_real(cell, real))
+                {
+                    res.types[col] = csv_type::text;
+                }
+            }
+        }
+        for (std::size_t col = 0; col != columns; ++col)
+        {
+            if (!seen[col])
+            {
+                res.types[col] = csv_type::text;
+            }
+        }
+        return res;
+    }
+
+#ifdef USE_SQLITE3
+    namespace
+    {
+        using namespace sqlite_api;
+
+        constexpr const char* module_name = "xsql_csv";
+
+        /* SQLite only sees the base classes */
+        struct csv_vtab : sqlite3_vtab
+        {
+            std::unique_ptr<mapped_file> file;
+            csv_schema schema;
+        };
+
+        struct csv_cursor : sqlite3_vtab_cursor
+        {
+            explicit csv_cursor(const csv_vtab& table)
+                : sqlite3_vtab_cursor()
+                , reader(table.file->data(), table.schema.delimiter, table.schema.data_offset)
+            {
+            }
+
+            csv_reader reader;
+            bool eof = true;
+            std::string buffer;
+        };
+
+        /* CREATE VIRTUAL TABLE name USING xsql_csv('path') */
+        int csv_connect(sqlite3* db, void*, int argc, const char* const* argv,
+                        sqlite3_vtab** vtab, char** error)
+        {
+            try
+            {
+                if (argc != 4)
+                {
+                    throw std::runtime_error(std::string(module_name) + " takes the path of a file");
+                }
+                std::string path = argv[3];
+                if (path.size() >= 2 && path.front() == '\'' && path.back() == '\'')
+                {
+                    path = path.substr(1, path.size() - 2);
+                    for (std::size_t pos = path.find("''"); pos != npos; pos = path.find("''", pos + 1))
+                    {
+                        path.erase(pos, 1);
+                    }
+                }
+
+                auto table = std::make_unique<csv_vtab>();
+                table->file = std::make_unique<mapped_file>(path);
+                table->schema = infer_csv_schema(table->file->data());
+                std::string declaration = "CREATE TABLE x(";
+                for (std::size_t col = 0; col != table->schema.names.size(); ++col)
+                {
+                    const csv_type type = table->schema.types[col];
+                    declaration += (col ? ", " : "") + quote_sql(table->schema.names[col])
+                                   + (type == csv_type::integer ? " INTEGER" : type == csv_type::real ? " REAL" : " TEXT");
+                }
+                int rc = sqlite3_declare_vtab(db, (declaration + ")").c_str());
+                if (rc != SQLITE_OK)
+                {
+                    return rc;
+                }
+                *vtab = table.release();
+                return SQLITE_OK;
+            }
+            catch (const std::exception& e)
+            {
+                *error = sqlite3_mprintf("%s", e.what());
+                return SQLITE_ERROR;
+            }
+        }
+
+        int csv_disconnect(sqlite3_vtab* vtab)
+        {
+            delete static_cast<csv_vtab*>(vtab);
+            return SQLITE_OK;
+        }
+
+        /* Rows can only be scanned, constraints are checked by SQLite */
+        int csv_best_index(sqlite3_vtab* vtab, sqlite3_index_info* info)
+        {
+            info->estimatedCost = static_cast<double>(static_cast<csv_vtab*>(vtab)->file->data().size());
+            return SQLITE_OK;
+        }
+
+        int csv_open(sqlite3_vtab* vtab, sqlite3_vtab_cursor** cursor)
+        {
+            *cursor = new csv_cursor(*static_cast<csv_vtab*>(vtab));
+            return SQLITE_OK;
+        }
+
+        int csv_close(sqlite3_vtab_cursor* cursor)
+        {
+            delete static_cast<csv_cursor*>(cursor);
+            return SQLITE_OK;
+        }
+
+        int csv_filter(sqlite3_vtab_cursor* base, int, const char*, int, sqlite3_value**)
+        {
+            csv_cursor* cursor = static_cast<csv_cursor*>(base);
+            const csv_vtab* table = static_cast<const csv_vtab*>(base->pVtab);
+            cursor->reader = csv_reader(table->file->data(), table->schema.delimiter, table->schema.data_offset);
+            cursor->eof = !cursor->reader.next();
+            return SQLITE_OK;
+        }
+
+        int csv_next(sqlite3_vtab_cursor* base)
+        {
+            csv_cursor* cursor = static_cast<csv_cursor*>(base);
+            cursor->eof = !cursor->reader.next();
+            return SQLITE_OK;
+        }
+
+        int csv_eof(sqlite3_vtab_cursor* base)
+        {
+            return static_cast<csv_cursor*>(base)->eof;
+        }
+
+        /* Only the columns used by the query are requested, the other ones
+           are neither split nor converted */
+        int csv_column(sqlite3_vtab_cursor* base, sqlite3_context* context, int column)
+        {
+            csv_cursor* cursor = static_cast<csv_cursor*>(base);
+            const csv_vtab* table = static_cast<const csv_vtab*>(base->pVtab);
+            const std::string_view raw = cursor->reader.field(static_cast<std::size_t>(column));
+            if (raw.empty())
+            {
+                sqlite3_result_null(context);
+                return SQLITE_OK;
+            }
+            const csv_type type = table->schema.types[static_cast<std::size_t>(column)];
+            const std::string_view cell = csv_reader::unquote(raw, cursor->buffer);
+            std::int64_t integer;
+            double real;
+            if (type == csv_type::integer && !cell.empty() && parse_integer(cell, integer))
+            {
+                sqlite3_result_int64(context, integer);
+            }
+            else if (type != csv_type::text && !cell.empty() && parse_real(cell, real))
+            {
+                sqlite3_result_double(context, real);
+            }
+            else
+            {
+                // cells that are not copied live as long as the mapping
+                const bool copied = cell.data() == cursor->buffer.data();
+                sqlite3_result_text(context, cell.data(), static_cast<int>(cell.size()),
+                                    copied ? SQLITE_TRANSIENT : SQLITE_STATIC);
+            }
+            return SQLITE_OK;
+        }
+
+        int csv_rowid(sqlite3_vtab_cursor* base, sqlite3_int64* rowid)
+        {
+            *rowid = static_cast<sqlite3_int64>(static_cast<csv_cursor*>(base)->reader.row_offset());
+            return SQLITE_OK;
+        }
+
+        /* Without xUpdate, the tables are read-only */
+        const sqlite3_module& csv_module()
+        {
+            static const sqlite3_module module = [] {
+                sqlite3_module res = {};
+                res.xCreate = csv_connect;
+                res.xConnect = csv_connect;
+                res.xBestIndex = csv_best_index;
+                res.xDisconnect = csv_disconnect;
+                res.xDestroy = csv_disconnect;
+                res.xOpen = csv_open;
+                res.xClose = csv_close;
+                res.xFilter = csv_filter;
+                res.xNext = csv_next;
+                res.xEof = csv_eof;
+                res.xColumn = csv_column;
+                res.xRowid = csv_rowid;
+                return res;
+            }();
+            return module;
+        }
+    }
+
+    std::vector<std::string> load_file_tables(soci::session& session, const std::string& directory)
+    {
+        auto backend = dynamic_cast<soci::sqlite3_session_backend*>(session.get_backend());
+        if (!backend)
+        {
+            throw std::runtime_error("file tables require a SQLite session");
+        }
+        if (sqlite3_create_module(backend->conn_, module_name, &csv_module(), nullptr) != SQLITE_OK)
+        {
+            throw std::runtime_error(std::string("cannot register ") + module_name + ": "
+                                     + sqlite3_errmsg(backend->conn_));
+        }
+
+        namespace fs = std::filesystem;
+        if (!fs::is_directory(directory))
+        {
+            throw std::runtime_error("not a directory: " + directory);
+        }
+        std::vector<fs::path> files;
+        for (const auto& entry : fs::directory_iterator(directory))
+        {
+            const std::string extension = xv_bindings::to_lower(entry.path().extension().string());
+            if (entry.is_regular_file() && (extension == ".csv" || extension == ".tsv"))
+            {
+                files.push_back(entry.path());
+            }
+        }
+        std::sort(files.begin(), files.end());
+
+        std::vector<std::string> res;
+        for (const fs::path& file : files)
+        {
+            std::string name = file.stem().string();
+            session << "CREATE VIRTUAL TABLE " + quote_sql(name) + " USING " + module_name
+                       + "(" + quote_sql(file.string(), '\'') + ")";
+            res.push_back(std::move(name));
+        }
+        return res;
+    }
+#else
+    std::vector<std::string> load_file_tables(soci::session&, const std::string&)
+    {
+        throw std::runtime_error("file tables require xeus-sql to be built with SQLite3 (XSQL_WITH_SQLITE3)");
+    }
+#endif
+}
@@ -0,0 +1,531 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "xeus-sql/query_metrics.hpp"
+
+namespace xeus_sql
+{
+    namespace
+    {
+        inline bool is_word_char(char c)
+        {
+            return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '$';
+        }
+
+        inline std::size_t highest_bit(std::uint64_t v)
+        {
+#ifdef _MSC_VER
+            unsigned long index;
+            _BitScanReverse64(&index, v);
+            return static_cast<std::size_t>(index);
+#else
+            return static_cast<std::size_t>(63 - __builtin_clzll(v));
+#endif
+        }
+
+        std::string escape_label(const std::string& value)
+        {
+            std::string res;
+            res.reserve(value.size());
+            for (char c : value)
+            {
+                switch (c)
+                {
+                    case '\\': res += "\\\\"; break;
+                    case '"': res += "\\\""; break;
+                    case '\n': res += "\\n"; break;
+                    default: res += c;
+                }
+            }
+            return res;
+        }
+
+        std::string escape_html(const std::string& value)
+        {
+            std::string res;
+            res.reserve(value.size());
+            for (char c : value)
+            {
+                switch (c)
+                {
+                    case '<': res += "&lt;"; break;
+                    case '>': res += "&gt;"; break;
+                    case '&': res += "&amp;"; break;
+                    default: res += c;
+                }
+            }
+            return res;
+        }
+
+        const std::string other_fingerprint = "<other>";
+    }
+
+    std::string fingerprint(const std::string& sql)
+    {
+        std::string res;
+        res.reserve(sql.size());
+        const std::size_t size = sql.size();
+        std::size_t i = 0;
+
+        auto push_space = [&res]() {
+            if (!res.empty() && res.back() != ' ')
+            {
+                res += ' ';
+            }
+        };
+
+        while (i < size)
+        {
+            char c = sql[i];
+            if (c == '-' && i + 1 < size && sql[i + 1] == '-')
+            {
+                i = sql.find('\n', i);
+                i = i == std::string::npos ? size : i;
+                push_space();
+            }
+            else if (c == '/' && i + 1 < size && sql[i + 1] == '*')
+            {
+                i = sql.find("*/", i + 2);
+                i = i == std::string::npos ? size : i + 2;
+                push_space();
+            }
+            else if (c == '\'')
+            {
+                // string literal, '' being an escaped quote
+                ++i;
+                while (i < size)
+                {
+                    if (sql[i] == '\'' && (i + 1 >= size || sql[i + 1] != '\''))
+                    {
+                        break;
+                    }
+                    i += sql[i] == '\'' ? 2 : 1;
+                }
+                ++i;
+                res += '?';
+            }
+            else if (c == '"' || c == '`')
+            {
+                // quoted identifier, kept verbatim
+                std::size_t end = sql.find(c, i + 1);
+                end = end == std::string::npos ? size : end + 1;
+                res.append(sql, i, end - i);
+                i = end;
+            }
+            else if (std::isdigit(static_cast<unsigned char>(c)) &&
+                     (res.empty() || !is_word_char(res.back())))
+            {
+                while (i < size && (is_word_char(sql[i]) || sql[i] == '.'))
+                {
+                    ++i;
+                }
+                res += '?';
+            }
+            else if (std::isspace(static_cast<unsigned char>(c)))
+            {
+                push_space();
+                ++i;
+            }
+            else
+            {
+                res += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+                ++i;
+            }
+        }
+
+        // collapses lists of placeholders such as IN (?, ?, ?) into (?+)
+        std::string collapsed;
+        collapsed.reserve(res.size());
+        for (std::size_t j = 0; j < res.size(); ++j)
+        {
+            collapsed += res[j];
+            if (res[j] != '?')
+            {
+                continue;
+            }
+            std::size_t k = j + 1;
+            bool is_list = false;
+            while (true)
+            {
+                std::size_t n = k;
+                if (n < res.size() && res[n] == ' ') ++n;
+                if (n >= res.size() || res[n] != ',') break;
+                ++n;
+                if (n < res.size() && res[n] == ' ') ++n;
+                if (n >= res.size() || res[n] != '?') break;
+                k = n + 1;
+                is_list = true;
+            }
+            if (is_list)
+            {
+                collapsed += '+';
+                j = k - 1;
+            }
+        }
+
+        while (!collapsed.empty() && (collapsed.back() == ' ' || collapsed.back() == ';'))
+        {
+            collapsed.pop_back();
+        }
+        return collapsed;
+    }
+
+    /*********************************************
+     * latency_histogram implementation
+     *********************************************/
+
+    std::size_t latency_histogram::bucket_index(std::uint64_t micros)
+    {
+        if (micros < sub_buckets)
+        {
+            return static_cast<std::size_t>(micros);
+        }
+        // micros >> shift lands in [sub_buckets, 2 * sub_buckets)
+        std::size_t shift = highest_bit(micros) - 4;
+        std::size_t sub = static_cast<std::size_t>(micros >> shift) - sub_buckets;
+        std::size_t index = (shift + 1) * sub_buckets + sub;
+        return std::min(index, bucket_count - 1);
+    }
+
+    std::uint64_t latency_histogram::bucket_value(std::size_t index)
+    {
+        if (index < sub_buckets)
+        {
+            return index;
+        }
+        std::size_t shift = index / sub_buckets - 1;
+        std::uint64_t sub = index % sub_buckets;
+        // middle of the bucket
+        std::uint64_t low = (sub_buckets + sub) << shift;
+        return low + ((std::uint64_t(1) << shift) >> 1);
+    }
+
+    void latency_histogram::record(std::uint64_t micros)
+    {
+        m_buckets[bucket_index(micros)].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(micros, std::memory_order_relaxed);
+        std::uint64_t current = m_max.load(std::memory_order_relaxed);
+        while (micros > current &&
+               !m_max.compare_exchange_weak(current, micros, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    std::uint64_t latency_histogram::count() const
+    {
+        return m_count.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t latency_histogram::sum() const
+    {
+        return m_sum.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t latency_histogram::max() const
+    {
+        return m_max.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t latency_histogram::percentile(double q) const
+    {
+        std::uint64_t total = count();
+        if (total == 0)
+        {
+            return 0;
+        }
+        auto rank = static_cast<std::uint64_t>(q * static_cast<double>(total) + 0.5);
+        rank = std::max<std::uint64_t>(rank, 1);
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i != bucket_count; ++i)
+        {
+            seen += m_buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+            {
+                return std::min(bucket_value(i), max());
+            }
+        }
+        return max();
+    }
+
+    void latency_histogram::reset()
+    {
+        for (auto& b : m_buckets)
+        {
+            b.store(0, std::memory_order_relaxed);
+        }
+        m_count.store(0, std::memory_order_relaxed);
+        m_sum.store(0, std::memory_order_relaxed);
+        m_max.store(0, std::memory_order_relaxed);
+    }
+
+    void query_stats::reset()
+    {
+        queries.store(0, std::memory_order_relaxed);
+        rows.store(0, std::memory_order_relaxed);
+        bytes.store(0, std::memory_order_relaxed);
+        errors.store(0, std::memory_order_relaxed);
+        cache_hits.store(0, std::memory_order_relaxed);
+        latency.reset();
+    }
+
+    /*********************************************
+     * query_metrics implementation
+     *********************************************/
+
+    query_metrics::~query_metrics()
+    {
+        stop_dump();
+    }
+
+    query_stats& query_metrics::stats_for(const std::string& sql)
+    {
+        std::string key = fingerprint(sql);
+        {
+            std::shared_lock<std::shared_mutex> lock(m_mutex);
+            auto it = m_stats.find(key);
+            if (it != m_stats.end())
+            {
+                return *(it->second);
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(m_mutex);
+        if (m_stats.size() >= max_fingerprints && m_stats.find(key) == m_stats.end())
+        {
+            key = other_fingerprint;
+        }
+        auto& stats = m_stats[key];
+        if (!stats)
+        {
+            stats = std::make_unique<query_stats>();
+        }
+        return *stats;
+    }
+
+    void query_metrics::record_query(const std::string& sql,
+                                     duration elapsed,
+                                     std::size_t rows,
+                                     std::size_t bytes)
+    {
+        query_stats& stats = stats_for(sql);
+        auto micros = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+        stats.queries.fetch_add(1, std::memory_order_relaxed);
+        stats.rows.fetch_add(rows, std::memory_order_relaxed);
+        stats.bytes.fetch_add(bytes, std::memory_order_relaxed);
+        stats.latency.record(static_cast<std::uint64_t>(std::max<long long>(micros, 0)));
+    }
+
+    void query_metrics::record_error(const std::string& sql)
+    {
+        stats_for(sql).errors.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void query_metrics::record_cache_hit(const std::string& sql)
+    {
+        stats_for(sql).cache_hits.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void query_metrics::reset()
+    {
+        std::unique_lock<std::shared_mutex> lock(m_mutex);
+        m_stats.clear();
+    }
+
+    nl::json query_metrics::to_bundle() const
+    {
+        struct line
+        {
+            const std::string* fingerprint;
+            const query_stats* stats;
+        };
+        std::vector<line> lines;
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        for (const auto& s : m_stats)
+        {
+            lines.push_back({&s.first, s.second.get()});
+        }
+        // most expensive queries first
+        std::sort(lines.begin(), lines.end(), [](const line& lhs, const line& rhs) {
+            return lhs.stats->latency.sum() > rhs.stats->latency.sum();
+        });
+
+        static const std::vector<std::string> headers = {
+            "queries", "errors", "cache hits", "rows", "bytes",
+            "total (ms)", "p50 (ms)", "p90 (ms)", "p99 (ms)", "max (ms)", "fingerprint"
+        };
+
+        std::stringstream text;
+        std::stringstream html;
+        html << "<table>\n<tr>\n";
+        for (const auto& h : headers)
+        {
+            text << h << "\t";
+            html << "<th>" << h << "</th>\n";
+        }
+        text << "\n";
+        html << "</tr>\n";
+
+        auto ms = [](std::uint64_t micros) {
+            std::stringstream ss;
+            ss << std::fixed << std::setprecision(3) << static_cast<double>(micros) / 1000.;
+            return ss.str();
+        };
+
+        for (const auto& l : lines)
+        {
+            const query_stats& s = *l.stats;
+            std::vector<std::string> cells = {
+                std::to_string(s.queries.load(std::memory_order_relaxed)),
+                std::to_string(s.errors.load(std::memory_order_relaxed)),
+                std::to_string(s.cache_hits.load(std::memory_order_relaxed)),
+                std::to_string(s.rows.load(std::memory_order_relaxed)),
+                std::to_string(s.bytes.load(std::memory_order_relaxed)),
+                ms(s.latency.sum()),
+                ms(s.latency.percentile(0.5)),
+                ms(s.latency.percentile(0.9)),
+                ms(s.latency.percentile(0.99)),
+                ms(s.latency.max()),
+                *l.fingerprint
+            };
+            html << "<tr>\n";
+            for (const auto& c : cells)
+            {
+                text << c << "\t";
+                html << "<td>" << escape_html(c) << "</td>\n";
+            }
+            text << "\n";
+            html << "</tr>\n";
+        }
+        html << "</table>";
+
+        nl::json bundle = nl::json::object();
+        bundle["text/plain"] = text.str();
+        bundle["text/html"] = html.str();
+        return bundle;
+    }
+
+    std::string query_metrics::to_prometheus() const
+    {
+        static const std::array<double, 4> quantiles = {0.5, 0.9, 0.99, 1.};
+        using counter = std::atomic<std::uint64_t> query_stats::*;
+        static const std::array<std::pair<const char*, counter>, 5> counters = {{
+            {"xsql_queries_total", &query_stats::queries},
+            {"xsql_rows_fetched_total", &query_stats::rows},
+            {"xsql_bytes_published_total", &query_stats::bytes},
+            {"xsql_errors_total", &query_stats::errors},
+            {"xsql_cache_hits_total", &query_stats::cache_hits}
+        }};
+
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        std::vector<std::string> labels;
+        labels.reserve(m_stats.size());
+        for (const auto& s : m_stats)
+        {
+            labels.push_back("fingerprint=\"" + escape_label(s.first) + "\"");
+        }
+
+        /* The samples of a family follow its TYPE line without being
+           interleaved with other families */
+        std::stringstream out;
+        for (const auto& family : counters)
+        {
+            out << "# TYPE " << family.first << " counter\n";
+            std::size_t i = 0;
+            for (const auto& s : m_stats)
+            {
+                out << family.first << "{" << labels[i++] << "} " << ((*s.second).*family.second).load() << "\n";
+            }
+        }
+
+        std::stringstream summaries;
+        summaries << "# TYPE xsql_query_duration_seconds summary\n";
+        summaries << std::setprecision(9);
+        std::size_t i = 0;
+        for (const auto& s : m_stats)
+        {
+            const std::string& label = labels[i++];
+            const query_stats& st = *s.second;
+            for (double q : quantiles)
+            {
+                summaries << "xsql_query_duration_seconds{" << label << ",quantile=\"" << q << "\"} "
+                          << static_cast<double>(st.latency.percentile(q)) / 1e6 << "\n";
+            }
+            summaries << "xsql_query_duration_seconds_sum{" << label << "} "
+                      << static_cast<double>(st.latency.sum()) / 1e6 << "\n"
+                      << "xsql_query_duration_seconds_count{" << label << "} "
+                      << st.latency.count() << "\n";
+        }
+        return out.str() + summaries.str();
+    }
+
+    void query_metrics::dump(const std::string& path) const
+    {
+        /* write then rename so that scrapers never see a partial file, the
+           rename replaces the previous dump atomically */
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+            if (!out.good())
+            {
+                return;
+            }
+            out << to_prometheus();
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp, path, ec);
+        if (ec)
+        {
+            std::filesystem::remove(tmp, ec);
+        }
+    }
+
+    void query_metrics::start_dump(const std::string& path, std::chrono::seconds interval)
+    {
+        stop_dump();
+        if (interval.count() <= 0)
+        {
+            return;
+        }
+        m_stop_dump = false;
+        m_dump_thread = std::thread([this, path, interval]() {
+            std::unique_lock<std::mutex> lock(m_dump_mutex);
+            while (!m_dump_cv.wait_for(lock, interval, [this]() { return m_stop_dump; }))
+            {
+                dump(path);
+            }
+            dump(path);
+        });
+    }
+
+    void query_metrics::stop_dump()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_dump_mutex);
+            m_stop_dump = true;
+        }
+        m_dump_cv.notify_all();
+        if (m_dump_thread.joinable())
+        {
+            m_dump_thread.join();
+        }
+    }
+}
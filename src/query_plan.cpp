@@ -0,0 +1,745 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+#include "nlohmann/json.hpp"
+
+#include "xeus-sql/query_plan.hpp"
+#include "xeus-sql/result_set.hpp"
+#include "xeus-sql/scratch_db.hpp"
+
+namespace nl = nlohmann;
+
+namespace xeus_sql
+{
+    namespace
+    {
+        /* MySQL writes some numbers as strings */
+        double number_of(const nl::json& value)
+        {
+            if (value.is_number())
+            {
+                return value.get<double>();
+            }
+            if (value.is_string())
+            {
+                return std::strtod(value.get<std::string>().c_str(), nullptr);
+            }
+            return 0.;
+        }
+
+        void max_produced_rows(const nl::json& node, double& rows)
+        {
+            if (node.is_object())
+            {
+                for (auto it = node.begin(); it != node.end(); ++it)
+                {
+                    if (it.key() == "rows_produced_per_join")
+                    {
+                        rows = std::max(rows, number_of(it.value()));
+                    }
+                    else
+                    {
+                        max_produced_rows(it.value(), rows);
+                    }
+                }
+            }
+            else if (node.is_array())
+            {
+                for (const nl::json& child : node)
+                {
+                    max_produced_rows(child, rows);
+                }
+            }
+        }
+
+        result_set fetch_all(soci::session& session, const std::string& sql)
+        {
+            result_set res;
+            soci::rowset<soci::row> rows = (session.prepare << sql);
+            for (const soci::row& r : rows)
+            {
+                if (!res.described())
+                {
+                    res.describe(r);
+                }
+                res.append(r);
+            }
+            return res;
+        }
+
+        /* The plans in JSON may be split over several rows */
+        std::string concatenated_cells(const result_set& result)
+        {
+            std::string res;
+            for (std::size_t row = 0; row != result.rows(); ++row)
+            {
+                res += result.cell(row, 0);
+            }
+            return res;
+        }
+
+        std::string trim_statement(const std::string& sql)
+        {
+            std::size_t end = sql.find_last_not_of(" \t\r\n;");
+            return end == std::string::npos ? std::string() : sql.substr(0, end + 1);
+        }
+
+        std::string trim(const std::string& text)
+        {
+            const std::size_t start = text.find_first_not_of(" \t\r\n");
+            const std::size_t end = text.find_last_not_of(" \t\r\n");
+            return start == std::string::npos ? std::string() : text.substr(start, end - start + 1);
+        }
+
+        /* Largest rowid of a SQLite table, negative if it has none */
+        double largest_rowid(soci::session& session, const std::string& table)
+        {
+            try
+            {
+                // read from the end of the table b-tree
+                const result_set count = fetch_all(session, "SELECT max(rowid) FROM " + quote_sql(table));
+                if (count.rows() == 1)
+                {
+                    const std::string cell(count.cell(0, 0));
+                    return std::strtod(cell.c_str(), nullptr);
+                }
+            }
+            catch (const std::exception&)
+            {
+                // aliases and tables without rowid
+            }
+            return -1.;
+        }
+
+        void append_detail(plan_node& node, const std::string& detail)
+        {
+            if (!detail.empty())
+            {
+                node.detail += (node.detail.empty() ? "" : "; ") + detail;
+            }
+        }
+
+        plan_node postgresql_node(const nl::json& node)
+        {
+            plan_node res;
+            res.operation = node.value("Node Type", "");
+            if (node.contains("Relation Name"))
+            {
+                const std::string relation = node["Relation Name"].get<std::string>();
+                res.operation += " on " + relation;
+                const std::string alias = node.value("Alias", relation);
+                if (alias != relation)
+                {
+                    res.operation += " " + alias;
+                }
+            }
+            if (node.contains("Index Name"))
+            {
+                res.operation += " using " + node["Index Name"].get<std::string>();
+            }
+            for (const char* key : {"Index Cond", "Hash Cond", "Merge Cond", "Join Filter", "Filter",
+                                    "Sort Key", "Group Key"})
+            {
+                if (!node.contains(key))
+                {
+                    continue;
+                }
+                std::string value;
+                if (node[key].is_array())
+                {
+                    for (const nl::json& item : node[key])
+                    {
+                        value += (value.empty() ? "" : ", ") + item.get<std::string>();
+                    }
+                }
+                else
+                {
+                    value = node[key].get<std::string>();
+                }
+                append_detail(res, std::string(key) + ": " + value);
+            }
+            res.estimated_rows = number_of(node.value("Plan Rows", nl::json(-1.)));
+            res.cost = number_of(node.value("Total Cost", nl::json(-1.)));
+            if (node.contains("Actual Rows"))
+            {
+                res.actual_rows = number_of(node["Actual Rows"]);
+                res.loops = number_of(node.value("Actual Loops", nl::json(1.)));
+                res.time_ms = number_of(node.value("Actual Total Time", nl::json(0.))) * res.loops;
+            }
+            if (node.contains("Shared Hit Blocks"))
+            {
+                res.buffers = number_of(node["Shared Hit Blocks"]) + number_of(node.value("Shared Read Blocks", nl::json(0.)));
+            }
+            if (node.contains("Plans"))
+            {
+                for (const nl::json& child : node["Plans"])
+                {
+                    res.children.push_back(postgresql_node(child));
+                }
+            }
+            return res;
+        }
+
+        /* MySQL nests operations as objects named after them, and lists
+           the tables of joins in arrays */
+        plan_node mysql_node(const std::string& name, const nl::json& node)
+        {
+            plan_node res;
+            res.operation = name;
+            std::replace(res.operation.begin(), res.operation.end(), '_', ' ');
+            if (node.contains("table_name"))
+            {
+                res.operation += " " + node["table_name"].get<std::string>();
+            }
+            if (node.contains("access_type"))
+            {
+                res.operation += " (" + node["access_type"].get<std::string>() + ")";
+            }
+            if (node.contains("key"))
+            {
+                append_detail(res, "key: " + node["key"].get<std::string>());
+            }
+            if (node.contains("attached_condition"))
+            {
+                append_detail(res, "condition: " + node["attached_condition"].get<std::string>());
+            }
+            if (node.contains("rows_produced_per_join"))
+            {
+                res.estimated_rows = number_of(node["rows_produced_per_join"]);
+            }
+            for (auto it = node.begin(); it != node.end(); ++it)
+            {
+                if (it.key() == "cost_info")
+                {
+                    continue;
+                }
+                if (it.value().is_object())
+                {
+                    res.children.push_back(mysql_node(it.key(), it.value()));
+                }
+                else if (it.value().is_array())
+                {
+                    for (const nl::json& item : it.value())
+                    {
+                        if (!item.is_object())
+                        {
+                            continue;
+                        }
+                        if (item.size() == 1 && item.begin().value().is_object())
+                        {
+                            res.children.push_back(mysql_node(item.begin().key(), item.begin().value()));
+                        }
+                        else
+                        {
+                            res.children.push_back(mysql_node(it.key(), item));
+                        }
+                    }
+                }
+            }
+            if (node.contains("cost_info"))
+            {
+                const nl::json& cost = node["cost_info"];
+                if (cost.contains("query_cost"))
+                {
+                    res.cost = number_of(cost["query_cost"]);
+                }
+                else
+                {
+                    // the other costs are the costs of the operation alone,
+                    // the costs of the children are added like in the
+                    // plans of the other backends
+                    for (const char* key : {"read_cost", "eval_cost", "sort_cost"})
+                    {
+                        if (cost.contains(key))
+                        {
+                            res.cost = std::max(res.cost, 0.) + number_of(cost[key]);
+                        }
+                    }
+                    for (const plan_node& child : res.children)
+                    {
+                        if (child.cost >= 0.)
+                        {
+                            res.cost = std::max(res.cost, 0.) + child.cost;
+                        }
+                    }
+                }
+            }
+            return res;
+        }
+
+        double number_after(const std::string& text, const std::string& label, std::size_t from = 0)
+        {
+            const std::size_t pos = text.find(label, from);
+            return pos == std::string::npos ? -1. : std::strtod(text.c_str() + pos + label.size(), nullptr);
+        }
+
+        /* Consecutive nodes at `depth` from the line `next`, with the deeper
+           lines following each of them as children */
+        std::vector<plan_node> build_tree(const std::vector<std::pair<std::size_t, plan_node>>& lines,
+                                          std::size_t& next,
+                                          std::size_t depth)
+        {
+            std::vector<plan_node> res;
+            while (next != lines.size() && lines[next].first == depth)
+            {
+                res.push_back(lines[next].second);
+                ++next;
+                res.back().children = build_tree(lines, next, depth + 1);
+            }
+            return res;
+        }
+
+        std::vector<plan_node> sqlite_children(const std::vector<sqlite_plan_row>& rows, long long parent)
+        {
+            std::vector<plan_node> res;
+            for (const sqlite_plan_row& row : rows)
+            {
+                if (row.parent == parent && row.id != parent)
+                {
+                    plan_node node;
+                    node.operation = row.detail;
+                    node.children = sqlite_children(rows, row.id);
+                    res.push_back(std::move(node));
+                }
+            }
+            return res;
+        }
+
+        void estimate_sqlite_scans(soci::session& session, const std::string& sql, plan_node& node)
+        {
+            const std::vector<std::string> tables = sqlite_scanned_tables({node.operation}, sql);
+            if (tables.size() == 1)
+            {
+                node.estimated_rows = largest_rowid(session, tables.front());
+                node.cost = node.estimated_rows;
+            }
+            for (plan_node& child : node.children)
+            {
+                estimate_sqlite_scans(session, sql, child);
+            }
+        }
+
+        /* Time, or cost without timings, spent in a node without its
+           children */
+        double own_share(const plan_node& node, bool timed)
+        {
+            const double value = timed ? node.time_ms : node.cost;
+            if (value < 0.)
+            {
+                return 0.;
+            }
+            double children = 0.;
+            for (const plan_node& child : node.children)
+            {
+                children += std::max(timed ? child.time_ms : child.cost, 0.);
+            }
+            return std::max(value - children, 0.);
+        }
+
+        double total_share(const plan_node& node, bool timed)
+        {
+            double res = own_share(node, timed);
+            for (const plan_node& child : node.children)
+            {
+                res += total_share(child, timed);
+            }
+            return res;
+        }
+
+        std::string format_number(double value, int precision)
+        {
+            std::stringstream ss;
+            ss << std::fixed << std::setprecision(precision) << value;
+            return ss.str();
+        }
+
+        std::string node_summary(const plan_node& node, bool timed, double total)
+        {
+            std::vector<std::string> parts;
+            if (node.estimated_rows >= 0.)
+            {
+                parts.push_back("est. " + format_number(node.estimated_rows, 0) + " rows");
+            }
+            if (node.actual_rows >= 0.)
+            {
+                std::string actual = "actual " + format_number(node.actual_rows, 0) + " rows";
+                if (node.loops > 1.)
+                {
+                    actual += " x " + format_number(node.loops, 0) + " loops";
+                }
+                parts.push_back(actual);
+                const double estimated = node.estimated_rows;
+                const double ratio = std::max(estimated, node.actual_rows)
+                                     / std::max(std::min(estimated, node.actual_rows), 1.);
+                if (estimated >= 0. && ratio >= 10.)
+                {
+                    parts.push_back("rows misestimated x" + format_number(ratio, 0));
+                }
+            }
+            if (node.time_ms >= 0.)
+            {
+                parts.push_back(format_number(node.time_ms, 3) + " ms");
+            }
+            if (node.buffers >= 0.)
+            {
+                parts.push_back(format_number(node.buffers, 0) + " buffers");
+            }
+            if (node.cost >= 0.)
+            {
+                parts.push_back("cost " + format_number(node.cost, 2));
+            }
+            if (total > 0.)
+            {
+                parts.push_back(format_number(100. * own_share(node, timed) / total, 0) + "% of the "
+                                + (timed ? "time" : "cost"));
+            }
+            std::string res;
+            for (const std::string& part : parts)
+            {
+                res += (res.empty() ? "" : ", ") + part;
+            }
+            return res;
+        }
+
+        std::string escape_html(const std::string& value)
+        {
+            std::string res;
+            res.reserve(value.size());
+            for (char c : value)
+            {
+                switch (c)
+                {
+                    case '<': res += "&lt;"; break;
+                    case '>': res += "&gt;"; break;
+                    case '&': res += "&amp;"; break;
+                    default: res += c;
+                }
+            }
+            return res;
+        }
+
+        void append_text(std::string& out, const plan_node& node, bool timed, double total, std::size_t depth)
+        {
+            const std::string indent(2 * depth, ' ');
+            out += indent + "-> " + node.operation;
+            const std::string summary = node_summary(node, timed, total);
+            if (!summary.empty())
+            {
+                out += "  (" + summary + ")";
+            }
+            out += '\n';
+            if (!node.detail.empty())
+            {
+                out += indent + "     " + node.detail + '\n';
+            }
+            for (const plan_node& child : node.children)
+            {
+                append_text(out, child, timed, total, depth + 1);
+            }
+        }
+
+        void append_html(std::string& out, const plan_node& node, bool timed, double total)
+        {
+            // the background gets redder with the share of the node
+            const double share = total > 0. ? own_share(node, timed) / total : 0.;
+            std::string summary = "<summary style=\"padding: 2px 4px";
+            if (share >= 0.1)
+            {
+                summary += "; background: rgba(255, 64, 0, " + format_number(0.15 + 0.6 * share, 2) + ")";
+            }
+            summary += "\"><b>" + escape_html(node.operation) + "</b> <span>"
+                       + escape_html(node_summary(node, timed, total)) + "</span></summary>";
+            out += "<li><details open>" + summary;
+            if (!node.detail.empty())
+            {
+                out += "<div style=\"margin-left: 1.5em; opacity: 0.7\">" + escape_html(node.detail) + "</div>";
+            }
+            if (!node.children.empty())
+            {
+                out += "<ul style=\"list-style: none; padding-left: 1.5em; border-left: 1px dotted gray\">";
+                for (const plan_node& child : node.children)
+                {
+                    append_html(out, child, timed, total);
+                }
+                out += "</ul>";
+            }
+            out += "</details></li>";
+        }
+
+        std::string plan_header(const query_plan& plan)
+        {
+            std::string res;
+            if (plan.planning_ms >= 0.)
+            {
+                res += "Planning " + format_number(plan.planning_ms, 3) + " ms";
+            }
+            if (plan.execution_ms >= 0.)
+            {
+                res += (res.empty() ? "Execution " : ", execution ") + format_number(plan.execution_ms, 3) + " ms";
+            }
+            return res;
+        }
+    }
+
+    query_plan parse_postgresql_plan(const std::string& json)
+    {
+        const nl::json output = nl::json::parse(json);
+        const nl::json& plan = output.is_array() ? output.at(0) : output;
+        query_plan res;
+        res.root = postgresql_node(plan.at("Plan"));
+        res.planning_ms = number_of(plan.value("Planning Time", nl::json(-1.)));
+        res.execution_ms = number_of(plan.value("Execution Time", nl::json(-1.)));
+        return res;
+    }
+
+    query_plan parse_mysql_plan(const std::string& json)
+    {
+        query_plan res;
+        res.root = mysql_node("query_block", nl::json::parse(json).at("query_block"));
+        return res;
+    }
+
+    query_plan parse_mysql_analyze(const std::string& tree)
+    {
+        std::vector<std::pair<std::size_t, plan_node>> lines;
+        std::stringstream input(tree);
+        for (std::string line; std::getline(input, line);)
+        {
+            const std::size_t arrow = line.find("-> ");
+            if (arrow == std::string::npos)
+            {
+                // conditions that don't fit on the line of their node
+                if (!lines.empty())
+                {
+                    append_detail(lines.back().second, trim(line));
+                }
+                continue;
+            }
+            plan_node node;
+            const std::string text = line.substr(arrow + 3);
+            const std::size_t cost = text.find("(cost=");
+            const std::size_t actual = text.find("(actual time=");
+            node.operation = trim(text.substr(0, std::min(std::min(cost, actual), text.find("(never executed)"))));
+            if (cost != std::string::npos)
+            {
+                node.cost = number_after(text, "cost=", cost);
+                node.estimated_rows = number_after(text.substr(0, actual), "rows=", cost);
+            }
+            if (actual != std::string::npos)
+            {
+                // time=first..last per loop
+                node.loops = number_after(text, "loops=", actual);
+                node.time_ms = number_after(text, "..", actual) * std::max(node.loops, 1.);
+                node.actual_rows = number_after(text, "rows=", actual);
+            }
+            lines.emplace_back(arrow / 4, std::move(node));
+        }
+
+        query_plan res;
+        std::size_t next = 0;
+        std::vector<plan_node> roots = build_tree(lines, next, lines.empty() ? 0 : lines.front().first);
+        if (roots.size() == 1)
+        {
+            res.root = std::move(roots.front());
+        }
+        else
+        {
+            res.root.operation = "query";
+            res.root.children = std::move(roots);
+        }
+        res.execution_ms = res.root.time_ms;
+        return res;
+    }
+
+    query_plan parse_sqlite_plan(const std::vector<sqlite_plan_row>& rows)
+    {
+        query_plan res;
+        res.root.operation = "QUERY PLAN";
+        res.root.children = sqlite_children(rows, 0);
+        return res;
+    }
+
+    query_plan explain_query(soci::session& session, const std::string& sql, bool analyze)
+    {
+        const std::string backend = session.get_backend_name();
+        const std::string statement = trim_statement(sql);
+        if (backend == "postgresql")
+        {
+            const std::string command = analyze ? "EXPLAIN (ANALYZE, BUFFERS, FORMAT JSON) " : "EXPLAIN (FORMAT JSON) ";
+            return parse_postgresql_plan(concatenated_cells(fetch_all(session, command + statement)));
+        }
+        if (backend == "mysql")
+        {
+            if (analyze)
+            {
+                return parse_mysql_analyze(concatenated_cells(fetch_all(session, "EXPLAIN ANALYZE " + statement)));
+            }
+            return parse_mysql_plan(concatenated_cells(fetch_all(session, "EXPLAIN FORMAT=JSON " + statement)));
+        }
+        if (backend == "sqlite3")
+        {
+            const result_set output = fetch_all(session, "EXPLAIN QUERY PLAN " + statement);
+            std::vector<sqlite_plan_row> rows;
+            for (std::size_t row = 0; row != output.rows(); ++row)
+            {
+                rows.push_back({std::atoll(std::string(output.cell(row, 0)).c_str()),
+                                std::atoll(std::string(output.cell(row, 1)).c_str()),
+                                std::string(output.cell(row, output.columns() - 1))});
+            }
+            query_plan res = parse_sqlite_plan(rows);
+            estimate_sqlite_scans(session, statement, res.root);
+            if (analyze)
+            {
+                const auto start = std::chrono::steady_clock::now();
+                soci::rowset<soci::row> result = (session.prepare << statement);
+                double count = 0.;
+                for (auto it = result.begin(); it != result.end(); ++it)
+                {
+                    ++count;
+                }
+                res.execution_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                res.root.actual_rows = count;
+                res.root.loops = 1.;
+                res.root.time_ms = res.execution_ms;
+            }
+            return res;
+        }
+        throw std::runtime_error("no query plans for " + backend);
+    }
+
+    std::string plan_to_text(const query_plan& plan)
+    {
+        const bool timed = plan.root.time_ms >= 0.;
+        std::string res = plan_header(plan);
+        res += res.empty() ? "" : "\n";
+        append_text(res, plan.root, timed, total_share(plan.root, timed), 0);
+        return res;
+    }
+
+    std::string plan_to_html(const query_plan& plan)
+    {
+        const bool timed = plan.root.time_ms >= 0.;
+        std::string res = "<div>";
+        const std::string header = plan_header(plan);
+        if (!header.empty())
+        {
+            res += "<p>" + header + "</p>";
+        }
+        res += "<ul style=\"list-style: none; padding-left: 0\">";
+        append_html(res, plan.root, timed, total_share(plan.root, timed));
+        return res + "</ul></div>";
+    }
+
+    plan_estimate parse_postgresql_estimate(const std::string& json)
+    {
+        const plan_node root = parse_postgresql_plan(json).root;
+        plan_estimate res;
+        res.rows = root.estimated_rows;
+        res.cost = root.cost;
+        return res;
+    }
+
+    plan_estimate parse_mysql_estimate(const std::string& json)
+    {
+        const nl::json plan = nl::json::parse(json);
+        const nl::json& block = plan.at("query_block");
+        plan_estimate res;
+        if (block.contains("cost_info"))
+        {
+            res.cost = number_of(block["cost_info"].value("query_cost", nl::json()));
+        }
+        max_produced_rows(block, res.rows);
+        return res;
+    }
+
+    std::vector<std::string> sqlite_scanned_tables(const std::vector<std::string>& details, const std::string& sql)
+    {
+        const std::map<std::string, std::string> aliases = table_aliases(sql);
+        std::vector<std::string> res;
+        for (const std::string& detail : details)
+        {
+            std::stringstream words(detail);
+            std::string word;
+            words >> word;
+            if (word != "SCAN")
+            {
+                continue;
+            }
+            words >> word;
+            // before SQLite 3.36, "SCAN TABLE name"
+            if (word == "TABLE")
+            {
+                words >> word;
+            }
+            // constant rows, subqueries and common table expressions
+            if (word.empty() || word == "CONSTANT" || word == "SUBQUERY" || word.front() == '(')
+            {
+                continue;
+            }
+            // since SQLite 3.36, the alias of the table when it has one
+            auto alias = aliases.find(xv_bindings::to_lower(word));
+            res.push_back(alias == aliases.end() ? word : alias->second);
+        }
+        return res;
+    }
+
+    plan_estimate estimate_query(soci::session& session, const std::string& sql)
+    {
+        const std::string backend = session.get_backend_name();
+        const std::string statement = trim_statement(sql);
+        if (backend == "postgresql")
+        {
+            return parse_postgresql_estimate(concatenated_cells(fetch_all(session, "EXPLAIN (FORMAT JSON) " + statement)));
+        }
+        if (backend == "mysql")
+        {
+            return parse_mysql_estimate(concatenated_cells(fetch_all(session, "EXPLAIN FORMAT=JSON " + statement)));
+        }
+        if (backend == "sqlite3")
+        {
+            const result_set plan = fetch_all(session, "EXPLAIN QUERY PLAN " + statement);
+            std::vector<std::string> details;
+            for (std::size_t row = 0; row != plan.rows(); ++row)
+            {
+                details.emplace_back(plan.cell(row, plan.columns() - 1));
+            }
+            /* The full scans of a join are nested loops, each row of the
+               outer scan reads the whole inner table */
+            plan_estimate res;
+            bool scanned = false;
+            for (const std::string& table : sqlite_scanned_tables(details, statement))
+            {
+                const double rows = largest_rowid(session, table);
+                if (rows >= 0.)
+                {
+                    res.rows = scanned ? res.rows * rows : rows;
+                    scanned = true;
+                }
+            }
+            res.cost = res.rows;
+            return res;
+        }
+        throw std::runtime_error("no query plan estimates for " + backend);
+    }
+
+    std::string limit_query(const std::string& sql, std::size_t rows)
+    {
+        // the line breaks end a comment on the last line of the query
+        return "SELECT * FROM (\n" + trim_statement(sql) + "\n) AS xsql_guarded LIMIT " + std::to_string(rows);
+    }
+}
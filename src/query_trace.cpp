@@ -0,0 +1,235 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+#include "xeus-sql/query_trace.hpp"
+
+namespace nl = nlohmann;
+
+namespace xeus_sql
+{
+    namespace
+    {
+        struct trace_event
+        {
+            const char* name;
+            std::int64_t start;
+            std::int64_t end;
+            std::int64_t arg;
+        };
+
+        /* Single producer (the owning thread), single consumer (the
+           flushing thread) ring buffer. */
+        struct thread_buffer
+        {
+            static constexpr std::size_t capacity = 16384;
+
+            explicit thread_buffer(std::size_t id)
+                : tid(id)
+            {
+            }
+
+            bool push(const trace_event& e)
+            {
+                std::uint64_t h = head.load(std::memory_order_relaxed);
+                if (h - tail.load(std::memory_order_acquire) >= capacity)
+                {
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                events[h % capacity] = e;
+                head.store(h + 1, std::memory_order_release);
+                return true;
+            }
+
+            std::array<trace_event, capacity> events;
+            std::atomic<std::uint64_t> head = {0};
+            std::atomic<std::uint64_t> tail = {0};
+            std::atomic<std::uint64_t> dropped = {0};
+            // set when the thread exits, nothing is pushed afterwards
+            std::atomic<bool> retired = {false};
+            std::size_t tid;
+        };
+
+        std::atomic<bool> tracing_on = {false};
+
+        std::mutex& registry_mutex()
+        {
+            static std::mutex m;
+            return m;
+        }
+
+        /* Buffers outlive their thread so that their spans can still be
+           flushed, retired buffers are removed once drained */
+        std::vector<std::shared_ptr<thread_buffer>>& registry()
+        {
+            static std::vector<std::shared_ptr<thread_buffer>> buffers;
+            return buffers;
+        }
+
+        void unregister(const std::shared_ptr<thread_buffer>& buffer)
+        {
+            auto& buffers = registry();
+            buffers.erase(std::remove(buffers.begin(), buffers.end(), buffer), buffers.end());
+        }
+
+        /* Owned by the thread_local of the recording thread */
+        class buffer_holder
+        {
+        public:
+
+            buffer_holder()
+            {
+                static std::size_t last_tid = 0;
+                std::lock_guard<std::mutex> lock(registry_mutex());
+                m_buffer = std::make_shared<thread_buffer>(++last_tid);
+                registry().push_back(m_buffer);
+            }
+
+            ~buffer_holder()
+            {
+                std::lock_guard<std::mutex> lock(registry_mutex());
+                m_buffer->retired.store(true, std::memory_order_release);
+                if (m_buffer->head.load(std::memory_order_relaxed) == m_buffer->tail.load(std::memory_order_acquire) &&
+                    m_buffer->dropped.load(std::memory_order_relaxed) == 0)
+                {
+                    unregister(m_buffer);
+                }
+            }
+
+            buffer_holder(const buffer_holder&) = delete;
+            buffer_holder& operator=(const buffer_holder&) = delete;
+
+            thread_buffer& buffer()
+            {
+                return *m_buffer;
+            }
+
+        private:
+
+            std::shared_ptr<thread_buffer> m_buffer;
+        };
+
+        thread_buffer& local_buffer()
+        {
+            thread_local buffer_holder holder;
+            return holder.buffer();
+        }
+
+        const std::chrono::steady_clock::time_point trace_epoch = std::chrono::steady_clock::now();
+    }
+
+    void set_tracing(bool enabled)
+    {
+        tracing_on.store(enabled, std::memory_order_relaxed);
+    }
+
+    bool tracing_enabled()
+    {
+        return tracing_on.load(std::memory_order_relaxed);
+    }
+
+    std::int64_t trace_now()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - trace_epoch).count();
+    }
+
+    void record_span(const char* name, std::int64_t start, std::int64_t end, std::int64_t arg)
+    {
+        local_buffer().push({name, start, end, arg});
+    }
+
+    std::size_t trace_buffers()
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        return registry().size();
+    }
+
+    std::size_t write_trace(const std::string& path)
+    {
+        std::vector<std::shared_ptr<thread_buffer>> buffers;
+        {
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            buffers = registry();
+        }
+
+        nl::json events = nl::json::array();
+        std::vector<std::shared_ptr<thread_buffer>> drained;
+        for (const auto& buffer : buffers)
+        {
+            // read first, the spans of a retired buffer are all pushed
+            if (buffer->retired.load(std::memory_order_acquire))
+            {
+                drained.push_back(buffer);
+            }
+            std::uint64_t tail = buffer->tail.load(std::memory_order_relaxed);
+            std::uint64_t head = buffer->head.load(std::memory_order_acquire);
+            for (std::uint64_t i = tail; i != head; ++i)
+            {
+                const trace_event& e = buffer->events[i % thread_buffer::capacity];
+                nl::json event = {
+                    {"name", e.name},
+                    {"cat", "xsql"},
+                    {"ph", "X"},
+                    {"ts", e.start},
+                    {"dur", e.end - e.start},
+                    {"pid", 1},
+                    {"tid", buffer->tid}
+                };
+                if (e.arg >= 0)
+                {
+                    event["args"] = {{"rows", e.arg}};
+                }
+                events.push_back(std::move(event));
+            }
+            buffer->tail.store(head, std::memory_order_release);
+
+            std::uint64_t dropped = buffer->dropped.exchange(0, std::memory_order_relaxed);
+            if (dropped != 0)
+            {
+                events.push_back({
+                    {"name", "dropped spans"},
+                    {"ph", "C"},
+                    {"ts", trace_now()},
+                    {"pid", 1},
+                    {"tid", buffer->tid},
+                    {"args", {{"dropped", dropped}}}
+                });
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            for (const auto& buffer : drained)
+            {
+                unregister(buffer);
+            }
+        }
+
+        std::size_t count = events.size();
+        std::ofstream out(path, std::ios::trunc);
+        if (!out.good())
+        {
+            throw std::runtime_error("can't write trace file: " + path);
+        }
+        out << nl::json{{"traceEvents", std::move(events)}, {"displayTimeUnit", "ms"}}.dump();
+        return count;
+    }
+}
@@ -0,0 +1,290 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/vfs.h>
+#endif
+
+#include "xeus-sql/result_arena.hpp"
+#include "xeus-sql/result_cache.hpp"
+
+namespace xeus_sql
+{
+    namespace
+    {
+        std::mutex spill_mutex;
+        spill_options spill_settings;
+        std::atomic<std::size_t> resident_bytes(0);
+        std::atomic<mapping_observer> observer(nullptr);
+
+        void notify_mapping(std::ptrdiff_t bytes)
+        {
+            if (mapping_observer o = observer.load(std::memory_order_relaxed))
+            {
+                o(bytes);
+            }
+        }
+        std::pmr::pool_options arena_pools()
+        {
+            std::pmr::pool_options res;
+            // larger blocks go to the system resource one by one
+            res.largest_required_pool_block = result_arena::mapping_threshold / 4;
+            return res;
+        }
+
+        void* map_pages(std::size_t bytes)
+        {
+#ifdef _WIN32
+            void* res = ::VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+            if (res == nullptr)
+            {
+                throw std::bad_alloc();
+            }
+#else
+            void* res = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (res == MAP_FAILED)
+            {
+                throw std::bad_alloc();
+            }
+#endif
+            return res;
+        }
+
+        void unmap_pages(void* p, std::size_t bytes)
+        {
+#ifdef _WIN32
+            (void)bytes;
+            ::VirtualFree(p, 0, MEM_RELEASE);
+#else
+            ::munmap(p, bytes);
+#endif
+        }
+
+        /* Maps a temporary file which is deleted as soon as it is unmapped */
+        void* map_spill_file(std::size_t bytes, const std::string& directory)
+        {
+            const std::string error = "can't create a spill file in " + directory;
+#ifdef _WIN32
+            char path[MAX_PATH];
+            if (::GetTempFileNameA(directory.c_str(), "xsq", 0, path) == 0)
+            {
+                throw std::runtime_error(error);
+            }
+            HANDLE file = ::CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                                        FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+            if (file == INVALID_HANDLE_VALUE)
+            {
+                throw std::runtime_error(error);
+            }
+            const unsigned long long size = bytes;
+            HANDLE mapping = ::CreateFileMappingA(file, nullptr, PAGE_READWRITE,
+                                                  static_cast<DWORD>(size >> 32),
+                                                  static_cast<DWORD>(size & 0xFFFFFFFF), nullptr);
+            void* res = mapping != nullptr ? ::MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, bytes) : nullptr;
+            // the view keeps the file alive until it is unmapped
+            if (mapping != nullptr)
+            {
+                ::CloseHandle(mapping);
+            }
+            ::CloseHandle(file);
+            if (res == nullptr)
+            {
+                throw std::runtime_error(error);
+            }
+#else
+            std::string path = directory + "/xsql_spill_XXXXXX";
+            int fd = ::mkstemp(&path[0]);
+            if (fd == -1)
+            {
+                throw std::runtime_error(error);
+            }
+            ::unlink(path.c_str());
+#ifdef __linux__
+            // the disk space is reserved now rather than failing on a write
+            const bool sized = ::posix_fallocate(fd, 0, static_cast<off_t>(bytes)) == 0;
+#else
+            const bool sized = ::ftruncate(fd, static_cast<off_t>(bytes)) == 0;
+#endif
+            void* res = sized ? ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+            ::close(fd);
+            if (res == MAP_FAILED)
+            {
+                throw std::runtime_error(error + " (no space left?)");
+            }
+#endif
+            return res;
+        }
+
+        /* Spilling to a tmpfs only moves the pages from the memory to the
+           swap, if any */
+        std::string check_spill_directory(const std::string& directory)
+        {
+#ifdef __linux__
+            const long tmpfs_magic = 0x01021994;
+            struct statfs info;
+            if (::statfs(directory.c_str(), &info) == 0 && static_cast<long>(info.f_type) == tmpfs_magic)
+            {
+                return "The spill directory " + directory + " is a tmpfs, spilled results will stay in memory. "
+                       "Set XSQL_SPILL_DIR or the directory of %SPILL to a directory on disk.";
+            }
+#else
+            (void)directory;
+#endif
+            return "";
+        }
+
+        void unmap_spill_file(void* p, std::size_t bytes)
+        {
+#ifdef _WIN32
+            (void)bytes;
+            ::UnmapViewOfFile(p);
+#else
+            ::munmap(p, bytes);
+#endif
+        }
+    }
+
+    void set_mapping_observer(mapping_observer o)
+    {
+        observer.store(o, std::memory_order_relaxed);
+    }
+
+    std::string set_spill_options(const spill_options& options)
+    {
+        std::lock_guard<std::mutex> lock(spill_mutex);
+        spill_settings = options;
+        if (spill_settings.directory.empty())
+        {
+            spill_settings.directory = default_spill_directory();
+        }
+        if (spill_settings.budget != 0)
+        {
+            std::error_code ec;
+            std::filesystem::create_directories(spill_settings.directory, ec);
+            return check_spill_directory(spill_settings.directory);
+        }
+        return "";
+    }
+
+    std::string default_spill_directory()
+    {
+        return result_cache::default_directory();
+    }
+
+    spill_options get_spill_options()
+    {
+        std::lock_guard<std::mutex> lock(spill_mutex);
+        return spill_settings;
+    }
+
+    std::size_t resident_arena_bytes()
+    {
+        return resident_bytes.load(std::memory_order_relaxed);
+    }
+
+    result_arena::result_arena()
+        : m_pool(arena_pools(), &m_system)
+    {
+    }
+
+    std::pmr::memory_resource* result_arena::resource()
+    {
+        return &m_pool;
+    }
+
+    std::size_t result_arena::reserved() const
+    {
+        return m_system.reserved;
+    }
+
+    std::size_t result_arena::peak() const
+    {
+        return m_system.peak;
+    }
+
+    std::size_t result_arena::spilled() const
+    {
+        return m_system.spilled;
+    }
+
+    void* result_arena::system_resource::do_allocate(std::size_t bytes, std::size_t alignment)
+    {
+        void* res = nullptr;
+        if (bytes < mapping_threshold)
+        {
+            res = ::operator new(bytes, std::align_val_t(alignment));
+            resident_bytes += bytes;
+        }
+        else
+        {
+            // mapped blocks are page aligned
+            const spill_options options = get_spill_options();
+            if (options.budget != 0 && resident_bytes.load(std::memory_order_relaxed) + bytes > options.budget)
+            {
+                res = map_spill_file(bytes, options.directory);
+                m_spilled_blocks.insert(res);
+                spilled += bytes;
+            }
+            else
+            {
+                res = map_pages(bytes);
+                resident_bytes += bytes;
+            }
+            notify_mapping(static_cast<std::ptrdiff_t>(bytes));
+        }
+        reserved += bytes;
+        peak = std::max(peak, reserved);
+        return res;
+    }
+
+    void result_arena::system_resource::do_deallocate(void* p, std::size_t bytes, std::size_t alignment)
+    {
+        if (bytes < mapping_threshold)
+        {
+            ::operator delete(p, std::align_val_t(alignment));
+            resident_bytes -= bytes;
+        }
+        else if (m_spilled_blocks.erase(p) != 0)
+        {
+            unmap_spill_file(p, bytes);
+            spilled -= bytes;
+            notify_mapping(-static_cast<std::ptrdiff_t>(bytes));
+        }
+        else
+        {
+            unmap_pages(p, bytes);
+            resident_bytes -= bytes;
+            notify_mapping(-static_cast<std::ptrdiff_t>(bytes));
+        }
+        reserved -= bytes;
+    }
+
+    bool result_arena::system_resource::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+    {
+        return this == &other;
+    }
+}
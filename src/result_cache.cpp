@@ -0,0 +1,356 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "xeus-sql/result_cache.hpp"
+#include "xeus-sql/file_tables.hpp"
+
+namespace xeus_sql
+{
+    namespace fs = std::filesystem;
+
+    namespace
+    {
+        const char magic[] = "XSQLRC01";
+        constexpr std::size_t magic_size = sizeof(magic) - 1;
+        const char* const extension = ".xsqlc";
+
+        /* FNV-1a, file names must not depend on the standard library */
+        std::uint64_t hash_key(std::string_view key)
+        {
+            std::uint64_t res = 0xCBF29CE484222325ull;
+            for (char c : key)
+            {
+                res ^= static_cast<unsigned char>(c);
+                res *= 0x100000001B3ull;
+            }
+            return res;
+        }
+
+        std::int64_t seconds_since_epoch(std::chrono::system_clock::time_point time)
+        {
+            return std::chrono::duration_cast<std::chrono::seconds>(time.time_since_epoch()).count();
+        }
+
+        struct cache_file
+        {
+            fs::path path;
+            std::uintmax_t size;
+            fs::file_time_type last_use;
+        };
+
+        std::vector<cache_file> cache_files(const std::string& directory)
+        {
+            std::vector<cache_file> res;
+            std::error_code ec;
+            for (fs::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec))
+            {
+                if (it->path().extension() != extension)
+                {
+                    continue;
+                }
+                std::error_code file_ec;
+                cache_file file = {it->path(), it->file_size(file_ec), it->last_write_time(file_ec)};
+                // files removed by another kernel in the meantime
+                if (!file_ec)
+                {
+                    res.push_back(std::move(file));
+                }
+            }
+            return res;
+        }
+    }
+
+    std::string normalize_sql(std::string_view sql)
+    {
+        std::string res;
+        res.reserve(sql.size());
+        char quote = '\0';
+        bool space = false;
+        for (char c : sql)
+        {
+            if (quote == '\0' && std::isspace(static_cast<unsigned char>(c)))
+            {
+                space = true;
+                continue;
+            }
+            if (space && !res.empty())
+            {
+                res += ' ';
+            }
+            space = false;
+            res += c;
+            if (quote == '\0' && (c == '\'' || c == '"' || c == '`'))
+            {
+                quote = c;
+            }
+            else if (c == quote)
+            {
+                quote = '\0';
+            }
+        }
+        while (!res.empty() && (res.back() == ';' || res.back() == ' '))
+        {
+            res.pop_back();
+        }
+        return res;
+    }
+
+    std::chrono::seconds parse_ttl(const std::string& ttl)
+    {
+        std::size_t end = 0;
+        long long value = -1;
+        try
+        {
+            value = std::stoll(ttl, &end);
+        }
+        catch (const std::logic_error&)
+        {
+        }
+        const std::string unit = ttl.substr(end);
+        long long scale = 0;
+        if (unit.empty() || unit == "s")
+        {
+            scale = 1;
+        }
+        else if (unit == "m")
+        {
+            scale = 60;
+        }
+        else if (unit == "h")
+        {
+            scale = 3600;
+        }
+        else if (unit == "d")
+        {
+            scale = 86400;
+        }
+        if (value <= 0 || scale == 0)
+        {
+            throw std::runtime_error("invalid ttl: " + ttl);
+        }
+        return std::chrono::seconds(value * scale);
+    }
+
+    std::string result_cache::default_directory()
+    {
+        if (const char* env = std::getenv("XDG_CACHE_HOME"))
+        {
+            return (fs::path(env) / "xeus-sql").string();
+        }
+#ifdef _WIN32
+        if (const char* env = std::getenv("LOCALAPPDATA"))
+        {
+            return (fs::path(env) / "xeus-sql" / "cache").string();
+        }
+#else
+        if (const char* env = std::getenv("HOME"))
+        {
+            return (fs::path(env) / ".cache" / "xeus-sql").string();
+        }
+#endif
+        return (fs::temp_directory_path() / "xeus-sql-cache").string();
+    }
+
+    result_cache::result_cache()
+        : m_capacity(default_capacity)
+    {
+    }
+
+    void result_cache::configure(const std::string& directory, std::size_t capacity)
+    {
+        m_directory = directory.empty() ? default_directory() : directory;
+        m_capacity = capacity;
+    }
+
+    const std::string& result_cache::directory() const
+    {
+        return m_directory;
+    }
+
+    std::size_t result_cache::capacity() const
+    {
+        return m_capacity;
+    }
+
+    std::string result_cache::path_of(const std::string& key) const
+    {
+        static const char digits[] = "0123456789abcdef";
+        std::string name(16, '0');
+        std::uint64_t hash = hash_key(key);
+        for (std::size_t i = 16; i-- != 0; hash >>= 4)
+        {
+            name[i] = digits[hash & 0xF];
+        }
+        return (fs::path(m_directory) / (name + extension)).string();
+    }
+
+    std::shared_ptr<const result_set> result_cache::load(const std::string& connection,
+                                                         const std::string& sql) const
+    {
+        const std::string key = connection + '\n' + normalize_sql(sql);
+        const std::string path = path_of(key);
+        std::error_code ec;
+        if (m_directory.empty() || !fs::exists(path, ec))
+        {
+            return nullptr;
+        }
+
+        std::shared_ptr<result_set> res;
+        bool expired = false;
+        try
+        {
+            mapped_file file(path);
+            std::string_view data = file.data();
+            std::int64_t expires = 0;
+            std::uint64_t key_size = 0;
+            const std::size_t header_size = magic_size + sizeof(expires) + sizeof(key_size);
+            if (data.size() < header_size || data.compare(0, magic_size, magic) != 0)
+            {
+                return nullptr;
+            }
+            std::memcpy(&expires, data.data() + magic_size, sizeof(expires));
+            std::memcpy(&key_size, data.data() + magic_size + sizeof(expires), sizeof(key_size));
+            data.remove_prefix(header_size);
+            // another query with the same hash
+            if (key_size != key.size() || data.compare(0, key.size(), key) != 0)
+            {
+                return nullptr;
+            }
+            data.remove_prefix(key.size());
+            expired = expires <= seconds_since_epoch(std::chrono::system_clock::now());
+            if (!expired)
+            {
+                res = std::make_shared<result_set>(result_set::read(data));
+            }
+        }
+        catch (const std::runtime_error&)
+        {
+            // removed by another kernel, or corrupted
+            expired = true;
+        }
+        if (expired)
+        {
+            fs::remove(path, ec);
+            return nullptr;
+        }
+        // the modification time orders the files for the eviction
+        fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+        return res;
+    }
+
+    void result_cache::store(const std::string& connection,
+                             const std::string& sql,
+                             const result_set& result,
+                             std::chrono::seconds ttl)
+    {
+        if (m_directory.empty())
+        {
+            return;
+        }
+        const std::string key = connection + '\n' + normalize_sql(sql);
+        const std::string path = path_of(key);
+
+        /* The cache is best effort: a file that can't be written only costs
+           the next execution of the query */
+        std::error_code ec;
+        fs::create_directories(m_directory, ec);
+        const std::string tmp = path + ".tmp" + std::to_string(std::random_device()());
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            const std::int64_t expires = seconds_since_epoch(std::chrono::system_clock::now() + ttl);
+            const std::uint64_t key_size = key.size();
+            out.write(magic, magic_size);
+            out.write(reinterpret_cast<const char*>(&expires), sizeof(expires));
+            out.write(reinterpret_cast<const char*>(&key_size), sizeof(key_size));
+            out.write(key.data(), static_cast<std::streamsize>(key.size()));
+            result.write(out);
+            out.close();
+            if (!out)
+            {
+                fs::remove(tmp, ec);
+                return;
+            }
+        }
+        fs::rename(tmp, path, ec);
+        if (ec)
+        {
+            fs::remove(tmp, ec);
+            return;
+        }
+        evict();
+    }
+
+    /* Removes the least recently used files beyond the capacity */
+    void result_cache::evict()
+    {
+        std::vector<cache_file> files = cache_files(m_directory);
+        std::uintmax_t total = 0;
+        for (const cache_file& file : files)
+        {
+            total += file.size;
+        }
+        if (total <= m_capacity)
+        {
+            return;
+        }
+        std::sort(files.begin(), files.end(), [](const cache_file& lhs, const cache_file& rhs) {
+            return lhs.last_use < rhs.last_use;
+        });
+        for (const cache_file& file : files)
+        {
+            if (total <= m_capacity)
+            {
+                break;
+            }
+            std::error_code ec;
+            fs::remove(file.path, ec);
+            total -= file.size;
+        }
+    }
+
+    std::size_t result_cache::entries() const
+    {
+        return cache_files(m_directory).size();
+    }
+
+    std::size_t result_cache::size() const
+    {
+        std::size_t res = 0;
+        for (const cache_file& file : cache_files(m_directory))
+        {
+            res += static_cast<std::size_t>(file.size);
+        }
+        return res;
+    }
+
+    std::size_t result_cache::clear()
+    {
+        std::size_t res = 0;
+        for (const cache_file& file : cache_files(m_directory))
+        {
+            std::error_code ec;
+            if (fs::remove(file.path, ec))
+            {
+                res += static_cast<std::size_t>(file.size);
+            }
+        }
+        return res;
+    }
+}
@@ -0,0 +1,173 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <algorithm>
+#include <stdexcept>
+#include <string_view>
+
+#include "xeus-sql/result_diff.hpp"
+
+#include "cell_hash.hpp"
+
+namespace xeus_sql
+{
+    namespace
+    {
+        /* Order-dependent combination of the hashes of the cells of a row */
+        inline std::uint64_t combine(std::uint64_t seed, std::uint64_t value)
+        {
+            return mix(seed ^ (value + 0x9E3779B97F4A7C15ull + (seed << 6) + (seed >> 2)));
+        }
+
+        bool same_columns(const result_set& lhs, const result_set& rhs)
+        {
+            if (lhs.columns() != rhs.columns())
+            {
+                return false;
+            }
+            for (std::size_t col = 0; col != lhs.columns(); ++col)
+            {
+                if (lhs.column(col).name != rhs.column(col).name)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+
+    result_diff::result_diff(std::vector<std::string> key)
+        : m_key(std::move(key))
+    {
+    }
+
+    void result_diff::hash_rows(const result_set& result,
+                                std::vector<std::uint64_t>& keys,
+                                std::vector<std::uint64_t>& hashes) const
+    {
+        std::vector<bool> key_columns(result.columns(), m_key.empty());
+        for (const std::string& name : m_key)
+        {
+            std::size_t col = 0;
+            while (col != result.columns() && result.column(col).name != name)
+            {
+                ++col;
+            }
+            if (col == result.columns())
+            {
+                throw std::runtime_error("unknown key column: " + name);
+            }
+            key_columns[col] = true;
+        }
+
+        keys.assign(result.rows(), 0);
+        hashes.assign(result.rows(), 0);
+        std::vector<std::uint64_t> value_hashes;
+        for (std::size_t col = 0; col != result.columns(); ++col)
+        {
+            const string_dictionary* dictionary = result.dictionary(col);
+            if (dictionary != nullptr)
+            {
+                value_hashes.resize(dictionary->size());
+                for (std::uint32_t code = 0; code != dictionary->size(); ++code)
+                {
+                    value_hashes[code] = hash_cell(dictionary->value(code));
+                }
+            }
+            for (std::size_t row = 0; row != result.rows(); ++row)
+            {
+                const std::uint64_t h = dictionary != nullptr ? value_hashes[result.codes(col)[row]]
+                                                              : hash_cell(result.cell(row, col));
+                hashes[row] = combine(hashes[row], h);
+                if (key_columns[col])
+                {
+                    keys[row] = combine(keys[row], h);
+                }
+            }
+        }
+    }
+
+    std::vector<row_change> result_diff::update(std::shared_ptr<const result_set> result)
+    {
+        std::vector<std::uint64_t> keys;
+        std::vector<std::uint64_t> hashes;
+        hash_rows(*result, keys, hashes);
+
+        row_map rows;
+        rows.reserve(result->rows());
+        for (std::size_t row = 0; row != result->rows(); ++row)
+        {
+            // the n-th occurrence of a key gets a key of its own
+            while (!rows.emplace(keys[row], row_entry{hashes[row], row}).second)
+            {
+                keys[row] = mix(keys[row] + 1);
+            }
+        }
+
+        // rows of results with other columns never match
+        const bool comparable = m_current != nullptr && same_columns(*m_current, *result);
+        std::vector<row_change> res;
+        for (std::size_t row = 0; row != result->rows(); ++row)
+        {
+            auto previous = comparable ? m_rows.find(keys[row]) : m_rows.end();
+            if (previous == m_rows.end())
+            {
+                res.push_back({row_change::added, row});
+            }
+            else if (previous->second.hash != hashes[row])
+            {
+                res.push_back({row_change::changed, row});
+            }
+        }
+        std::vector<std::size_t> removed;
+        for (const auto& entry : m_rows)
+        {
+            if (!comparable || rows.find(entry.first) == rows.end())
+            {
+                removed.push_back(entry.second.row);
+            }
+        }
+        std::sort(removed.begin(), removed.end());
+        for (std::size_t row : removed)
+        {
+            res.push_back({row_change::removed, row});
+        }
+
+        m_previous = std::move(m_current);
+        m_current = std::move(result);
+        m_rows = std::move(rows);
+        return res;
+    }
+
+    result_set result_diff::changes_table(const std::vector<row_change>& changes) const
+    {
+        result_set res;
+        if (!m_current)
+        {
+            return res;
+        }
+        res.add_column("change", soci::dt_string);
+        for (const column_info& column : m_current->column_infos())
+        {
+            res.add_column(column.name, column.type);
+        }
+        for (const row_change& change : changes)
+        {
+            static const char* const marks[] = {"+", "~", "-"};
+            const result_set& from = change.kind == row_change::removed ? *m_previous : *m_current;
+            res.append_cell(marks[change.kind]);
+            for (std::size_t col = 0; col != m_current->columns(); ++col)
+            {
+                // removed rows of a result with other columns
+                res.append_cell(col < from.columns() ? from.cell(change.row, col) : std::string_view());
+            }
+        }
+        return res;
+    }
+}
@@ -0,0 +1,303 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string_view>
+
+#include "xeus-sql/result_grid.hpp"
+
+namespace xeus_sql
+{
+    namespace
+    {
+        /* Filter with its value parsed once */
+        struct compiled_filter
+        {
+            std::size_t column;
+            enum { contains, eq, ne, lt, le, gt, ge } op;
+            std::string value;
+            double number;
+            bool numeric;
+
+            bool accept(std::string_view cell) const
+            {
+                if (op == contains)
+                {
+                    return cell.find(value) != std::string_view::npos;
+                }
+                int cmp = 0;
+                if (numeric)
+                {
+                    double lhs = parse_number(cell);
+                    if (std::isnan(lhs))
+                    {
+                        // NULL or unparsable cells only match !=
+                        return op == ne;
+                    }
+                    cmp = lhs < number ? -1 : (lhs > number ? 1 : 0);
+                }
+                else
+                {
+                    cmp = cell.compare(value);
+                }
+                switch (op)
+                {
+                    case eq: return cmp == 0;
+                    case ne: return cmp != 0;
+                    case lt: return cmp < 0;
+                    case le: return cmp <= 0;
+                    case gt: return cmp > 0;
+                    case ge: return cmp >= 0;
+                    default: return false;
+                }
+            }
+        };
+
+        compiled_filter compile(const grid_filter& filter, const result_set& result)
+        {
+            if (filter.column >= result.columns())
+            {
+                throw std::runtime_error("invalid filter column: " + std::to_string(filter.column));
+            }
+            compiled_filter res;
+            res.column = filter.column;
+            res.value = filter.value;
+            res.number = parse_number(filter.value);
+            res.numeric = is_numeric(result.column(filter.column).type) && !std::isnan(res.number);
+            if (filter.op == "contains") res.op = compiled_filter::contains;
+            else if (filter.op == "=") res.op = compiled_filter::eq;
+            else if (filter.op == "!=") res.op = compiled_filter::ne;
+            else if (filter.op == "<") res.op = compiled_filter::lt;
+            else if (filter.op == "<=") res.op = compiled_filter::le;
+            else if (filter.op == ">") res.op = compiled_filter::gt;
+            else if (filter.op == ">=") res.op = compiled_filter::ge;
+            else throw std::runtime_error("invalid filter operator: " + filter.op);
+            return res;
+        }
+    }
+
+    result_view::result_view(std::shared_ptr<const result_set> result)
+        : m_result(std::move(result))
+    {
+        filter();
+    }
+
+    void result_view::sort_by(long column, bool ascending)
+    {
+        if (column >= static_cast<long>(m_result->columns()))
+        {
+            throw std::runtime_error("invalid sort column: " + std::to_string(column));
+        }
+        m_sort_column = column;
+        m_ascending = ascending;
+        sort();
+        filter();
+    }
+
+    void result_view::set_filters(std::vector<grid_filter> filters)
+    {
+        // an invalid filter throws before it replaces the current ones
+        for (const grid_filter& filter : filters)
+        {
+            compile(filter, *m_result);
+        }
+        m_filters = std::move(filters);
+        filter();
+    }
+
+    std::size_t result_view::size() const
+    {
+        return m_rows.size();
+    }
+
+    const result_set& result_view::result() const
+    {
+        return *m_result;
+    }
+
+    nl::json result_view::schema() const
+    {
+        nl::json res = nl::json::array();
+        for (std::size_t col = 0; col != m_result->columns(); ++col)
+        {
+            const column_info& info = m_result->column(col);
+            res.push_back({{"name", info.name}, {"numeric", is_numeric(info.type)}});
+        }
+        return res;
+    }
+
+    nl::json result_view::window(std::size_t start, std::size_t count) const
+    {
+        nl::json res = nl::json::array();
+        const std::size_t end = start < m_rows.size() ? start + std::min(count, m_rows.size() - start) : start;
+        for (std::size_t i = start; i < end; ++i)
+        {
+            nl::json row = nl::json::array();
+            for (std::size_t col = 0; col != m_result->columns(); ++col)
+            {
+                row.push_back(m_result->cell(m_rows[i], col));
+            }
+            res.push_back(std::move(row));
+        }
+        return res;
+    }
+
+    void result_view::sort()
+    {
+        const result_set& result = *m_result;
+        m_order.clear();
+        if (m_sort_column < 0)
+        {
+            return;
+        }
+
+        m_order.resize(result.rows());
+        for (std::size_t row = 0; row != m_order.size(); ++row)
+        {
+            m_order[row] = row;
+        }
+        const std::size_t col = static_cast<std::size_t>(m_sort_column);
+        const bool ascending = m_ascending;
+        if (is_numeric(result.column(col).type))
+        {
+            // cells are parsed once, NULLs go last whatever the order
+            std::vector<double> keys(result.rows());
+            for (std::size_t row = 0; row != keys.size(); ++row)
+            {
+                keys[row] = parse_number(result.cell(row, col));
+            }
+            std::stable_sort(m_order.begin(), m_order.end(), [&](std::size_t lhs, std::size_t rhs) {
+                double a = keys[lhs];
+                double b = keys[rhs];
+                if (std::isnan(a) || std::isnan(b))
+                {
+                    return !std::isnan(a) && std::isnan(b);
+                }
+                return ascending ? a < b : b < a;
+            });
+        }
+        else
+        {
+            std::stable_sort(m_order.begin(), m_order.end(), [&](std::size_t lhs, std::size_t rhs) {
+                std::string_view a = result.cell(lhs, col);
+                std::string_view b = result.cell(rhs, col);
+                return ascending ? a < b : b < a;
+            });
+        }
+    }
+
+    void result_view::filter()
+    {
+        const result_set& result = *m_result;
+
+        std::vector<compiled_filter> filters;
+        for (const grid_filter& filter : m_filters)
+        {
+            filters.push_back(compile(filter, result));
+        }
+
+        m_rows.clear();
+        for (std::size_t i = 0; i != result.rows(); ++i)
+        {
+            const std::size_t row = m_order.empty() ? i : m_order[i];
+            bool accepted = std::all_of(filters.begin(), filters.end(), [&](const compiled_filter& f) {
+                return f.accept(result.cell(row, f.column));
+            });
+            if (accepted)
+            {
+                m_rows.push_back(row);
+            }
+        }
+    }
+
+    result_grid::result_grid(xeus::xcomm&& comm, std::shared_ptr<const result_set> result)
+        : m_comm(std::move(comm))
+        , m_view(std::move(result))
+    {
+        m_comm.on_message([this](const xeus::xmessage& message) { handle_message(message); });
+        m_comm.on_close([this](const xeus::xmessage&) { m_closed = true; });
+
+        nl::json data = reply(0, 100);
+        data["columns"] = m_view.schema();
+        m_comm.open(nl::json::object(), std::move(data), xeus::buffer_sequence());
+    }
+
+    nl::json result_grid::model() const
+    {
+        return {
+            {"comm_id", m_comm.id()},
+            {"columns", m_view.schema()},
+            {"total", m_view.size()}
+        };
+    }
+
+    bool result_grid::closed() const
+    {
+        return m_closed;
+    }
+
+    void result_grid::close()
+    {
+        if (!m_closed)
+        {
+            m_closed = true;
+            m_comm.close(nl::json::object(), nl::json::object(), xeus::buffer_sequence());
+        }
+    }
+
+    void result_grid::handle_message(const xeus::xmessage& message)
+    {
+        try
+        {
+            const nl::json data = message.content().value("data", nl::json::object());
+            const std::size_t start = data.value("start", std::size_t(0));
+            const std::size_t count = data.value("count", std::size_t(100));
+            const std::string request = data.value("request", "window");
+            if (request == "sort")
+            {
+                const nl::json& column = data.value("column", nl::json());
+                m_view.sort_by(column.is_number() ? column.get<long>() : -1,
+                               data.value("ascending", true));
+            }
+            else if (request == "filter")
+            {
+                std::vector<grid_filter> filters;
+                for (const auto& f : data.value("filters", nl::json::array()))
+                {
+                    filters.push_back({f.at("column").get<std::size_t>(),
+                                       f.value("op", "contains"),
+                                       f.value("value", "")});
+                }
+                m_view.set_filters(std::move(filters));
+            }
+            else if (request != "window")
+            {
+                throw std::runtime_error("invalid request: " + request);
+            }
+            m_comm.send(nl::json::object(), reply(start, count), xeus::buffer_sequence());
+        }
+        catch (const std::exception& e)
+        {
+            nl::json error = {{"response", "error"}, {"message", e.what()}};
+            m_comm.send(nl::json::object(), std::move(error), xeus::buffer_sequence());
+        }
+    }
+
+    nl::json result_grid::reply(std::size_t start, std::size_t count) const
+    {
+        return {
+            {"response", "window"},
+            {"start", start},
+            {"total", m_view.size()},
+            {"rows", m_view.window(start, std::min(count, max_window))}
+        };
+    }
+}
@@ -0,0 +1,885 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+
+#include "xeus-sql/result_set.hpp"
+
+// Floating point std::to_chars and std::from_chars are not available in
+// every standard library
+#if defined(__cpp_lib_to_chars) || defined(_MSC_VER)
+#define XSQL_HAS_FLOAT_TO_CHARS 1
+#define XSQL_HAS_FLOAT_FROM_CHARS 1
+#endif
+
+namespace xeus_sql
+{
+    namespace
+    {
+        /* Implementations shared by std::string and cell_buffer */
+        template <class S>
+        void append_integer_to(S& out, long long value)
+        {
+            char buffer[24];
+            auto res = std::to_chars(buffer, buffer + sizeof(buffer), value);
+            out.append(buffer, res.ptr);
+        }
+
+        template <class S>
+        void append_unsigned_to(S& out, unsigned long long value)
+        {
+            char buffer[24];
+            auto res = std::to_chars(buffer, buffer + sizeof(buffer), value);
+            out.append(buffer, res.ptr);
+        }
+
+        template <class S>
+        void append_double_to(S& out, double value)
+        {
+            char buffer[32];
+#ifdef XSQL_HAS_FLOAT_TO_CHARS
+            auto res = std::to_chars(buffer, buffer + sizeof(buffer), value);
+            out.append(buffer, res.ptr);
+#else
+            // the shortest of %.15g and %.17g that round-trips
+            int size = std::snprintf(buffer, sizeof(buffer), "%.15g", value);
+            if (std::strtod(buffer, nullptr) != value)
+            {
+                size = std::snprintf(buffer, sizeof(buffer), "%.17g", value);
+            }
+            out.append(buffer, static_cast<std::size_t>(size));
+#endif
+        }
+
+        template <class S>
+        inline void append_two_digits(S& out, int value)
+        {
+            out += static_cast<char>('0' + value / 10 % 10);
+            out += static_cast<char>('0' + value % 10);
+        }
+
+        template <class S>
+        void append_date_to(S& out, const std::tm& value)
+        {
+            const int year = value.tm_year + 1900;
+            if (year >= 0 && year <= 9999)
+            {
+                append_two_digits(out, year / 100);
+                append_two_digits(out, year % 100);
+            }
+            else
+            {
+                append_integer_to(out, year);
+            }
+            out += '-';
+            append_two_digits(out, value.tm_mon + 1);
+            out += '-';
+            append_two_digits(out, value.tm_mday);
+            out += ' ';
+            append_two_digits(out, value.tm_hour);
+            out += ':';
+            append_two_digits(out, value.tm_min);
+            out += ':';
+            append_two_digits(out, value.tm_sec);
+        }
+    }
+
+    void append_integer(std::string& out, long long value)
+    {
+        append_integer_to(out, value);
+    }
+
+    void append_integer(cell_buffer& out, long long value)
+    {
+        append_integer_to(out, value);
+    }
+
+    void append_unsigned(std::string& out, unsigned long long value)
+    {
+        append_unsigned_to(out, value);
+    }
+
+    void append_unsigned(cell_buffer& out, unsigned long long value)
+    {
+        append_unsigned_to(out, value);
+    }
+
+    void append_double(std::string& out, double value)
+    {
+        append_double_to(out, value);
+    }
+
+    void append_double(cell_buffer& out, double value)
+    {
+        append_double_to(out, value);
+    }
+
+    double parse_number(std::string_view text)
+    {
+        const double invalid = std::numeric_limits<double>::quiet_NaN();
+        // from_chars rejects the leading + that strtod accepts
+        if (!text.empty() && text.front() == '+')
+        {
+            text.remove_prefix(1);
+            if (!text.empty() && text.front() == '-')
+            {
+                return invalid;
+            }
+        }
+#ifdef XSQL_HAS_FLOAT_FROM_CHARS
+        double res;
+        const char* end = text.data() + text.size();
+        auto parsed = std::from_chars(text.data(), end, res);
+        return parsed.ec == std::errc() && parsed.ptr == end ? res : invalid;
+#else
+        // cells are not null terminated, they are copied before strtod,
+        // which also skips spaces and reads hexadecimal numbers
+        char buffer[64];
+        if (text.empty() || text.size() >= sizeof(buffer) || std::isspace(static_cast<unsigned char>(text.front()))
+            || text.find_first_of("xX") != std::string_view::npos)
+        {
+            return invalid;
+        }
+        text.copy(buffer, text.size());
+        buffer[text.size()] = '\0';
+        char* end = nullptr;
+        double res = std::strtod(buffer, &end);
+        return end == buffer + text.size() ? res : invalid;
+#endif
+    }
+
+    void append_date(std::string& out, const std::tm& value)
+    {
+        append_date_to(out, value);
+    }
+
+    void append_date(cell_buffer& out, const std::tm& value)
+    {
+        append_date_to(out, value);
+    }
+
+    bool is_numeric(soci::data_type type)
+    {
+        return type == soci::dt_double || type == soci::dt_integer ||
+               type == soci::dt_long_long || type == soci::dt_unsigned_long_long;
+    }
+
+    namespace
+    {
+        void format_string(cell_buffer& out, const soci::row& r, std::size_t i)
+        {
+            out += r.get<std::string>(i);
+        }
+
+        void format_double(cell_buffer& out, const soci::row& r, std::size_t i)
+        {
+            append_double(out, r.get<double>(i));
+        }
+
+        void format_integer(cell_buffer& out, const soci::row& r, std::size_t i)
+        {
+            append_integer(out, r.get<int>(i));
+        }
+
+        void format_long_long(cell_buffer& out, const soci::row& r, std::size_t i)
+        {
+            append_integer(out, r.get<long long>(i));
+        }
+
+        void format_unsigned_long_long(cell_buffer& out, const soci::row& r, std::size_t i)
+        {
+            append_unsigned(out, r.get<unsigned long long>(i));
+        }
+
+        void format_date(cell_buffer& out, const soci::row& r, std::size_t i)
+        {
+            append_date(out, r.get<std::tm>(i));
+        }
+
+        void format_nothing(cell_buffer&, const soci::row&, std::size_t)
+        {
+        }
+
+        cell_formatter select_formatter(soci::data_type type)
+        {
+            switch (type)
+            {
+                case soci::dt_string:
+                    return &format_string;
+                case soci::dt_double:
+                    return &format_double;
+                case soci::dt_integer:
+                    return &format_integer;
+                case soci::dt_long_long:
+                    return &format_long_long;
+                case soci::dt_unsigned_long_long:
+                    return &format_unsigned_long_long;
+                case soci::dt_date:
+                    return &format_date;
+                default:
+                    // blobs and xml are not displayed
+                    return &format_nothing;
+            }
+        }
+
+        const std::string null_cell = "NULL";
+
+        const std::uint32_t empty_slot = static_cast<std::uint32_t>(-1);
+
+        /* Images are written in the byte order of the machine, sizes and
+           offsets as 64 bits integers */
+        template <class T>
+        void write_value(std::ostream& out, T value)
+        {
+            out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+
+        void write_bytes(std::ostream& out, std::string_view bytes)
+        {
+            write_value<std::uint64_t>(out, bytes.size());
+            out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        }
+
+        void write_offsets(std::ostream& out, const std::pmr::vector<std::size_t>& offsets)
+        {
+            if constexpr (sizeof(std::size_t) == sizeof(std::uint64_t))
+            {
+                out.write(reinterpret_cast<const char*>(offsets.data()),
+                          static_cast<std::streamsize>(offsets.size() * sizeof(std::size_t)));
+            }
+            else
+            {
+                for (std::size_t offset : offsets)
+                {
+                    write_value<std::uint64_t>(out, offset);
+                }
+            }
+        }
+
+        /* Reads an image, every read is checked against its end */
+        class image_reader
+        {
+        public:
+
+            explicit image_reader(std::string_view image)
+                : m_image(image)
+            {
+            }
+
+            template <class T>
+            T value()
+            {
+                T res;
+                std::memcpy(&res, take(sizeof(T)).data(), sizeof(T));
+                return res;
+            }
+
+            std::size_t size()
+            {
+                const std::uint64_t res = value<std::uint64_t>();
+                if (res > m_image.size())
+                {
+                    throw corrupted();
+                }
+                return static_cast<std::size_t>(res);
+            }
+
+            std::string_view bytes()
+            {
+                return take(size());
+            }
+
+            /* `count` offsets, increasing from 0 to `end` */
+            void offsets(std::size_t count, std::size_t end, std::pmr::vector<std::size_t>& res)
+            {
+                if (count == 0 || count > m_image.size() / sizeof(std::uint64_t))
+                {
+                    throw corrupted();
+                }
+                const std::string_view data = take(count * sizeof(std::uint64_t));
+                res.resize(count);
+                if constexpr (sizeof(std::size_t) == sizeof(std::uint64_t))
+                {
+                    std::memcpy(res.data(), data.data(), data.size());
+                }
+                else
+                {
+                    for (std::size_t i = 0; i != count; ++i)
+                    {
+                        std::uint64_t offset;
+                        std::memcpy(&offset, data.data() + i * sizeof(offset), sizeof(offset));
+                        res[i] = static_cast<std::size_t>(offset);
+                    }
+                }
+                if (res.front() != 0 || res.back() != end ||
+                    !std::is_sorted(res.begin(), res.end()))
+                {
+                    throw corrupted();
+                }
+            }
+
+            void codes(std::size_t count, std::size_t limit, std::pmr::vector<std::uint32_t>& res)
+            {
+                if (count > m_image.size() / sizeof(std::uint32_t))
+                {
+                    throw corrupted();
+                }
+                const std::string_view data = take(count * sizeof(std::uint32_t));
+                res.resize(count);
+                std::memcpy(res.data(), data.data(), data.size());
+                for (std::uint32_t code : res)
+                {
+                    if (code >= limit)
+                    {
+                        throw corrupted();
+                    }
+                }
+            }
+
+            bool done() const
+            {
+                return m_image.empty();
+            }
+
+            static std::runtime_error corrupted()
+            {
+                return std::runtime_error("corrupted result image");
+            }
+
+        private:
+
+            std::string_view take(std::size_t count)
+            {
+                if (count > m_image.size())
+                {
+                    throw corrupted();
+                }
+                std::string_view res = m_image.substr(0, count);
+                m_image.remove_prefix(count);
+                return res;
+            }
+
+            std::string_view m_image;
+        };
+    }
+
+    string_dictionary::string_dictionary(std::pmr::memory_resource* resource)
+        : m_values(resource)
+        , m_offsets(1, 0, resource)
+        , m_slots(resource)
+    {
+    }
+
+    std::uint32_t string_dictionary::intern(std::string_view value)
+    {
+        // the table is kept at most half full
+        if (2 * (size() + 1) > m_slots.size())
+        {
+            rehash(std::max<std::size_t>(64, 2 * m_slots.size()));
+        }
+        const std::size_t mask = m_slots.size() - 1;
+        std::size_t slot = std::hash<std::string_view>()(value) & mask;
+        while (m_slots[slot] != empty_slot)
+        {
+            if (this->value(m_slots[slot]) == value)
+            {
+                return m_slots[slot];
+            }
+            slot = (slot + 1) & mask;
+        }
+        const std::uint32_t code = static_cast<std::uint32_t>(size());
+        m_values.append(value.data(), value.size());
+        m_offsets.push_back(m_values.size());
+        m_slots[slot] = code;
+        return code;
+    }
+
+    std::string_view string_dictionary::value(std::uint32_t code) const
+    {
+        return std::string_view(m_values.data() + m_offsets[code],
+                                m_offsets[code + 1] - m_offsets[code]);
+    }
+
+    std::size_t string_dictionary::size() const
+    {
+        return m_offsets.size() - 1;
+    }
+
+    std::size_t string_dictionary::bytes() const
+    {
+        return m_values.size();
+    }
+
+    std::size_t string_dictionary::memory() const
+    {
+        return m_values.capacity()
+               + m_offsets.capacity() * sizeof(std::size_t)
+               + m_slots.capacity() * sizeof(std::uint32_t);
+    }
+
+    void string_dictionary::rehash(std::size_t slot_count)
+    {
+        m_slots.assign(slot_count, empty_slot);
+        const std::size_t mask = slot_count - 1;
+        for (std::uint32_t code = 0; code != size(); ++code)
+        {
+            std::size_t slot = std::hash<std::string_view>()(value(code)) & mask;
+            while (m_slots[slot] != empty_slot)
+            {
+                slot = (slot + 1) & mask;
+            }
+            m_slots[slot] = code;
+        }
+    }
+
+    result_set::encoded_column::encoded_column(std::pmr::memory_resource* resource)
+        : dictionary(resource)
+        , codes(resource)
+    {
+    }
+
+    result_set::storage::storage()
+        : buffer(arena.resource())
+        , offsets(1, 0, arena.resource())
+    {
+    }
+
+    result_set::result_set()
+        : m_storage(std::make_unique<storage>())
+    {
+    }
+
+    result_set::result_set(result_set&& other)
+        : result_set()
+    {
+        swap(other);
+    }
+
+    result_set& result_set::operator=(result_set&& other)
+    {
+        swap(other);
+        return *this;
+    }
+
+    void result_set::swap(result_set& other)
+    {
+        std::swap(m_columns, other.m_columns);
+        std::swap(m_layout, other.m_layout);
+        std::swap(m_plain_columns, other.m_plain_columns);
+        std::swap(m_storage, other.m_storage);
+        std::swap(m_rows, other.m_rows);
+        std::swap(m_next_column, other.m_next_column);
+    }
+
+    void result_set::describe(const soci::row& r)
+    {
+        m_columns.clear();
+        m_columns.reserve(r.size());
+        for (std::size_t i = 0; i != r.size(); ++i)
+        {
+            const soci::column_properties& props = r.get_properties(i);
+            m_columns.push_back({props.get_name(),
+                                 props.get_data_type(),
+                                 select_formatter(props.get_data_type())});
+        }
+        reset_layout();
+    }
+
+    void result_set::describe(const std::vector<column_info>& columns)
+    {
+        m_columns = columns;
+        reset_layout();
+    }
+
+    void result_set::reset_layout()
+    {
+        m_layout.assign(m_columns.size(), encoded);
+        m_storage->encoded.clear();
+        m_storage->encoded.reserve(m_columns.size());
+        m_plain_columns = 0;
+        for (std::size_t col = 0; col != m_columns.size(); ++col)
+        {
+            m_storage->encoded.emplace_back(m_storage->arena.resource());
+            if (m_columns[col].type != soci::dt_string)
+            {
+                m_layout[col] = m_plain_columns++;
+            }
+        }
+    }
+
+    void result_set::append(const soci::row& r)
+    {
+        const std::size_t first = m_columns.size() - r.size();
+        for (std::size_t i = 0; i != r.size(); ++i)
+        {
+            const std::size_t col = first + i;
+            const bool plain = m_layout[col] != encoded;
+            cell_buffer& out = plain ? m_storage->buffer : m_scratch;
+            const std::size_t start = plain ? m_storage->buffer.size() : 0;
+            m_scratch.clear();
+            if (r.get_indicator(i) == soci::i_null)
+            {
+                out += null_cell;
+            }
+            else
+            {
+                try
+                {
+                    m_columns[col].format(out, r, i);
+                }
+                catch (...)
+                {
+                    // values that can't be converted to the column type
+                    out.resize(start);
+                    out += null_cell;
+                }
+            }
+            if (plain)
+            {
+                end_cell();
+            }
+            else
+            {
+                append_code(m_scratch);
+            }
+        }
+    }
+
+    void result_set::add_column(const std::string& name, soci::data_type type)
+    {
+        m_columns.push_back({name, type, select_formatter(type)});
+        reset_layout();
+    }
+
+    void result_set::append_cell(std::string_view value)
+    {
+        if (m_layout[m_next_column] == encoded)
+        {
+            append_code(value);
+        }
+        else
+        {
+            m_storage->buffer.append(value.data(), value.size());
+            end_cell();
+        }
+    }
+
+    void result_set::end_cell()
+    {
+        m_storage->offsets.push_back(m_storage->buffer.size());
+        end_row();
+    }
+
+    void result_set::append_code(std::string_view value)
+    {
+        encoded_column& column = m_storage->encoded[m_next_column];
+        column.codes.push_back(column.dictionary.intern(value));
+        end_row();
+    }
+
+    /* Called after each cell, counts the row after its last cell */
+    void result_set::end_row()
+    {
+        if (++m_next_column == m_columns.size())
+        {
+            m_next_column = 0;
+            ++m_rows;
+            check_cardinality();
+        }
+    }
+
+    void result_set::check_cardinality()
+    {
+        for (std::size_t col = 0; col != m_columns.size(); ++col)
+        {
+            if (m_layout[col] != encoded)
+            {
+                continue;
+            }
+            const std::size_t distinct = m_storage->encoded[col].dictionary.size();
+            if (distinct > 1024 && 2 * distinct > m_rows)
+            {
+                decode(col);
+            }
+        }
+    }
+
+    /* Moves the cells of a dictionary-encoded column to the buffer */
+    void result_set::decode(std::size_t col)
+    {
+        std::vector<std::size_t> layout = m_layout;
+        layout[col] = 0;
+        std::size_t plain_columns = 0;
+        for (std::size_t& position : layout)
+        {
+            if (position != encoded)
+            {
+                position = plain_columns++;
+            }
+        }
+
+        std::pmr::memory_resource* resource = m_storage->arena.resource();
+        const encoded_column& column = m_storage->encoded[col];
+        cell_buffer buffer(resource);
+        buffer.reserve(m_storage->buffer.size() + m_rows * column.dictionary.bytes() / column.dictionary.size());
+        std::pmr::vector<std::size_t> offsets(resource);
+        offsets.reserve(m_rows * plain_columns + 1);
+        offsets.push_back(0);
+        for (std::size_t row = 0; row != m_rows; ++row)
+        {
+            for (std::size_t c = 0; c != m_columns.size(); ++c)
+            {
+                if (layout[c] != encoded)
+                {
+                    const std::string_view value = cell(row, c);
+                    buffer.append(value.data(), value.size());
+                    offsets.push_back(buffer.size());
+                }
+            }
+        }
+        m_storage->buffer = std::move(buffer);
+        m_storage->offsets = std::move(offsets);
+        m_layout = std::move(layout);
+        m_plain_columns = plain_columns;
+        m_storage->encoded[col] = encoded_column(resource);
+    }
+
+    void result_set::append_rows(const result_set& other)
+    {
+        if (m_layout != other.m_layout)
+        {
+            // a column is only encoded in one of the results
+            for (std::size_t row = 0; row != other.m_rows; ++row)
+            {
+                for (std::size_t col = 0; col != m_columns.size(); ++col)
+                {
+                    append_cell(other.cell(row, col));
+                }
+            }
+            return;
+        }
+
+        const std::size_t shift = m_storage->buffer.size();
+        m_storage->buffer += other.m_storage->buffer;
+        for (auto it = other.m_storage->offsets.begin() + 1; it != other.m_storage->offsets.end(); ++it)
+        {
+            m_storage->offsets.push_back(*it + shift);
+        }
+        // the codes of the other dictionaries are translated once per value
+        std::vector<std::uint32_t> translation;
+        for (std::size_t col = 0; col != m_columns.size(); ++col)
+        {
+            if (m_layout[col] != encoded)
+            {
+                continue;
+            }
+            const encoded_column& from = other.m_storage->encoded[col];
+            encoded_column& to = m_storage->encoded[col];
+            translation.resize(from.dictionary.size());
+            for (std::uint32_t code = 0; code != translation.size(); ++code)
+            {
+                translation[code] = to.dictionary.intern(from.dictionary.value(code));
+            }
+            for (std::uint32_t code : from.codes)
+            {
+                to.codes.push_back(translation[code]);
+            }
+        }
+        m_rows += other.m_rows;
+        check_cardinality();
+    }
+
+    bool result_set::described() const
+    {
+        return !m_columns.empty();
+    }
+
+    std::size_t result_set::rows() const
+    {
+        return m_rows;
+    }
+
+    std::size_t result_set::columns() const
+    {
+        return m_columns.size();
+    }
+
+    const column_info& result_set::column(std::size_t col) const
+    {
+        return m_columns[col];
+    }
+
+    const std::vector<column_info>& result_set::column_infos() const
+    {
+        return m_columns;
+    }
+
+    std::string_view result_set::cell(std::size_t row, std::size_t col) const
+    {
+        if (m_layout[col] == encoded)
+        {
+            const encoded_column& column = m_storage->encoded[col];
+            return column.dictionary.value(column.codes[row]);
+        }
+        const std::size_t index = row * m_plain_columns + m_layout[col];
+        return std::string_view(m_storage->buffer.data() + m_storage->offsets[index],
+                                m_storage->offsets[index + 1] - m_storage->offsets[index]);
+    }
+
+    const string_dictionary* result_set::dictionary(std::size_t col) const
+    {
+        return m_layout[col] == encoded ? &m_storage->encoded[col].dictionary : nullptr;
+    }
+
+    const std::pmr::vector<std::uint32_t>& result_set::codes(std::size_t col) const
+    {
+        return m_storage->encoded[col].codes;
+    }
+
+    std::size_t result_set::bytes() const
+    {
+        std::size_t res = m_storage->buffer.size();
+        for (std::size_t col = 0; col != m_columns.size(); ++col)
+        {
+            res += m_storage->encoded[col].dictionary.bytes();
+        }
+        return res;
+    }
+
+    std::size_t result_set::memory() const
+    {
+        std::size_t res = m_storage->buffer.capacity()
+                          + m_storage->offsets.capacity() * sizeof(std::size_t)
+                          + m_columns.capacity() * sizeof(column_info)
+                          + m_storage->encoded.capacity() * sizeof(encoded_column);
+        for (const encoded_column& column : m_storage->encoded)
+        {
+            res += column.dictionary.memory() + column.codes.capacity() * sizeof(std::uint32_t);
+        }
+        return res;
+    }
+
+    const result_arena& result_set::arena() const
+    {
+        return m_storage->arena;
+    }
+
+    void result_set::to_data_frame(xv::df_type& df) const
+    {
+        for (std::size_t col = 0; col != m_columns.size(); ++col)
+        {
+            auto& values = df[m_columns[col].name];
+            values.reserve(values.size() + m_rows);
+            if (const string_dictionary* values_of = dictionary(col))
+            {
+                for (std::uint32_t code : codes(col))
+                {
+                    values.emplace_back(values_of->value(code));
+                }
+                continue;
+            }
+            for (std::size_t row = 0; row != m_rows; ++row)
+            {
+                values.emplace_back(cell(row, col));
+            }
+        }
+    }
+
+    void result_set::write(std::ostream& out) const
+    {
+        write_value<std::uint64_t>(out, m_columns.size());
+        write_value<std::uint64_t>(out, m_rows);
+        for (std::size_t col = 0; col != m_columns.size(); ++col)
+        {
+            write_bytes(out, m_columns[col].name);
+            write_value<std::int32_t>(out, static_cast<std::int32_t>(m_columns[col].type));
+            write_value<std::uint8_t>(out, m_layout[col] == encoded ? 1 : 0);
+        }
+        write_bytes(out, m_storage->buffer);
+        write_offsets(out, m_storage->offsets);
+        for (std::size_t col = 0; col != m_columns.size(); ++col)
+        {
+            if (m_layout[col] != encoded)
+            {
+                continue;
+            }
+            const encoded_column& column = m_storage->encoded[col];
+            write_value<std::uint64_t>(out, column.dictionary.size());
+            write_bytes(out, column.dictionary.m_values);
+            write_offsets(out, column.dictionary.m_offsets);
+            out.write(reinterpret_cast<const char*>(column.codes.data()),
+                      static_cast<std::streamsize>(column.codes.size() * sizeof(std::uint32_t)));
+        }
+    }
+
+    result_set result_set::read(std::string_view image)
+    {
+        image_reader in(image);
+        result_set res;
+        const std::size_t column_count = in.size();
+        const std::size_t rows = in.size();
+        std::vector<bool> encoded_columns;
+        for (std::size_t col = 0; col != column_count; ++col)
+        {
+            const std::string_view name = in.bytes();
+            const auto type = static_cast<soci::data_type>(in.value<std::int32_t>());
+            res.m_columns.push_back({std::string(name), type, select_formatter(type)});
+            encoded_columns.push_back(in.value<std::uint8_t>() != 0);
+        }
+        res.reset_layout();
+        res.m_plain_columns = 0;
+        for (std::size_t col = 0; col != column_count; ++col)
+        {
+            res.m_layout[col] = encoded_columns[col] ? encoded : res.m_plain_columns++;
+        }
+        res.m_rows = rows;
+
+        storage& s = *res.m_storage;
+        const std::string_view buffer = in.bytes();
+        s.buffer.assign(buffer.data(), buffer.size());
+        if (res.m_plain_columns != 0 && rows > image.size() / res.m_plain_columns)
+        {
+            throw image_reader::corrupted();
+        }
+        in.offsets(rows * res.m_plain_columns + 1, buffer.size(), s.offsets);
+        for (std::size_t col = 0; col != column_count; ++col)
+        {
+            if (!encoded_columns[col])
+            {
+                continue;
+            }
+            string_dictionary& dictionary = s.encoded[col].dictionary;
+            const std::size_t distinct = in.size();
+            const std::string_view values = in.bytes();
+            dictionary.m_values.assign(values.data(), values.size());
+            in.offsets(distinct + 1, values.size(), dictionary.m_offsets);
+            // the lookup table is not part of the image
+            std::size_t slot_count = 64;
+            while (slot_count < 2 * distinct)
+            {
+                slot_count *= 2;
+            }
+            dictionary.rehash(slot_count);
+            in.codes(rows, distinct, s.encoded[col].codes);
+        }
+        if (!in.done())
+        {
+            throw image_reader::corrupted();
+        }
+        return res;
+    }
+}
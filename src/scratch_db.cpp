@@ -0,0 +1,392 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <iterator>
+#include <stdexcept>
+
+#include "xeus-sql/result_set.hpp"
+#include "xeus-sql/scratch_db.hpp"
+
+namespace xeus_sql
+{
+    namespace
+    {
+        struct sql_token
+        {
+            std::string text;
+            bool identifier;
+        };
+
+        using xv_bindings::to_lower;
+
+        /* Identifiers (plain or quoted) and punctuation, literals and
+           comments are dropped */
+        std::vector<sql_token> tokenize(const std::string& sql)
+        {
+            std::vector<sql_token> res;
+            std::size_t i = 0;
+            const std::size_t n = sql.size();
+            auto is_word = [](char c) {
+                return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '$';
+            };
+            while (i < n)
+            {
+                const char c = sql[i];
+                if (std::isspace(static_cast<unsigned char>(c)))
+                {
+                    ++i;
+                }
+                else if (c == '-' && i + 1 < n && sql[i + 1] == '-')
+                {
+                    i = sql.find('\n', i);
+                    i = i == std::string::npos ? n : i;
+                }
+                else if (c == '/' && i + 1 < n && sql[i + 1] == '*')
+                {
+                    i = sql.find("*/", i + 2);
+                    i = i == std::string::npos ? n : i + 2;
+                }
+                else if (c == '\'')
+                {
+                    // '' is an escaped quote, the loop goes through it
+                    do
+                    {
+                        i = sql.find('\'', i + 1);
+                        i = i == std::string::npos ? n : i + 1;
+                    } while (i < n && sql[i] == '\'');
+                }
+                else if (c == '"' || c == '`' || c == '[')
+                {
+                    const char close = c == '[' ? ']' : c;
+                    std::size_t end = sql.find(close, i + 1);
+                    end = end == std::string::npos ? n : end;
+                    res.push_back({sql.substr(i + 1, end - i - 1), true});
+                    i = end + 1;
+                }
+                else if (is_word(c))
+                {
+                    std::size_t end = i;
+                    while (end < n && is_word(sql[end]))
+                    {
+                        ++end;
+                    }
+                    res.push_back({sql.substr(i, end - i), true});
+                    i = end;
+                }
+                else
+                {
+                    res.push_back({std::string(1, c), false});
+                    ++i;
+                }
+            }
+            return res;
+        }
+
+        bool is_keyword(const sql_token& token)
+        {
+            static const std::set<std::string> keywords = {
+                "select", "from", "where", "join", "inner", "left", "right", "full",
+                "outer", "cross", "natural", "on", "using", "group", "order", "by",
+                "having", "limit", "offset", "union", "intersect", "except", "as",
+                "and", "or", "not", "window", "lateral"
+            };
+            return token.identifier && keywords.count(to_lower(token.text)) != 0;
+        }
+
+        bool is_name(const std::vector<sql_token>& tokens, std::size_t i)
+        {
+            return i < tokens.size() && tokens[i].identifier && !is_keyword(tokens[i]);
+        }
+
+        bool is_punct(const std::vector<sql_token>& tokens, std::size_t i, char c)
+        {
+            return i < tokens.size() && !tokens[i].identifier && tokens[i].text[0] == c;
+        }
+
+        /* Table references following the FROM or JOIN at `i` (comma
+           separated after FROM), with their aliases */
+        void read_table_references(const std::vector<sql_token>& tokens,
+                                   std::size_t i,
+                                   std::map<std::string, std::string>& aliases,
+                                   std::vector<std::string>& tables)
+        {
+            const bool from = to_lower(tokens[i].text) == "from";
+            std::size_t j = i + 1;
+            while (is_name(tokens, j))
+            {
+                std::string table = tokens[j].text;
+                // schema.table
+                if (is_punct(tokens, j + 1, '.') && is_name(tokens, j + 2))
+                {
+                    j += 2;
+                    table = tokens[j].text;
+                }
+                ++j;
+                aliases[to_lower(table)] = table;
+                tables.push_back(table);
+                if (j < tokens.size() && to_lower(tokens[j].text) == "as")
+                {
+                    ++j;
+                }
+                if (is_name(tokens, j))
+                {
+                    aliases[to_lower(tokens[j].text)] = table;
+                    ++j;
+                }
+                if (!from || !is_punct(tokens, j, ','))
+                {
+                    break;
+                }
+                ++j;
+            }
+        }
+
+        const char* sqlite_type(soci::data_type type)
+        {
+            switch (type)
+            {
+                case soci::dt_integer:
+                case soci::dt_long_long:
+                case soci::dt_unsigned_long_long:
+                    return "INTEGER";
+                case soci::dt_double:
+                    return "REAL";
+                default:
+                    return "TEXT";
+            }
+        }
+    }
+
+    std::string quote_sql(const std::string& text, char quote)
+    {
+        std::string res(1, quote);
+        for (char c : text)
+        {
+            res += c;
+            if (c == quote)
+            {
+                res += quote;
+            }
+        }
+        return res + quote;
+    }
+
+    std::vector<std::pair<std::string, std::string>> join_keys(const std::string& sql)
+    {
+        const std::vector<sql_token> tokens = tokenize(sql);
+        std::map<std::string, std::string> aliases;
+        std::vector<std::string> tables;
+        std::vector<std::pair<std::string, std::string>> res;
+        auto add = [&res](const std::string& table, const std::string& column) {
+            auto key = std::make_pair(table, column);
+            if (std::find(res.begin(), res.end(), key) == res.end())
+            {
+                res.push_back(std::move(key));
+            }
+        };
+
+        for (std::size_t i = 0; i < tokens.size(); ++i)
+        {
+            const std::string word = tokens[i].identifier ? to_lower(tokens[i].text) : "";
+            if (word == "from" || word == "join")
+            {
+                read_table_references(tokens, i, aliases, tables);
+            }
+            else if (word == "using" && is_punct(tokens, i + 1, '(') && tables.size() >= 2)
+            {
+                for (std::size_t j = i + 2; j < tokens.size() && !is_punct(tokens, j, ')'); ++j)
+                {
+                    if (is_name(tokens, j))
+                    {
+                        add(tables[tables.size() - 2], tokens[j].text);
+                        add(tables.back(), tokens[j].text);
+                    }
+                }
+            }
+        }
+
+        /* qualifier.column = qualifier.column */
+        auto qualified = [&](std::size_t i, std::string& table) {
+            if (!is_name(tokens, i) || !is_punct(tokens, i + 1, '.') || !is_name(tokens, i + 2))
+            {
+                return false;
+            }
+            auto alias = aliases.find(to_lower(tokens[i].text));
+            if (alias == aliases.end())
+            {
+                return false;
+            }
+            table = alias->second;
+            return true;
+        };
+        for (std::size_t i = 0; i + 6 < tokens.size(); ++i)
+        {
+            std::string lhs, rhs;
+            if (qualified(i, lhs) && is_punct(tokens, i + 3, '=') && qualified(i + 4, rhs) && lhs != rhs)
+            {
+                add(lhs, tokens[i + 2].text);
+                add(rhs, tokens[i + 6].text);
+            }
+        }
+        return res;
+    }
+
+    std::map<std::string, std::string> table_aliases(const std::string& sql)
+    {
+        const std::vector<sql_token> tokens = tokenize(sql);
+        std::map<std::string, std::string> res;
+        std::vector<std::string> tables;
+        for (std::size_t i = 0; i < tokens.size(); ++i)
+        {
+            const std::string word = tokens[i].identifier ? to_lower(tokens[i].text) : "";
+            if (word == "from" || word == "join")
+            {
+                read_table_references(tokens, i, res, tables);
+            }
+        }
+        return res;
+    }
+
+    soci::session& scratch_db::session()
+    {
+        if (!m_session)
+        {
+            m_session = std::make_unique<soci::session>("sqlite3", ":memory:");
+        }
+        return *m_session;
+    }
+
+    const std::map<std::string, std::size_t>& scratch_db::tables() const
+    {
+        return m_tables;
+    }
+
+    materialize_stats scratch_db::materialize(soci::session& source,
+                                              const std::string& query,
+                                              const std::string& table)
+    {
+        using clock = std::chrono::steady_clock;
+        const auto start = clock::now();
+        materialize_stats stats;
+
+        soci::rowset<soci::row> rows = (source.prepare << query);
+        auto it = rows.begin();
+        if (it == rows.end())
+        {
+            throw std::runtime_error("empty result, " + table + " was not created");
+        }
+
+        /* Cells are bound as text, the column affinity of SQLite converts
+           them back to numbers */
+        result_set columns;
+        columns.describe(*it);
+        const std::size_t column_count = columns.columns();
+
+        soci::session& db = session();
+        soci::transaction transaction(db);
+        db << "DROP TABLE IF EXISTS " + quote_sql(table);
+        std::string create = "CREATE TABLE " + quote_sql(table) + " (";
+        std::string insert = "INSERT INTO " + quote_sql(table) + " VALUES (";
+        for (std::size_t col = 0; col != column_count; ++col)
+        {
+            const column_info& info = columns.column(col);
+            create += (col ? ", " : "") + quote_sql(info.name) + " " + sqlite_type(info.type);
+            insert += (col ? ", :c" : ":c") + std::to_string(col);
+        }
+        db << create + ")";
+
+        std::vector<std::vector<std::string>> values(column_count, std::vector<std::string>(batch_rows));
+        std::vector<std::vector<soci::indicator>> indicators(column_count,
+                                                             std::vector<soci::indicator>(batch_rows));
+        soci::statement statement(db);
+        for (std::size_t col = 0; col != column_count; ++col)
+        {
+            statement.exchange(soci::use(values[col], indicators[col]));
+        }
+        statement.alloc();
+        statement.prepare(insert + ")");
+        statement.define_and_bind();
+
+        std::size_t batch = 0;
+        cell_buffer formatted;
+        auto flush = [&]() {
+            for (std::size_t col = 0; col != column_count; ++col)
+            {
+                values[col].resize(batch);
+                indicators[col].resize(batch);
+            }
+            statement.execute(true);
+            stats.rows += batch;
+            batch = 0;
+        };
+
+        for (; it != rows.end(); ++it)
+        {
+            const soci::row& r = *it;
+            for (std::size_t col = 0; col != column_count; ++col)
+            {
+                std::string& value = values[col][batch];
+                value.clear();
+                soci::indicator& indicator = indicators[col][batch];
+                indicator = r.get_indicator(col) == soci::i_null ? soci::i_null : soci::i_ok;
+                if (indicator == soci::i_ok)
+                {
+                    try
+                    {
+                        formatted.clear();
+                        columns.column(col).format(formatted, r, col);
+                        value.assign(formatted.data(), formatted.size());
+                    }
+                    catch (...)
+                    {
+                        indicator = soci::i_null;
+                    }
+                }
+            }
+            if (++batch == batch_rows)
+            {
+                flush();
+            }
+        }
+        if (batch != 0)
+        {
+            flush();
+        }
+        transaction.commit();
+
+        m_tables[table] = stats.rows;
+        // indexes were dropped with the table
+        for (auto index = m_indexes.begin(); index != m_indexes.end();)
+        {
+            index = index->first == table ? m_indexes.erase(index) : std::next(index);
+        }
+        stats.seconds = std::chrono::duration<double>(clock::now() - start).count();
+        return stats;
+    }
+
+    void scratch_db::index_join_keys(const std::string& sql)
+    {
+        for (const auto& key : join_keys(sql))
+        {
+            // table names are case insensitive in SQLite
+            auto table = std::find_if(m_tables.begin(), m_tables.end(), [&key](const auto& t) {
+                return to_lower(t.first) == to_lower(key.first);
+            });
+            if (table == m_tables.end() || !m_indexes.insert({table->first, key.second}).second)
+            {
+                continue;
+            }
+            session() << "CREATE INDEX IF NOT EXISTS " + quote_sql("xsql_" + table->first + "_" + key.second)
+                         + " ON " + quote_sql(table->first) + " (" + quote_sql(key.second) + ")";
+        }
+    }
+}
@@ -0,0 +1,164 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+
+#include "nlohmann/json.hpp"
+
+#include "xeus-sql/query_metrics.hpp"
+#include "xeus-sql/slow_query_log.hpp"
+
+namespace nl = nlohmann;
+
+namespace xeus_sql
+{
+    namespace
+    {
+        std::string iso_timestamp(std::chrono::system_clock::time_point tp)
+        {
+            std::time_t t = std::chrono::system_clock::to_time_t(tp);
+            std::tm when;
+#ifdef _WIN32
+            gmtime_s(&when, &t);
+#else
+            gmtime_r(&t, &when);
+#endif
+            char buffer[32];
+            std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%SZ", &when);
+            return buffer;
+        }
+    }
+
+    /* The log is configured from XSQL_SLOW_QUERY_LOG (the path of the file,
+       xsql_slow_queries.jsonl by default) and XSQL_SLOW_QUERY_MS (the
+       threshold in milliseconds, disabled when unset). */
+    slow_query_log::slow_query_log()
+        : m_path("xsql_slow_queries.jsonl")
+        , m_threshold(-1)
+    {
+        if (const char* path = std::getenv("XSQL_SLOW_QUERY_LOG"))
+        {
+            m_path = path;
+        }
+        if (const char* threshold = std::getenv("XSQL_SLOW_QUERY_MS"))
+        {
+            m_threshold = std::chrono::milliseconds(std::atoll(threshold));
+        }
+        m_writer = std::thread([this]() { run(); });
+    }
+
+    slow_query_log::~slow_query_log()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+        m_writer.join();
+    }
+
+    void slow_query_log::configure(const std::string& path, std::chrono::milliseconds threshold)
+    {
+        flush();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_path = path;
+        m_threshold = threshold;
+    }
+
+    bool slow_query_log::enabled() const
+    {
+        return m_threshold.count() >= 0;
+    }
+
+    const std::string& slow_query_log::path() const
+    {
+        return m_path;
+    }
+
+    std::chrono::milliseconds slow_query_log::threshold() const
+    {
+        return m_threshold;
+    }
+
+    void slow_query_log::record(const std::string& connection,
+                                const std::string& sql,
+                                const query_profile& profile,
+                                std::size_t bytes)
+    {
+        if (!enabled() || profile.total() * 1000. < static_cast<double>(m_threshold.count()))
+        {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_pending.size() >= max_pending)
+            {
+                return;
+            }
+            m_pending.push_back({std::chrono::system_clock::now(), connection, sql, profile, bytes});
+        }
+        m_cv.notify_one();
+    }
+
+    void slow_query_log::flush()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_flushed_cv.wait(lock, [this]() { return m_pending.empty() && !m_writing; });
+    }
+
+    void slow_query_log::run()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            m_cv.wait(lock, [this]() { return m_stop || !m_pending.empty(); });
+            if (m_pending.empty())
+            {
+                return;
+            }
+            std::deque<slow_query_record> batch;
+            batch.swap(m_pending);
+            std::string path = m_path;
+            m_writing = true;
+            lock.unlock();
+            std::ofstream out(path, std::ios::app);
+            for (const auto& record : batch)
+            {
+                write(out, record);
+            }
+            out.close();
+            lock.lock();
+            m_writing = false;
+            m_flushed_cv.notify_all();
+        }
+    }
+
+    void slow_query_log::write(std::ostream& out, const slow_query_record& record)
+    {
+        const query_profile& p = record.profile;
+        nl::json entry = {
+            {"timestamp", iso_timestamp(record.timestamp)},
+            {"connection", record.connection},
+            {"fingerprint", fingerprint(record.sql)},
+            {"sql", record.sql},
+            {"duration", p.total()},
+            {"execute", p.get(query_phase::execute)},
+            {"fetch", p.get(query_phase::fetch) + p.get(query_phase::format)},
+            {"render", p.get(query_phase::render_text) + p.get(query_phase::render_html)},
+            {"rows", p.rows},
+            {"bytes", record.bytes}
+        };
+        if (out.good())
+        {
+            out << entry.dump(-1, ' ', false, nl::json::error_handler_t::replace) << "\n";
+        }
+    }
+}
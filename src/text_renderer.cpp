@@ -0,0 +1,233 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <algorithm>
+#include <vector>
+
+#include "xeus-sql/text_renderer.hpp"
+
+namespace xeus_sql
+{
+    namespace
+    {
+        const std::string_view ellipsis = "\xE2\x80\xA6";
+        const std::string_view elided_cell = "...";
+
+        inline bool is_continuation_byte(char c)
+        {
+            return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
+        }
+
+        /* The longest prefix of value holding at most `chars` characters */
+        std::string_view utf8_prefix(std::string_view value, std::size_t chars)
+        {
+            std::size_t count = 0;
+            for (std::size_t i = 0; i != value.size(); ++i)
+            {
+                if (!is_continuation_byte(value[i]) && count++ == chars)
+                {
+                    return value.substr(0, i);
+                }
+            }
+            return value;
+        }
+
+        /* Display of a cell once truncated to the maximum width */
+        struct clipped_cell
+        {
+            std::string_view text;
+            std::size_t width;
+            bool truncated;
+        };
+
+        clipped_cell clip(std::string_view value, std::size_t max_width)
+        {
+            std::size_t width = display_width(value);
+            if (max_width == 0 || width <= max_width)
+            {
+                return {value, width, false};
+            }
+            return {utf8_prefix(value, max_width - 1), max_width, true};
+        }
+
+        void write_text(std::string& out, std::string_view text)
+        {
+            // line breaks and tabs would break the layout of the table
+            if (text.find_first_of("\n\r\t") == std::string_view::npos)
+            {
+                out.append(text.data(), text.size());
+                return;
+            }
+            for (char c : text)
+            {
+                out += (c == '\n' || c == '\r' || c == '\t') ? ' ' : c;
+            }
+        }
+
+        void write_cell(std::string& out,
+                        const clipped_cell& cell,
+                        std::size_t width,
+                        bool right_align)
+        {
+            const std::size_t padding = width - cell.width;
+            out += ' ';
+            if (right_align)
+            {
+                out.append(padding, ' ');
+            }
+            write_text(out, cell.text);
+            if (cell.truncated)
+            {
+                out.append(ellipsis.data(), ellipsis.size());
+            }
+            if (!right_align)
+            {
+                out.append(padding, ' ');
+            }
+            out += " |";
+        }
+
+        void write_border(std::string& out, const std::vector<std::size_t>& widths)
+        {
+            out += '+';
+            for (std::size_t w : widths)
+            {
+                out.append(w + 2, '-');
+                out += '+';
+            }
+            out += '\n';
+        }
+    }
+
+    std::size_t display_width(std::string_view value)
+    {
+        std::size_t res = 0;
+        for (char c : value)
+        {
+            res += is_continuation_byte(c) ? 0 : 1;
+        }
+        return res;
+    }
+
+    std::string render_text_table(const result_set& result, const text_table_options& options)
+    {
+        const std::size_t columns = result.columns();
+        const std::size_t rows = result.rows();
+        if (columns == 0)
+        {
+            return "";
+        }
+
+        const bool elide = options.max_rows != 0 && rows > options.max_rows;
+        const std::size_t head = elide ? options.max_rows / 2 : rows;
+        const std::size_t tail_start = elide ? rows - (options.max_rows - head) : rows;
+        const std::size_t shown = head + (rows - tail_start);
+
+        auto for_each_shown_row = [&](auto&& f) {
+            for (std::size_t row = 0; row != head; ++row)
+            {
+                f(row);
+            }
+            for (std::size_t row = tail_start; row != rows; ++row)
+            {
+                f(row);
+            }
+        };
+
+        /* Dictionary-encoded columns with fewer distinct values than
+           displayed rows are clipped once per value */
+        std::vector<std::vector<clipped_cell>> clipped_values(columns);
+        for (std::size_t col = 0; col != columns; ++col)
+        {
+            const string_dictionary* dictionary = result.dictionary(col);
+            if (dictionary != nullptr && dictionary->size() < shown)
+            {
+                clipped_values[col].reserve(dictionary->size());
+                for (std::uint32_t code = 0; code != dictionary->size(); ++code)
+                {
+                    clipped_values[col].push_back(clip(dictionary->value(code), options.max_cell_width));
+                }
+            }
+        }
+        auto clipped = [&](std::size_t row, std::size_t col) {
+            return clipped_values[col].empty() ? clip(result.cell(row, col), options.max_cell_width)
+                                               : clipped_values[col][result.codes(col)[row]];
+        };
+
+        /* Single pass over the displayed cells to compute the widths, and
+           the bytes taken by multi-byte characters */
+        std::vector<std::size_t> widths(columns);
+        std::vector<bool> right_align(columns);
+        std::size_t extra_bytes = 0;
+        for (std::size_t col = 0; col != columns; ++col)
+        {
+            clipped_cell name = clip(result.column(col).name, options.max_cell_width);
+            widths[col] = std::max(name.width, elide ? elided_cell.size() : std::size_t(0));
+            extra_bytes += name.text.size() + (name.truncated ? ellipsis.size() : 0) - name.width;
+            right_align[col] = is_numeric(result.column(col).type);
+        }
+        for_each_shown_row([&](std::size_t row) {
+            for (std::size_t col = 0; col != columns; ++col)
+            {
+                const clipped_cell cell = clipped(row, col);
+                widths[col] = std::max(widths[col], cell.width);
+                extra_bytes += cell.text.size() + (cell.truncated ? ellipsis.size() : 0) - cell.width;
+            }
+        });
+
+        std::size_t line_size = 2;
+        for (std::size_t w : widths)
+        {
+            line_size += w + 3;
+        }
+        const std::size_t lines = 4 + shown + (elide ? 1 : 0);
+
+        std::string out;
+        out.reserve(lines * line_size + extra_bytes);
+
+        write_border(out, widths);
+        out += '|';
+        for (std::size_t col = 0; col != columns; ++col)
+        {
+            write_cell(out, clip(result.column(col).name, options.max_cell_width), widths[col], false);
+        }
+        out += '\n';
+        write_border(out, widths);
+
+        auto write_row = [&](std::size_t row) {
+            out += '|';
+            for (std::size_t col = 0; col != columns; ++col)
+            {
+                write_cell(out, clipped(row, col), widths[col], right_align[col]);
+            }
+            out += '\n';
+        };
+
+        for (std::size_t row = 0; row != head; ++row)
+        {
+            write_row(row);
+        }
+        if (elide)
+        {
+            out += '|';
+            for (std::size_t col = 0; col != columns; ++col)
+            {
+                write_cell(out, {elided_cell, elided_cell.size(), false}, widths[col], right_align[col]);
+            }
+            out += '\n';
+        }
+        for (std::size_t row = tail_start; row != rows; ++row)
+        {
+            write_row(row);
+        }
+        write_border(out, widths);
+
+        return out;
+    }
+}
@@ -0,0 +1,349 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <array>
+#include <cctype>
+#include <cstdio>
+#include <stdexcept>
+#include <utility>
+
+#include "xeus-sql/transaction_state.hpp"
+
+namespace xeus_sql
+{
+    bool is_dml_statement(const std::string& code)
+    {
+        static const std::array<const char*, 6> keywords = {"INSERT", "UPDATE", "DELETE",
+                                                            "REPLACE", "MERGE", "UPSERT"};
+        std::size_t begin = 0;
+        while (begin != code.size() && std::isspace(static_cast<unsigned char>(code[begin])))
+        {
+            ++begin;
+        }
+        std::size_t end = begin;
+        while (end != code.size() && std::isalpha(static_cast<unsigned char>(code[end])))
+        {
+            ++end;
+        }
+        std::string word = code.substr(begin, end - begin);
+        for (char& c : word)
+        {
+            c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+        }
+        for (const char* keyword : keywords)
+        {
+            if (word == keyword)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool batch_options::enabled() const
+    {
+        return statements != 0 || interval.count() != 0;
+    }
+
+    transaction_state::~transaction_state()
+    {
+        stop_timer();
+        /* A batch only groups statements which would have been committed
+           one by one, a transaction begun by %BEGIN is rolled back */
+        try
+        {
+            if (m_batched)
+            {
+                commit();
+            }
+            else
+            {
+                rollback();
+            }
+        }
+        catch (...)
+        {
+        }
+    }
+
+    std::mutex& transaction_state::mutex()
+    {
+        return m_mutex;
+    }
+
+    void transaction_state::begin(std::shared_ptr<soci::session> session)
+    {
+        if (m_open && !m_batched)
+        {
+            throw std::runtime_error("A transaction is already open, %COMMIT or %ROLLBACK it first.");
+        }
+        commit();
+        start(std::move(session), nullptr, false);
+    }
+
+    void transaction_state::begin(std::shared_ptr<duckdb_session> session)
+    {
+        if (m_open && !m_batched)
+        {
+            throw std::runtime_error("A transaction is already open, %COMMIT or %ROLLBACK it first.");
+        }
+        commit();
+        start(nullptr, std::move(session), false);
+    }
+
+    std::size_t transaction_state::commit()
+    {
+        if (!m_open)
+        {
+            return 0;
+        }
+        const std::size_t res = m_statements;
+        try
+        {
+            if (m_duckdb)
+            {
+                m_duckdb->execute("COMMIT");
+            }
+            else
+            {
+                m_transaction->commit();
+            }
+        }
+        catch (...)
+        {
+            // the database rolls back a transaction it can't commit
+            reset();
+            throw;
+        }
+        reset();
+        return res;
+    }
+
+    std::size_t transaction_state::rollback()
+    {
+        if (!m_open)
+        {
+            return 0;
+        }
+        const std::size_t res = m_statements;
+        try
+        {
+            if (m_duckdb)
+            {
+                m_duckdb->execute("ROLLBACK");
+            }
+            else
+            {
+                m_transaction->rollback();
+            }
+        }
+        catch (...)
+        {
+            reset();
+            throw;
+        }
+        reset();
+        return res;
+    }
+
+    bool transaction_state::open() const
+    {
+        return m_open;
+    }
+
+    bool transaction_state::batched() const
+    {
+        return m_open && m_batched;
+    }
+
+    std::size_t transaction_state::statements() const
+    {
+        return m_statements;
+    }
+
+    void transaction_state::set_batch(const batch_options& options)
+    {
+        m_batch = options;
+        if (!m_batch.enabled() && batched())
+        {
+            commit();
+        }
+        if (m_batch.interval.count() != 0 && !m_timer.joinable())
+        {
+            m_timer = std::thread([this]() { run_timer(); });
+        }
+        // a shorter interval brings the deadline of the open batch forward
+        m_timer_cv.notify_all();
+    }
+
+    const batch_options& transaction_state::batch() const
+    {
+        return m_batch;
+    }
+
+    void transaction_state::before_statement(const std::shared_ptr<soci::session>& session,
+                                             const std::shared_ptr<duckdb_session>& duckdb,
+                                             bool dml)
+    {
+        if (m_open && !m_batched)
+        {
+            return;
+        }
+        if (batched() && (!dml || !owns(session, duckdb)))
+        {
+            commit();
+        }
+        if (!m_open && dml && m_batch.enabled())
+        {
+            start(session, duckdb, true);
+        }
+    }
+
+    bool transaction_state::after_statement()
+    {
+        if (!m_open)
+        {
+            return false;
+        }
+        ++m_statements;
+        if (m_batched && m_batch.statements != 0 && m_statements >= m_batch.statements)
+        {
+            commit();
+            return true;
+        }
+        return false;
+    }
+
+    bool transaction_state::commit_expired_batch()
+    {
+        if (batched() && m_batch.interval.count() != 0 && clock::now() - m_start >= m_batch.interval)
+        {
+            commit();
+            return true;
+        }
+        return false;
+    }
+
+    std::string transaction_state::timer_error()
+    {
+        return std::exchange(m_timer_error, std::string());
+    }
+
+    void transaction_state::run_timer()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_stop_timer)
+        {
+            if (batched() && m_batch.interval.count() != 0)
+            {
+                // the lock is only taken back once the running cell is done
+                m_timer_cv.wait_until(lock, m_start + m_batch.interval);
+                try
+                {
+                    commit_expired_batch();
+                }
+                catch (const std::exception& e)
+                {
+                    m_timer_error = e.what();
+                }
+            }
+            else
+            {
+                m_timer_cv.wait(lock);
+            }
+        }
+    }
+
+    void transaction_state::stop_timer()
+    {
+        if (!m_timer.joinable())
+        {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop_timer = true;
+        }
+        m_timer_cv.notify_all();
+        m_timer.join();
+    }
+
+    std::string transaction_state::footer() const
+    {
+        if (!m_open)
+        {
+            return "";
+        }
+        const std::chrono::duration<double> age = clock::now() - m_start;
+        char seconds[32];
+        std::snprintf(seconds, sizeof(seconds), "%.1f s", age.count());
+        std::string res = (m_batched ? "batch open: " : "transaction open: ")
+                          + std::to_string(m_statements)
+                          + (m_statements == 1 ? " statement, " : " statements, ") + seconds;
+        if (m_batched)
+        {
+            res += " (commits at ";
+            if (m_batch.statements != 0)
+            {
+                res += std::to_string(m_batch.statements) + " statements";
+            }
+            if (m_batch.interval.count() != 0)
+            {
+                res += (m_batch.statements != 0 ? " or " : "")
+                       + std::to_string(m_batch.interval.count()) + " s";
+            }
+            res += ")";
+        }
+        return res;
+    }
+
+    bool transaction_state::owns(const std::shared_ptr<soci::session>& session,
+                                 const std::shared_ptr<duckdb_session>& duckdb) const
+    {
+        return m_duckdb ? m_duckdb == duckdb : (m_session == session && !duckdb);
+    }
+
+    void transaction_state::start(std::shared_ptr<soci::session> session,
+                                  std::shared_ptr<duckdb_session> duckdb,
+                                  bool batched)
+    {
+        if (duckdb)
+        {
+            duckdb->execute("BEGIN TRANSACTION");
+        }
+        else if (session)
+        {
+            m_transaction = std::make_unique<soci::transaction>(*session);
+        }
+        else
+        {
+            throw std::runtime_error("Database was not loaded.");
+        }
+        m_session = std::move(session);
+        m_duckdb = std::move(duckdb);
+        m_open = true;
+        m_batched = batched;
+        m_statements = 0;
+        m_start = clock::now();
+        if (batched)
+        {
+            m_timer_cv.notify_all();
+        }
+    }
+
+    void transaction_state::reset()
+    {
+        m_transaction.reset();
+        m_session.reset();
+        m_duckdb.reset();
+        m_open = false;
+        m_batched = false;
+        m_statements = 0;
+    }
+}
@@ -0,0 +1,616 @@
+/***************************************************************************
+* Copyright (c) 2020, QuantStack and xeus-sql contributors                *
+*                                                                          *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+
+#include "xeus-sql/transform.hpp"
+
+namespace xeus_sql
+{
+    namespace
+    {
+        const double null_number = std::numeric_limits<double>::quiet_NaN();
+        const std::uint32_t unassigned = static_cast<std::uint32_t>(-1);
+
+        /* A column loaded once from the cells of a result: numbers are
+           parsed, NULL being NaN, text cells are views on the result. The
+           codes of dictionary-encoded columns are kept along their texts. */
+        struct typed_column
+        {
+            std::string name;
+            bool numeric = false;
+            std::vector<double> numbers;
+            std::vector<std::string_view> texts;
+            const string_dictionary* dictionary = nullptr;
+            std::vector<std::uint32_t> codes;
+        };
+
+        struct frame
+        {
+            std::vector<typed_column> columns;
+            std::size_t rows = 0;
+
+            std::size_t find(const std::string& name) const
+            {
+                for (std::size_t col = 0; col != columns.size(); ++col)
+                {
+                    if (columns[col].name == name)
+                    {
+                        return col;
+                    }
+                }
+                throw std::runtime_error("unknown column: " + name);
+            }
+
+            typed_column& numeric_column(const std::string& name, const char* step)
+            {
+                typed_column& res = columns[find(name)];
+                if (!res.numeric)
+                {
+                    throw std::runtime_error(std::string(step) + " needs a numeric column: " + name);
+                }
+                return res;
+            }
+        };
+
+        frame load(const result_set& result)
+        {
+            frame res;
+            res.rows = result.rows();
+            res.columns.resize(result.columns());
+            for (std::size_t col = 0; col != result.columns(); ++col)
+            {
+                typed_column& column = res.columns[col];
+                column.name = result.column(col).name;
+                column.numeric = is_numeric(result.column(col).type);
+                if (column.numeric)
+                {
+                    column.numbers.resize(res.rows);
+                    for (std::size_t row = 0; row != res.rows; ++row)
+                    {
+                        column.numbers[row] = parse_number(result.cell(row, col));
+                    }
+                }
+                else if ((column.dictionary = result.dictionary(col)) != nullptr)
+                {
+                    column.codes.assign(result.codes(col).begin(), result.codes(col).end());
+                    column.texts.resize(res.rows);
+                    for (std::size_t row = 0; row != res.rows; ++row)
+                    {
+                        column.texts[row] = column.dictionary->value(column.codes[row]);
+                    }
+                }
+                else
+                {
+                    column.texts.resize(res.rows);
+                    for (std::size_t row = 0; row != res.rows; ++row)
+                    {
+                        column.texts[row] = result.cell(row, col);
+                    }
+                }
+            }
+            return res;
+        }
+
+        /* Keeps the rows at `indices`, in that order */
+        frame gather(const frame& input, const std::vector<std::size_t>& indices)
+        {
+            frame res;
+            res.rows = indices.size();
+            res.columns.resize(input.columns.size());
+            for (std::size_t col = 0; col != input.columns.size(); ++col)
+            {
+                const typed_column& from = input.columns[col];
+                typed_column& to = res.columns[col];
+                to.name = from.name;
+                to.numeric = from.numeric;
+                if (from.numeric)
+                {
+                    to.numbers.resize(indices.size());
+                    for (std::size_t i = 0; i != indices.size(); ++i)
+                    {
+                        to.numbers[i] = from.numbers[indices[i]];
+                    }
+                }
+                else
+                {
+                    to.texts.resize(indices.size());
+                    for (std::size_t i = 0; i != indices.size(); ++i)
+                    {
+                        to.texts[i] = from.texts[indices[i]];
+                    }
+                }
+                to.dictionary = from.dictionary;
+                if (from.dictionary != nullptr)
+                {
+                    to.codes.resize(indices.size());
+                    for (std::size_t i = 0; i != indices.size(); ++i)
+                    {
+                        to.codes[i] = from.codes[indices[i]];
+                    }
+                }
+            }
+            return res;
+        }
+
+        template <class T, class C>
+        void select(const std::vector<T>& values, const T& value, C compare, std::vector<std::uint8_t>& keep)
+        {
+            for (std::size_t i = 0; i != values.size(); ++i)
+            {
+                keep[i] = compare(values[i], value);
+            }
+        }
+
+        template <class T>
+        void select(const std::vector<T>& values, const T& value, const std::string& op, std::vector<std::uint8_t>& keep)
+        {
+            if (op == "=") select(values, value, std::equal_to<T>(), keep);
+            else if (op == "!=") select(values, value, std::not_equal_to<T>(), keep);
+            else if (op == "<") select(values, value, std::less<T>(), keep);
+            else if (op == "<=") select(values, value, std::less_equal<T>(), keep);
+            else if (op == ">") select(values, value, std::greater<T>(), keep);
+            else if (op == ">=") select(values, value, std::greater_equal<T>(), keep);
+            else throw std::runtime_error("invalid filter operator: " + op);
+        }
+
+        frame filter(const frame& input, const transform_step& step)
+        {
+            const typed_column& column = input.columns[input.find(step.column)];
+            // one byte per row, so that the comparison loop has no branch
+            std::vector<std::uint8_t> keep(input.rows);
+            const double number = parse_number(step.value);
+            if (column.numeric && !std::isnan(number))
+            {
+                // NaN compares unequal to everything: NULL only matches !=
+                select(column.numbers, number, step.op, keep);
+            }
+            else if (column.dictionary != nullptr)
+            {
+                // each distinct value is compared once
+                std::vector<std::string_view> values(column.dictionary->size());
+                for (std::uint32_t code = 0; code != values.size(); ++code)
+                {
+                    values[code] = column.dictionary->value(code);
+                }
+                std::vector<std::uint8_t> matches(values.size());
+                select(values, std::string_view(step.value), step.op, matches);
+                for (std::size_t row = 0; row != input.rows; ++row)
+                {
+                    keep[row] = matches[column.codes[row]];
+                }
+            }
+            else if (!column.numeric)
+            {
+                select(column.texts, std::string_view(step.value), step.op, keep);
+            }
+            else
+            {
+                throw std::runtime_error("invalid number: " + step.value);
+            }
+
+            std::vector<std::size_t> indices;
+            indices.reserve(input.rows);
+            for (std::size_t row = 0; row != input.rows; ++row)
+            {
+                if (keep[row])
+                {
+                    indices.push_back(row);
+                }
+            }
+            return gather(input, indices);
+        }
+
+        /* Replaces the values by the start of their equal width bin */
+        void bin(frame& input, const transform_step& step)
+        {
+            std::vector<double>& values = input.numeric_column(step.column, "BIN").numbers;
+            double lo = std::numeric_limits<double>::infinity();
+            double hi = -lo;
+            for (double v : values)
+            {
+                // comparisons with NaN are false, NULLs are skipped
+                lo = v < lo ? v : lo;
+                hi = v > hi ? v : hi;
+            }
+            if (!(lo < hi) || step.count == 0)
+            {
+                return;
+            }
+            const double width = (hi - lo) / static_cast<double>(step.count);
+            const double last = static_cast<double>(step.count - 1);
+            for (double& v : values)
+            {
+                v = lo + std::min(std::floor((v - lo) / width), last) * width;
+            }
+        }
+
+        /* Dense codes of the distinct values of a column, in the order of
+           their first appearance */
+        std::vector<std::uint32_t> encode(const typed_column& column, std::size_t rows, std::vector<std::size_t>& first)
+        {
+            std::vector<std::uint32_t> codes(rows);
+            first.clear();
+            auto assign = [&](auto& map, const auto& key, std::size_t row) {
+                auto it = map.emplace(key, static_cast<std::uint32_t>(first.size())).first;
+                if (it->second == first.size())
+                {
+                    first.push_back(row);
+                }
+                codes[row] = it->second;
+            };
+            if (column.dictionary != nullptr)
+            {
+                // the codes of the result are already dense, they are only
+                // renumbered in the order of first appearance
+                std::vector<std::uint32_t> renumbered(column.dictionary->size(), unassigned);
+                for (std::size_t row = 0; row != rows; ++row)
+                {
+                    std::uint32_t& code = renumbered[column.codes[row]];
+                    if (code == unassigned)
+                    {
+                        code = static_cast<std::uint32_t>(first.size());
+                        first.push_back(row);
+                    }
+                    codes[row] = code;
+                }
+            }
+            else if (column.numeric)
+            {
+                std::unordered_map<std::uint64_t, std::uint32_t> map;
+                for (std::size_t row = 0; row != rows; ++row)
+                {
+                    double v = column.numbers[row];
+                    // a single group for NULLs, and for 0 and -0
+                    v = std::isnan(v) ? null_number : (v == 0. ? 0. : v);
+                    std::uint64_t bits;
+                    std::memcpy(&bits, &v, sizeof(bits));
+                    assign(map, bits, row);
+                }
+            }
+            else
+            {
+                std::unordered_map<std::string_view, std::uint32_t> map;
+                for (std::size_t row = 0; row != rows; ++row)
+                {
+                    assign(map, column.texts[row], row);
+                }
+            }
+            return codes;
+        }
+
+        frame group(const frame& input, const transform_step& step)
+        {
+            /* Group of each row: the codes of the keys are combined one key
+               at a time */
+            std::vector<std::size_t> first(input.rows > 0 ? 1 : 0, 0);
+            std::vector<std::uint32_t> groups(input.rows, 0);
+            for (const std::string& key : step.keys)
+            {
+                std::vector<std::size_t> key_first;
+                std::vector<std::uint32_t> codes = encode(input.columns[input.find(key)], input.rows, key_first);
+                std::unordered_map<std::uint64_t, std::uint32_t> combined;
+                first.clear();
+                for (std::size_t row = 0; row != input.rows; ++row)
+                {
+                    const std::uint64_t pair = (static_cast<std::uint64_t>(groups[row]) << 32) | codes[row];
+                    auto it = combined.emplace(pair, static_cast<std::uint32_t>(first.size())).first;
+                    if (it->second == first.size())
+                    {
+                        first.push_back(row);
+                    }
+                    groups[row] = it->second;
+                }
+            }
+            const std::size_t group_count = first.size();
+
+            frame res;
+            res.rows = group_count;
+            frame keys = gather(input, first);
+            for (const std::string& key : step.keys)
+            {
+                res.columns.push_back(keys.columns[input.find(key)]);
+            }
+
+            for (const aggregate& agg : step.aggregates)
+            {
+                typed_column out;
+                out.name = agg.name;
+                out.numeric = true;
+                std::vector<double> counts(group_count, 0.);
+                if (agg.column.empty())
+                {
+                    for (std::size_t row = 0; row != input.rows; ++row)
+                    {
+                        counts[groups[row]] += 1.;
+                    }
+                    out.numbers = std::move(counts);
+                    res.columns.push_back(std::move(out));
+                    continue;
+                }
+
+                const typed_column& column = input.columns[input.find(agg.column)];
+                if (agg.op == aggregate_op::count)
+                {
+                    for (std::size_t row = 0; row != input.rows; ++row)
+                    {
+                        const bool null = column.numeric ? std::isnan(column.numbers[row]) : column.texts[row] == "NULL";
+                        counts[groups[row]] += null ? 0. : 1.;
+                    }
+                    out.numbers = std::move(counts);
+                    res.columns.push_back(std::move(out));
+                    continue;
+                }
+                if (!column.numeric)
+                {
+                    throw std::runtime_error("aggregate needs a numeric column: " + agg.column);
+                }
+
+                const double initial = agg.op == aggregate_op::min ? std::numeric_limits<double>::infinity()
+                                     : agg.op == aggregate_op::max ? -std::numeric_limits<double>::infinity()
+                                     : 0.;
+                std::vector<double> acc(group_count, initial);
+                const std::vector<double>& values = column.numbers;
+                for (std::size_t row = 0; row != input.rows; ++row)
+                {
+                    const double v = values[row];
+                    if (std::isnan(v))
+                    {
+                        continue;
+                    }
+                    double& a = acc[groups[row]];
+                    switch (agg.op)
+                    {
+                        case aggregate_op::min: a = v < a ? v : a; break;
+                        case aggregate_op::max: a = v > a ? v : a; break;
+                        default: a += v; break;
+                    }
+                    counts[groups[row]] += 1.;
+                }
+                for (std::size_t g = 0; g != group_count; ++g)
+                {
+                    // groups with only NULLs
+                    if (counts[g] == 0.)
+                    {
+                        acc[g] = agg.op == aggregate_op::sum ? 0. : null_number;
+                    }
+                    else if (agg.op == aggregate_op::mean)
+                    {
+                        acc[g] /= counts[g];
+                    }
+                }
+                out.numbers = std::move(acc);
+                res.columns.push_back(std::move(out));
+            }
+            return res;
+        }
+
+        frame top(const frame& input, const transform_step& step)
+        {
+            const typed_column& column = input.columns[input.find(step.column)];
+            std::vector<std::size_t> indices(input.rows);
+            std::iota(indices.begin(), indices.end(), std::size_t(0));
+            const std::size_t count = std::min(step.count, input.rows);
+            const bool ascending = step.ascending;
+            auto by_number = [&](std::size_t lhs, std::size_t rhs) {
+                const double a = column.numbers[lhs];
+                const double b = column.numbers[rhs];
+                // NULLs go last whatever the order
+                if (std::isnan(a) || std::isnan(b))
+                {
+                    return !std::isnan(a) && std::isnan(b);
+                }
+                return ascending ? a < b : b < a;
+            };
+            auto by_text = [&](std::size_t lhs, std::size_t rhs) {
+                const std::string_view a = column.texts[lhs];
+                const std::string_view b = column.texts[rhs];
+                return ascending ? a < b : b < a;
+            };
+            if (column.numeric)
+            {
+                std::partial_sort(indices.begin(), indices.begin() + count, indices.end(), by_number);
+            }
+            else
+            {
+                std::partial_sort(indices.begin(), indices.begin() + count, indices.end(), by_text);
+            }
+            indices.resize(count);
+            return gather(input, indices);
+        }
+
+        bool is_step(const std::string& token)
+        {
+            for (const char* keyword : {"FILTER", "BIN", "GROUP", "TOP"})
+            {
+                if (xv_bindings::case_insentive_equals(keyword, token))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool parse_aggregate(const std::string& token, aggregate_op& op)
+        {
+            if (xv_bindings::case_insentive_equals("COUNT", token)) op = aggregate_op::count;
+            else if (xv_bindings::case_insentive_equals("SUM", token)) op = aggregate_op::sum;
+            else if (xv_bindings::case_insentive_equals("MEAN", token) ||
+                     xv_bindings::case_insentive_equals("AVG", token)) op = aggregate_op::mean;
+            else if (xv_bindings::case_insentive_equals("MIN", token)) op = aggregate_op::min;
+            else if (xv_bindings::case_insentive_equals("MAX", token)) op = aggregate_op::max;
+            else return false;
+            return true;
+        }
+
+        std::size_t parse_count(const std::string& token)
+        {
+            char* end = nullptr;
+            unsigned long res = std::strtoul(token.c_str(), &end, 10);
+            if (token.empty() || *end != '\0')
+            {
+                throw std::runtime_error("invalid count: " + token);
+            }
+            return static_cast<std::size_t>(res);
+        }
+
+        std::string unquote(const std::string& value)
+        {
+            if (value.size() >= 2 && (value.front() == '\'' || value.front() == '"') && value.back() == value.front())
+            {
+                return value.substr(1, value.size() - 2);
+            }
+            return value;
+        }
+    }
+
+    transform_pipeline transform_pipeline::parse(const std::vector<std::string>& tokens)
+    {
+        transform_pipeline res;
+        std::size_t i = 0;
+        auto next = [&](const char* what) -> const std::string& {
+            if (i == tokens.size())
+            {
+                throw std::runtime_error(std::string("missing ") + what + " in TRANSFORM");
+            }
+            return tokens[i++];
+        };
+        while (i != tokens.size())
+        {
+            const std::string& keyword = tokens[i++];
+            transform_step step;
+            if (xv_bindings::case_insentive_equals("FILTER", keyword))
+            {
+                step.kind = transform_step::filter;
+                step.column = next("column");
+                step.op = next("operator");
+                step.value = unquote(next("value"));
+            }
+            else if (xv_bindings::case_insentive_equals("BIN", keyword))
+            {
+                step.kind = transform_step::bin;
+                step.column = next("column");
+                step.count = parse_count(next("number of bins"));
+            }
+            else if (xv_bindings::case_insentive_equals("TOP", keyword))
+            {
+                step.kind = transform_step::top;
+                step.count = parse_count(next("count"));
+                step.column = next("column");
+                if (i != tokens.size() && (xv_bindings::case_insentive_equals("ASC", tokens[i]) ||
+                                           xv_bindings::case_insentive_equals("DESC", tokens[i])))
+                {
+                    step.ascending = xv_bindings::case_insentive_equals("ASC", tokens[i++]);
+                }
+            }
+            else if (xv_bindings::case_insentive_equals("GROUP", keyword))
+            {
+                step.kind = transform_step::group;
+                aggregate_op op;
+                while (i != tokens.size() && !parse_aggregate(tokens[i], op) && !is_step(tokens[i]))
+                {
+                    step.keys.push_back(tokens[i++]);
+                }
+                while (i != tokens.size() && parse_aggregate(tokens[i], op))
+                {
+                    aggregate agg = {op, "", xv_bindings::to_lower(tokens[i++])};
+                    if (i != tokens.size() && !is_step(tokens[i]) && !parse_aggregate(tokens[i], op)
+                        && !xv_bindings::case_insentive_equals("AS", tokens[i]))
+                    {
+                        agg.column = tokens[i++];
+                        agg.name += "_" + agg.column;
+                    }
+                    if (i != tokens.size() && xv_bindings::case_insentive_equals("AS", tokens[i]))
+                    {
+                        ++i;
+                        agg.name = next("name");
+                    }
+                    if (agg.column.empty() && agg.op != aggregate_op::count)
+                    {
+                        throw std::runtime_error("missing column of " + agg.name + " in TRANSFORM");
+                    }
+                    step.aggregates.push_back(std::move(agg));
+                }
+                if (step.keys.empty())
+                {
+                    throw std::runtime_error("missing column in GROUP");
+                }
+                if (step.aggregates.empty())
+                {
+                    step.aggregates.push_back({aggregate_op::count, "", "count"});
+                }
+            }
+            else
+            {
+                throw std::runtime_error("invalid TRANSFORM step: " + keyword);
+            }
+            res.m_steps.push_back(std::move(step));
+        }
+        return res;
+    }
+
+    bool transform_pipeline::empty() const
+    {
+        return m_steps.empty();
+    }
+
+    const std::vector<transform_step>& transform_pipeline::steps() const
+    {
+        return m_steps;
+    }
+
+    result_set transform_pipeline::apply(const result_set& input) const
+    {
+        frame data = load(input);
+        for (const transform_step& step : m_steps)
+        {
+            switch (step.kind)
+            {
+                case transform_step::filter: data = filter(data, step); break;
+                case transform_step::bin: bin(data, step); break;
+                case transform_step::group: data = group(data, step); break;
+                case transform_step::top: data = top(data, step); break;
+            }
+        }
+
+        result_set res;
+        for (const typed_column& column : data.columns)
+        {
+            res.add_column(column.name, column.numeric ? soci::dt_double : soci::dt_string);
+        }
+        for (std::size_t row = 0; row != data.rows; ++row)
+        {
+            for (const typed_column& column : data.columns)
+            {
+                if (!column.numeric)
+                {
+                    res.append_cell(column.texts[row]);
+                }
+                else if (std::isnan(column.numbers[row]))
+                {
+                    res.append_cell("NULL");
+                }
+                else
+                {
+                    res.emplace_cell([&](cell_buffer& out) { append_double(out, column.numbers[row]); });
+                }
+            }
+        }
+        return res;
+    }
+}
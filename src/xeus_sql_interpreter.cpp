@@ -11,8 +11,10 @@
 #include <cctype>
 #include <chrono>
 #include <cstdio>
+#include <cstdlib>
 #include <ctime>
 #include <fstream>
+#include <iostream>
 #include <locale>
 #include <memory>
 #include <set>
@@ -20,12 +22,19 @@
 #include <tuple>
 #include <vector>
 
-#include "tabulate/table.hpp"
 #include "xeus/xinterpreter.hpp"
+#include "xeus/xguid.hpp"
 #include "xeus/xhelper.hpp"
+#include "xeus/xinput.hpp"
 
 #include "xeus-sql/xeus_sql_interpreter.hpp"
+#include "xeus-sql/column_summary.hpp"
+#include "xeus-sql/duckdb_session.hpp"
+#include "xeus-sql/file_tables.hpp"
+#include "xeus-sql/result_set.hpp"
 #include "xeus-sql/soci_handler.hpp"
+#include "xeus-sql/text_renderer.hpp"
+#include "xeus-sql/transform.hpp"
 
 #ifdef USE_POSTGRE_SQL
 #include "soci/postgresql/soci-postgresql.h"
@@ -37,6 +46,12 @@
 #include "soci/sqlite3/soci-sqlite3.h"
 #endif
 
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
 namespace xeus_sql
 {
     // implemented at the end of the file
@@ -54,6 +69,60 @@ namespace xeus_sql
 
     void interpreter::configure_impl()
     {
+        /* Metrics are dumped to XSQL_METRICS_FILE, xsql_metrics.<pid>.prom
+           next to xeus.log by default so that kernels started in the same
+           directory don't overwrite each other, every XSQL_METRICS_INTERVAL
+           seconds (60 by default, 0 disables the dump). */
+        std::chrono::seconds interval(60);
+        if (const char* env = std::getenv("XSQL_METRICS_INTERVAL"))
+        {
+            interval = std::chrono::seconds(std::atoi(env));
+        }
+#ifdef _WIN32
+        std::string metrics_file = "xsql_metrics." + std::to_string(_getpid()) + ".prom";
+#else
+        std::string metrics_file = "xsql_metrics." + std::to_string(getpid()) + ".prom";
+#endif
+        if (const char* env = std::getenv("XSQL_METRICS_FILE"))
+        {
+            metrics_file = env;
+        }
+        metrics.start_dump(metrics_file, interval);
+
+        /* Results are spilled to XSQL_SPILL_DIR (the cache directory by
+           default) beyond XSQL_MEMORY_BUDGET_MB */
+        spill_options spill;
+        if (const char* env = std::getenv("XSQL_MEMORY_BUDGET_MB"))
+        {
+            spill.budget = std::strtoull(env, nullptr, 10) << 20;
+        }
+        if (const char* env = std::getenv("XSQL_SPILL_DIR"))
+        {
+            spill.directory = env;
+        }
+        // no frontend is connected yet, the warning goes to the kernel log
+        const std::string spill_warning = set_spill_options(spill);
+        if (!spill_warning.empty())
+        {
+            std::cerr << "xeus-sql: " << spill_warning << std::endl;
+        }
+
+        /* Results of %CACHE are kept in XSQL_CACHE_DIR, at most
+           XSQL_CACHE_SIZE_MB of them (1024 by default) */
+        std::size_t cache_capacity = result_cache::default_capacity;
+        if (const char* env = std::getenv("XSQL_CACHE_SIZE_MB"))
+        {
+            cache_capacity = std::strtoull(env, nullptr, 10) << 20;
+        }
+        const char* cache_dir = std::getenv("XSQL_CACHE_DIR");
+        cache.configure(cache_dir ? cache_dir : "", cache_capacity);
+
+        /* SELECT statements expected to return more than XSQL_GUARD_ROWS
+           rows are limited */
+        if (const char* env = std::getenv("XSQL_GUARD_ROWS"))
+        {
+            guard.max_rows = std::strtoull(env, nullptr, 10);
+        }
     }
 
     // trim string https://stackoverflow.com/a/217605/1203241
@@ -80,111 +149,722 @@ namespace xeus_sql
 
     using clock = std::chrono::system_clock;
     using sec = std::chrono::duration<double>;
+
+    // maximum number of results held for data grids
+    constexpr std::size_t max_grids = 16;
+
+    namespace
+    {
+        std::string rows_in_set(std::size_t row_count, double seconds)
+        {
+            std::stringstream rows_info;
+            rows_info << "\n" << std::fixed << std::setprecision(2);
+            if (row_count == 0) {
+                rows_info << "Empty set (" << seconds << " sec)";
+            } else if (row_count == 1) {
+                rows_info << "1 row in set (" << seconds << " sec)";
+            } else {
+                rows_info << row_count << " rows in set (" << seconds << " sec)";
+            }
+            return rows_info.str();
+        }
+
+        void record_result(query_profile& profile, const result_set& result)
+        {
+            profile.rows = result.rows();
+            profile.bytes_formatted = result.bytes();
+            profile.hold(result.bytes());
+            profile.arena_bytes = result.arena().reserved();
+            profile.arena_peak_bytes = result.arena().peak();
+            profile.spilled_bytes = result.arena().spilled();
+        }
+
+        std::string html_table(const result_set& result)
+        {
+            std::stringstream html_table("");
+            html_table << "<table>\n<tr>\n";
+            for (std::size_t col = 0; col != result.columns(); ++col)
+            {
+                html_table << "<th>" << result.column(col).name << "</th>\n";
+            }
+            html_table << "</tr>\n";
+            for (std::size_t row = 0; row != result.rows(); ++row)
+            {
+                html_table << "<tr>\n";
+                for (std::size_t col = 0; col != result.columns(); ++col)
+                {
+                    html_table << "<td>" << result.cell(row, col) << "</td>\n";
+                }
+                html_table << "</tr>\n";
+            }
+            html_table << "</table>";
+            return html_table.str();
+        }
+    }
+
+    std::shared_ptr<const result_set> interpreter::fetch_SQL_result(const std::string& code,
+                                                                    query_profile& profile)
+    {
+        std::string name = stored_result_name(code);
+        if (!name.empty())
+        {
+            auto stored = stored_results.find(name);
+            if (stored == stored_results.end())
+            {
+                throw std::runtime_error("unknown stored result: " + name);
+            }
+            metrics.record_cache_hit(stored->second.sql);
+            profile.rows = stored->second.result->rows();
+            return stored->second.result;
+        }
+
+        /* In a %CACHE cell, results are read from the disk cache first,
+           unless uncommitted changes may differ from them */
+        if (cache_ttl.count() > 0 && !transaction.open())
+        {
+            std::shared_ptr<const result_set> cached;
+            {
+                trace_span span("cache_load");
+                phase_timer timer(profile, query_phase::fetch);
+                cached = cache.load(connection_alias, code);
+            }
+            if (cached)
+            {
+                metrics.record_cache_hit(code);
+                record_result(profile, *cached);
+                profile.cached = true;
+                return cached;
+            }
+        }
+        auto store = [&](const result_set& result) {
+            if (cache_ttl.count() > 0 && !transaction.open())
+            {
+                trace_span span("cache_store");
+                cache.store(connection_alias, code, result, cache_ttl);
+            }
+        };
+
+        /* DuckDB results are read column by column, without soci::row */
+        if (this->duckdb)
+        {
+            auto result = std::make_shared<result_set>();
+            try {
+                trace_span span("duckdb_query");
+                this->duckdb->query(code, *result, profile);
+            } catch (...) {
+                metrics.record_error(code);
+                throw;
+            }
+            record_result(profile, *result);
+            store(*result);
+            return result;
+        }
+
+        if (!this->sql)
+        {
+            throw std::runtime_error("Database was not loaded.");
+        }
+
+        const std::string query = guard_SQL_query(code);
+        auto rows = [&]() -> soci::rowset<soci::row> {
+            trace_span span("prepare");
+            phase_timer timer(profile, query_phase::execute);
+            try {
+                return ((*this->sql).prepare << query);
+            } catch (...) {
+                metrics.record_error(code);
+                throw;
+            }
+        }();
+
+        /* Fetches and formats the rows */
+        auto result = std::make_shared<result_set>();
+        fetch_rows(rows, *result, fetch_opts, profile);
+        record_result(profile, *result);
+        // limited results are not the results of the query
+        if (query == code)
+        {
+            store(*result);
+        }
+        return result;
+    }
+
+    std::string interpreter::guard_SQL_query(const std::string& code)
+    {
+        std::vector<std::string> tokens = xv_bindings::tokenizer(first_code_line(code));
+        if (guard.max_rows == 0 || tokens.empty() ||
+            !xv_bindings::case_insentive_equals("SELECT", tokens[0]))
+        {
+            return code;
+        }
+
+        plan_estimate estimate;
+        try {
+            trace_span span("estimate");
+            estimate = estimate_query(*this->sql, code);
+        } catch (const std::exception&) {
+            // the query itself reports its errors
+            return code;
+        }
+        if (estimate.rows <= static_cast<double>(guard.max_rows))
+        {
+            return code;
+        }
+
+        std::stringstream message;
+        message << std::fixed << std::setprecision(0) << "The database estimates " << estimate.rows
+                << " rows (cost " << estimate.cost << "), more than the guard of " << guard.max_rows << " rows.";
+        if (guard.action == guard_options::ask && allow_stdin)
+        {
+            std::string answer = xv_bindings::to_lower(
+                xeus::blocking_input_request(message.str() + " Run it anyway? [y/N/limit] ", false));
+            trim(answer);
+            if (answer == "y" || answer == "yes")
+            {
+                return code;
+            }
+            if (answer != "l" && answer != "limit")
+            {
+                throw std::runtime_error("Query cancelled.");
+            }
+        }
+        publish_stream("stderr", message.str() + " Only the first " + std::to_string(guard.max_rows)
+                                 + " rows are fetched.\n");
+        return limit_query(code, guard.max_rows);
+    }
+
     nl::json interpreter::process_SQL_input(const std::string& code,
-                                            xv::df_type& xv_sql_df)
+                                            xv::df_type* xv_sql_df,
+                                            query_profile& profile,
+                                            bool summarize)
     {
         const auto before = clock::now();
-        soci::rowset<soci::row> rows = ((*this->sql).prepare << code);
+        const auto start = query_profile::clock::now();
 
         nl::json pub_data;
 
-        tabulate::Table plain_table;
-        std::stringstream html_table("");
-        /* Builds table body */
-        int row_count = 0;
-        for (const soci::row& r : rows)
+        auto stored = fetch_SQL_result(code, profile);
+        const result_set& result = *stored;
+        const std::size_t row_count = result.rows();
+
+        auto mark = query_profile::clock::now();
+        auto lap = [&mark, &profile](query_phase phase) {
+            auto now = query_profile::clock::now();
+            profile.add(phase, now - mark);
+            mark = now;
+        };
+
+        if (xv_sql_df != nullptr)
         {
-            if (row_count == 0) {
-                tabulate::Table::Row_t col_names;
-                html_table << "<table>\n<tr>\n";
-                for (std::size_t i = 0; i != r.size(); ++i) {
-                    std::string name = r.get_properties(i).get_name();
-                    html_table << "<th>" << name << "</th>\n";
-                    col_names.push_back(name);
+            result.to_data_frame(*xv_sql_df);
+            profile.hold(result.bytes());
+            lap(query_phase::format);
+        }
+
+        /* Builds the different kinds of outputs */
+        std::string html_str;
+        {
+            trace_span html_span("render_html");
+            html_str = html_table(result);
+            profile.hold(html_str.size());
+            lap(query_phase::render_html);
+        }
+
+        std::string plain_str;
+        {
+            trace_span text_span("render_text");
+            plain_str = render_text_table(result, text_options);
+            profile.hold(plain_str.size());
+            lap(query_phase::render_text);
+        }
+
+        /* Statistics of the columns, published after the result */
+        if (summarize || summary_always)
+        {
+            trace_span summary_span("summarize");
+            const auto summary_start = clock::now();
+            result_set summary = summary_table(summarize_columns(result));
+            const sec summary_duration = clock::now() - summary_start;
+            std::stringstream summary_info;
+            summary_info << std::fixed << std::setprecision(2)
+                         << "\n\nSummary (" << summary_duration.count() << " sec)\n";
+            plain_str += summary_info.str() + render_text_table(summary, text_options);
+            html_str += "<pre>" + summary_info.str() + "</pre>" + html_table(summary);
+        }
+
+        const sec duration = clock::now() - before;
+        const std::string rows_info = rows_in_set(row_count, duration.count());
+
+        pub_data["text/plain"] = rows_info + plain_str;
+        pub_data["text/html"] = rows_info + html_str;
+
+        const std::size_t bytes = 2 * rows_info.size() + plain_str.size() + html_str.size();
+        // stored and cached results are counted as cache hits of their query
+        if (stored_result_name(code).empty() && !profile.cached)
+        {
+            metrics.record_query(code, query_profile::clock::now() - start, profile.rows, bytes);
+            slow_log.record(connection_alias, code, profile, bytes);
+        }
+
+        return pub_data;
+    }
+
+    void interpreter::process_SQL_cell(int execution_counter,
+                                       const std::string& code,
+                                       bool profiling,
+                                       bool summarize)
+    {
+        std::vector<std::string> tokenized_input = xv_bindings::tokenizer(first_code_line(code));
+        if (tokenized_input.empty())
+        {
+            throw std::runtime_error("invalid input: " + code);
+        }
+
+        query_profile profile;
+
+        /* Shows rich output for tables */
+        if (xv_bindings::case_insentive_equals("SELECT", tokenized_input[0]) ||
+            xv_bindings::case_insentive_equals("DESC", tokenized_input[0]) ||
+            xv_bindings::case_insentive_equals("DESCRIBE", tokenized_input[0]) ||
+            xv_bindings::case_insentive_equals("SHOW", tokenized_input[0]) ||
+            xv_bindings::case_insentive_equals("--", tokenized_input[0]) ||
+            xv_bindings::case_insentive_equals("%FROM", tokenized_input[0]))
+        {
+            nl::json data = process_SQL_input(code, nullptr, profile, summarize);
+            nl::json metadata = nl::json::object();
+
+            if (profiling)
+            {
+                std::string footer = "\n" + profile.footer();
+                data["text/plain"] = data["text/plain"].get<std::string>() + footer;
+                data["text/html"] = data["text/html"].get<std::string>()
+                                    + "<pre>" + profile.footer() + "</pre>";
+                metadata["xsql_profile"] = profile.to_json();
+            }
+            if (transaction.open())
+            {
+                data["text/plain"] = data["text/plain"].get<std::string>() + "\n" + transaction.footer();
+                data["text/html"] = data["text/html"].get<std::string>()
+                                    + "<pre>" + transaction.footer() + "</pre>";
+            }
+
+            trace_span span("publish_execution_result");
+            publish_execution_result(execution_counter,
+                                     std::move(data),
+                                     std::move(metadata));
+        }
+        /* Execute all SQL commands that don't output tables */
+        else
+        {
+            if (!this->sql && !this->duckdb)
+            {
+                throw std::runtime_error("Database was not loaded.");
+            }
+
+            const auto start = query_profile::clock::now();
+            bool committed = false;
+            try {
+                trace_span span("execute");
+                phase_timer timer(profile, query_phase::execute);
+                transaction.before_statement(this->sql, this->duckdb, is_dml_statement(code));
+                if (this->duckdb) {
+                    this->duckdb->execute(code);
+                } else {
+                    *this->sql << code;
                 }
-                html_table << "</tr>\n";
-                plain_table.add_row(col_names);
+                committed = transaction.after_statement();
+            } catch (...) {
+                metrics.record_error(code);
+                /* The statements of the batch are not kept without the
+                   failed one, which some databases refuse to commit */
+                if (transaction.batched()) {
+                    const std::size_t discarded = transaction.statements();
+                    try {
+                        transaction.rollback();
+                    } catch (...) {
+                        // the database has already discarded it
+                    }
+                    publish_stream("stderr", "The batch was rolled back, " + std::to_string(discarded)
+                                             + " previous statements were discarded.\n");
+                }
+                throw;
+            }
+            metrics.record_query(code, query_profile::clock::now() - start, 0, 0);
+            slow_log.record(connection_alias, code, profile, 0);
+
+            std::string footer;
+            nl::json metadata = nl::json::object();
+            if (profiling)
+            {
+                footer = profile.footer();
+                metadata["xsql_profile"] = profile.to_json();
+            }
+            const std::string transaction_footer = transaction.open() ? transaction.footer()
+                                                   : committed ? "batch committed" : "";
+            if (!transaction_footer.empty())
+            {
+                footer += (footer.empty() ? "" : "\n") + transaction_footer;
             }
-            row_count++;
-            /* Iterates through cols' rows and builds different kinds of
-               outputs
-            */
-            tabulate::Table::Row_t row;
-            html_table << "<tr>\n";
-            for(std::size_t i = 0; i != r.size(); ++i)
+            if (!footer.empty())
+            {
+                nl::json data = nl::json::object();
+                data["text/plain"] = footer;
+                publish_execution_result(execution_counter,
+                                         std::move(data),
+                                         std::move(metadata));
+            }
+        }
+    }
+
+    nl::json interpreter::stored_results_bundle() const
+    {
+        result_set list;
+        list.add_column("name", soci::dt_string);
+        list.add_column("rows", soci::dt_long_long);
+        list.add_column("columns", soci::dt_long_long);
+        list.add_column("bytes", soci::dt_long_long);
+        list.add_column("query", soci::dt_string);
+        std::size_t total = 0;
+        for (const auto& stored : stored_results)
+        {
+            const result_set& result = *stored.second.result;
+            list.append_cell(stored.first);
+            list.emplace_cell([&](cell_buffer& out) { append_unsigned(out, result.rows()); });
+            list.emplace_cell([&](cell_buffer& out) { append_unsigned(out, result.columns()); });
+            list.emplace_cell([&](cell_buffer& out) { append_unsigned(out, result.memory()); });
+            list.append_cell(stored.second.sql);
+            total += result.memory();
+        }
+
+        nl::json bundle = nl::json::object();
+        bundle["text/plain"] = render_text_table(list, text_options)
+                               + std::to_string(total) + " bytes held by stored results";
+        return bundle;
+    }
+
+    void interpreter::process_SQL_grid(int execution_counter,
+                                       const std::string& code,
+                                       bool profiling)
+    {
+        const auto before = clock::now();
+        const auto start = query_profile::clock::now();
+        query_profile profile;
+        auto result = fetch_SQL_result(code, profile);
+
+        /* The frontend never opens grids, the target only has to exist for
+           the comms opened by the kernel */
+        if (!grid_target_registered)
+        {
+            comm_manager().register_comm_target(result_grid::target_name,
+                                                [](xeus::xcomm&&, const xeus::xmessage&) {});
+            grid_target_registered = true;
+        }
+
+        grids.erase(std::remove_if(grids.begin(), grids.end(),
+                                   [](const std::unique_ptr<result_grid>& g) { return g->closed(); }),
+                    grids.end());
+        if (grids.size() == max_grids)
+        {
+            grids.front()->close();
+            grids.erase(grids.begin());
+        }
+
+        xeus::xcomm comm(comm_manager().target(result_grid::target_name), xeus::new_xguid());
+        grids.push_back(std::make_unique<result_grid>(std::move(comm), result));
+
+        /* Frontends without the grid renderer show the head and the tail
+           of the result */
+        std::string plain_str;
+        {
+            trace_span text_span("render_text");
+            phase_timer timer(profile, query_phase::render_text);
+            plain_str = render_text_table(*result, text_options);
+        }
+        const sec duration = clock::now() - before;
+
+        nl::json data = nl::json::object();
+        data[result_grid::mime_type] = grids.back()->model();
+        data["text/plain"] = rows_in_set(result->rows(), duration.count()) + plain_str;
+        nl::json metadata = nl::json::object();
+        if (profiling)
+        {
+            data["text/plain"] = data["text/plain"].get<std::string>() + "\n" + profile.footer();
+            metadata["xsql_profile"] = profile.to_json();
+        }
+
+        const std::size_t bytes = data["text/plain"].get<std::string>().size();
+        if (stored_result_name(code).empty())
+        {
+            metrics.record_query(code, query_profile::clock::now() - start, profile.rows, bytes);
+            slow_log.record(connection_alias, code, profile, bytes);
+        }
+
+        trace_span span("publish_execution_result");
+        publish_execution_result(execution_counter, std::move(data), std::move(metadata));
+    }
+
+    void interpreter::process_SQL_sweep(int execution_counter,
+                                        const std::string& code,
+                                        bool profiling)
+    {
+        /* %%SWEEP name IN (values|query) on the first line, the query
+           using :name on the next ones */
+        const std::string first_line = first_code_line(code);
+        std::vector<std::string> tokens = xv_bindings::tokenizer(first_line);
+        const std::size_t open = first_line.find('(');
+        const std::size_t close = first_line.rfind(')');
+        if (tokens.size() < 4 || !xv_bindings::case_insentive_equals("IN", tokens[2]) ||
+            open == std::string::npos || close == std::string::npos || close < open)
+        {
+            throw std::runtime_error("invalid input: " + first_line);
+        }
+        const std::string name = tokens[1][0] == ':' ? tokens[1].substr(1) : tokens[1];
+        const std::string list = first_line.substr(open + 1, close - open - 1);
+        std::string query = code.substr(code.find(first_line) + first_line.size());
+        trim(query);
+        if (query.empty())
+        {
+            throw std::runtime_error("%%SWEEP runs the query following its first line.");
+        }
+        if (!this->sql)
+        {
+            throw std::runtime_error(this->duckdb ? "%%SWEEP can't bind the parameters of DuckDB queries."
+                                                  : "Database was not loaded.");
+        }
+
+        const auto before = clock::now();
+        const auto start = query_profile::clock::now();
+        query_profile profile;
+        std::vector<std::string> values;
+        // NULL values are bound with an indicator
+        std::vector<bool> nulls;
+        std::vector<std::string> list_tokens = xv_bindings::tokenizer(list);
+        if (!list_tokens.empty() && xv_bindings::case_insentive_equals("SELECT", list_tokens[0]))
+        {
+            query_profile list_profile;
+            auto list_result = fetch_SQL_result(list, list_profile);
+            for (std::size_t row = 0; row != list_result->rows(); ++row)
             {
-                std::string cell;
+                values.emplace_back(list_result->cell(row, 0));
+                nulls.push_back(values.back() == "NULL");
+            }
+        }
+        else
+        {
+            values = parse_value_list(list, &nulls);
+        }
 
-                soci::column_properties props = r.get_properties(i);
+        /* Numbers are bound as numbers, so that they compare as numbers */
+        auto all_parse = [&values, &nulls](auto parse) {
+            for (std::size_t i = 0; i != values.size(); ++i)
+            {
+                if (nulls[i])
+                {
+                    continue;
+                }
+                const std::string& value = values[i];
+                std::size_t end = 0;
                 try {
-                    switch(props.get_data_type())
+                    parse(value, &end);
+                } catch (const std::logic_error&) {
+                    return false;
+                }
+                if (end != value.size())
+                {
+                    return false;
+                }
+            }
+            return true;
+        };
+        const bool integers = all_parse([](const std::string& v, std::size_t* end) { return std::stoll(v, end); });
+        const bool reals = integers || all_parse([](const std::string& v, std::size_t* end) { return std::stod(v, end); });
+
+        auto result = std::make_shared<result_set>();
+        const std::string null_value = "NULL";
+        auto sweep = [&](auto& bound, auto assign) {
+            soci::row r;
+            soci::indicator indicator = soci::i_ok;
+            soci::statement statement = [&]() -> soci::statement {
+                trace_span span("prepare");
+                phase_timer timer(profile, query_phase::execute);
+                return ((*this->sql).prepare << query, soci::use(bound, indicator, name), soci::into(r));
+            }();
+            for (std::size_t i = 0; i != values.size(); ++i)
+            {
+                const std::string& value = nulls[i] ? null_value : values[i];
+                indicator = nulls[i] ? soci::i_null : soci::i_ok;
+                if (!nulls[i])
+                {
+                    assign(value);
+                }
+                {
+                    trace_span span("execute");
+                    phase_timer timer(profile, query_phase::execute);
+                    statement.execute();
+                }
+                phase_timer timer(profile, query_phase::fetch);
+                while (statement.fetch())
+                {
+                    if (!result->described())
                     {
-                        case soci::dt_string:
-                            cell = r.get<std::string>(i, "NULL");
-                            break;
-                        case soci::dt_double:
-                            cell = std::to_string(r.get<double>(i));
-                            cell.erase(cell.find_last_not_of('0') + 1, std::string::npos);
-                            if (cell.back() == '.') {
-                                cell.pop_back();
-                            }
-                            break;
-                        case soci::dt_integer:
-                            cell = std::to_string(r.get<int>(i));
-                            break;
-                        case soci::dt_long_long:
-                            cell = std::to_string(r.get<long long>(i));
-                            break;
-                        case soci::dt_unsigned_long_long:
-                            cell = std::to_string(r.get<unsigned long long>(i));
-                            break;
-                        case soci::dt_xml:
-                        case soci::dt_blob:
-                            break;
-                        case soci::dt_date:
-                            std::tm when = r.get<std::tm>(i);
-                            char buffer [20];
-                            std::strftime(buffer, 20, "%Y-%m-%d %H:%M:%S", &when);
-                            cell = buffer;
-                            break;
+                        result_set row_columns;
+                        row_columns.describe(r);
+                        std::vector<column_info> columns = {{name,
+                                                             integers ? soci::dt_long_long
+                                                                      : reals ? soci::dt_double : soci::dt_string,
+                                                             nullptr}};
+                        columns.insert(columns.end(), row_columns.column_infos().begin(),
+                                       row_columns.column_infos().end());
+                        result->describe(columns);
                     }
-                } catch (...) {
-                    cell = "NULL";
+                    result->append_cell(value);
+                    result->append(r);
                 }
-                html_table << "<td>" << cell << "</td>\n";
-                row.push_back(cell);
-                xv_sql_df[r.get_properties(i).get_name()].push_back(cell);
             }
-            plain_table.add_row(row);
-            html_table << "</tr>\n";
+        };
+        try {
+            if (integers)
+            {
+                long long bound = 0;
+                sweep(bound, [&bound](const std::string& value) { bound = std::stoll(value); });
+            }
+            else if (reals)
+            {
+                double bound = 0.;
+                sweep(bound, [&bound](const std::string& value) { bound = std::stod(value); });
+            }
+            else
+            {
+                std::string bound;
+                sweep(bound, [&bound](const std::string& value) { bound = value; });
+            }
+        } catch (...) {
+            metrics.record_error(query);
+            throw;
+        }
+        record_result(profile, *result);
+
+        std::string plain_str;
+        {
+            trace_span text_span("render_text");
+            phase_timer timer(profile, query_phase::render_text);
+            plain_str = render_text_table(*result, text_options);
+        }
+        std::string html_str;
+        {
+            trace_span html_span("render_html");
+            phase_timer timer(profile, query_phase::render_html);
+            html_str = html_table(*result);
         }
-        html_table << "</table>";
         const sec duration = clock::now() - before;
-        std::stringstream rows_info;
-        rows_info << "\n";
-        if (row_count == 0) {
-            rows_info << std::fixed << std::setprecision(2) << "Empty set ("
-                       << duration.count() << " sec)";
-        } else if (row_count == 1) {
-            rows_info << std::fixed << std::setprecision(2) << "1 row in set ("
-                       << duration.count() << " sec)";
-        } else {
-            rows_info << std::fixed << std::setprecision(2) << row_count
-                       << " rows in set (" << duration.count() << " sec)";
+        const std::string rows_info = rows_in_set(result->rows(), duration.count());
+
+        nl::json data = nl::json::object();
+        data["text/plain"] = rows_info + plain_str;
+        data["text/html"] = rows_info + html_str;
+        nl::json metadata = nl::json::object();
+        if (profiling)
+        {
+            data["text/plain"] = data["text/plain"].get<std::string>() + "\n" + profile.footer();
+            data["text/html"] = data["text/html"].get<std::string>() + "<pre>" + profile.footer() + "</pre>";
+            metadata["xsql_profile"] = profile.to_json();
+        }
+        const std::size_t bytes = 2 * rows_info.size() + plain_str.size() + html_str.size();
+        metrics.record_query(query, query_profile::clock::now() - start, result->rows(), bytes);
+        slow_log.record(connection_alias, query, profile, bytes);
+
+        trace_span span("publish_execution_result");
+        publish_execution_result(execution_counter, std::move(data), std::move(metadata));
+    }
+
+    void interpreter::watch_SQL_result(int execution_counter,
+                                       const std::string& code,
+                                       const std::vector<std::string>& key,
+                                       std::chrono::seconds interval)
+    {
+        {
+            std::lock_guard<std::mutex> lock(watch_mutex);
+            watch_interrupted = false;
         }
+        result_diff diff(key);
+        nl::json transient = nl::json::object();
+        transient["display_id"] = xeus::new_xguid();
+        for (std::size_t refresh = 0;; ++refresh)
+        {
+            const auto before = clock::now();
+            const auto start = query_profile::clock::now();
+            query_profile profile;
+            auto result = fetch_SQL_result(code, profile);
+            std::vector<row_change> changes;
+            {
+                trace_span span("diff");
+                changes = diff.update(result);
+            }
+            const sec duration = clock::now() - before;
+            metrics.record_query(code, query_profile::clock::now() - start, profile.rows, 0);
+            slow_log.record(connection_alias, code, profile, 0);
 
-        pub_data["text/plain"] = rows_info.str() + plain_table.str();
-        pub_data["text/html"] = rows_info.str() + html_table.str();
+            /* The first result is published whole, the next ones only
+               update the display of the changes */
+            if (refresh == 0)
+            {
+                nl::json data = nl::json::object();
+                const std::string rows_info = rows_in_set(result->rows(), duration.count());
+                data["text/plain"] = rows_info + render_text_table(*result, text_options);
+                data["text/html"] = rows_info + html_table(*result);
+                publish_execution_result(execution_counter, std::move(data), nl::json::object());
+                changes.clear();
+            }
+            std::size_t counts[3] = {0, 0, 0};
+            for (const row_change& change : changes)
+            {
+                ++counts[change.kind];
+            }
+            const std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+            std::stringstream status;
+            status << std::fixed << std::setprecision(2)
+                   << "Refreshed at " << std::put_time(std::localtime(&now), "%H:%M:%S") << ": "
+                   << result->rows() << " rows, " << counts[row_change::added] << " added, "
+                   << counts[row_change::changed] << " changed, " << counts[row_change::removed]
+                   << " removed (" << duration.count() << " sec). Interrupt the kernel to stop.\n";
 
-        return pub_data;
+            nl::json data = nl::json::object();
+            data["text/plain"] = status.str();
+            data["text/html"] = "<pre>" + status.str() + "</pre>";
+            if (!changes.empty())
+            {
+                result_set table = diff.changes_table(changes);
+                data["text/plain"] = status.str() + render_text_table(table, text_options);
+                data["text/html"] = "<pre>" + status.str() + "</pre>" + html_table(table);
+            }
+            if (refresh == 0)
+            {
+                display_data(std::move(data), nl::json::object(), transient);
+            }
+            else
+            {
+                update_display_data(std::move(data), nl::json::object(), transient);
+            }
+
+            std::unique_lock<std::mutex> lock(watch_mutex);
+            if (watch_cv.wait_for(lock, interval, [this] { return watch_interrupted; }))
+            {
+                return;
+            }
+        }
     }
 
     void interpreter::execute_request_impl(send_reply_callback cb,
                                   int execution_counter,
                                   const std::string& code,
-                                  xeus::execute_request_config /*config*/,
+                                  xeus::execute_request_config config,
                                   nl::json user_expressions)
     {
+        trace_span request_span("execute_request");
+        // the timer committing the expired batches waits for the cell
+        std::lock_guard<std::mutex> transaction_lock(transaction.mutex());
+        allow_stdin = config.allow_stdin;
+
         auto ok = [&]() {
             return xeus::create_successful_reply(nl::json::array(), user_expressions);
         };
@@ -198,16 +878,19 @@ namespace xeus_sql
         };
 
         // we only need to tokenize the first line
-        std::istringstream iss(code);
-        std::string first_line;
-        while (std::getline(iss, first_line)) {
-            trim(first_line);
-            if (first_line.size() > 0) break;
-        }
+        std::string first_line = first_code_line(code);
         std::vector<std::string> tokenized_input = xv_bindings::tokenizer(first_line);
         xv::df_type xv_sql_df;
+        query_profile profile;
         try
         {
+            const std::string timer_error = transaction.timer_error();
+            if (!timer_error.empty())
+            {
+                publish_stream("stderr", "The expired batch could not be committed: " + timer_error + "\n");
+            }
+            transaction.commit_expired_batch();
+
             /* Runs magic */
             if(xv_bindings::is_magic(tokenized_input))
             {
@@ -230,11 +913,30 @@ namespace xeus_sql
                         stringfied_sql_input << " " << sql_input[i];
                     }
 
-                    process_SQL_input(stringfied_sql_input.str(), xv_sql_df);
+                    /* "TRANSFORM steps..." ends the xvega arguments, the steps
+                       are applied to the result before the data frame is built */
+                    auto transform = std::find_if(xvega_input.begin(), xvega_input.end(), [](const std::string& token) {
+                        return xv_bindings::case_insentive_equals("TRANSFORM", token);
+                    });
+                    if (transform != xvega_input.end()) {
+                        transform_pipeline pipeline = transform_pipeline::parse(
+                            std::vector<std::string>(transform + 1, xvega_input.end()));
+                        xvega_input.erase(transform, xvega_input.end());
+                        const auto start = query_profile::clock::now();
+                        auto result = fetch_SQL_result(stringfied_sql_input.str(), profile);
+                        pipeline.apply(*result).to_data_frame(xv_sql_df);
+                        if (stored_result_name(stringfied_sql_input.str()).empty()) {
+                            metrics.record_query(stringfied_sql_input.str(), query_profile::clock::now() - start,
+                                                 profile.rows, 0);
+                        }
+                    } else {
+                        process_SQL_input(stringfied_sql_input.str(), &xv_sql_df, profile);
+                    }
 
                     chart = xv_bindings::process_xvega_input(xvega_input,
                                                              xv_sql_df);
 
+                    trace_span span("publish_execution_result");
                     publish_execution_result(execution_counter,
                                              std::move(chart),
                                              nl::json::object());
@@ -280,7 +982,7 @@ namespace xeus_sql
                     sql.erase(0, code.find(first_line) + first_line.length());
                     trim(sql);
                     if (sql.length() > 0) {
-                        process_SQL_input(sql, xv_sql_df);
+                        process_SQL_input(sql, &xv_sql_df, profile);
                         if (xv_sql_df.size() == 0) {
                             throw std::runtime_error("Empty result from sql, can't render");
                         }
@@ -290,43 +992,531 @@ namespace xeus_sql
                     }
                     auto bundle = nl::json::object();
                     bundle["application/vnd.vegalite.v3+json"] = j;
+                    trace_span span("publish_execution_result");
                     publish_execution_result(execution_counter, std::move(bundle), nl::json::object());
                     cb(ok());
                     return;
-                }
-
-                /* Parses LOAD magic */
-                this->sql = parse_SQL_magic(tokenized_input);
-            }
-            /* Runs SQL code */
-            else
-            {
-                if (this->sql)
-                {
-                    /* Shows rich output for tables */
-                    if (xv_bindings::case_insentive_equals("SELECT", tokenized_input[0]) ||
-                        xv_bindings::case_insentive_equals("DESC", tokenized_input[0]) ||
-                        xv_bindings::case_insentive_equals("DESCRIBE", tokenized_input[0]) ||
-                        xv_bindings::case_insentive_equals("SHOW", tokenized_input[0]) ||
-                        xv_bindings::case_insentive_equals("--", tokenized_input[0]))
+                } else if (xv_bindings::case_insentive_equals("TRACE", tokenized_input[0])) {
+                    if (tokenized_input.size() < 2) {
+                        throw std::runtime_error("invalid input: " + code);
+                    }
+                    if (tokenized_input.size() > 2) {
+                        trace_path = tokenized_input[2];
+                    }
+                    auto bundle = nl::json::object();
+                    if (xv_bindings::case_insentive_equals("ON", tokenized_input[1])) {
+                        set_tracing(true);
+                        bundle["text/plain"] = "Tracing enabled, spans will be written to " + trace_path + ".";
+                    } else if (xv_bindings::case_insentive_equals("OFF", tokenized_input[1]) ||
+                               xv_bindings::case_insentive_equals("FLUSH", tokenized_input[1])) {
+                        if (xv_bindings::case_insentive_equals("OFF", tokenized_input[1])) {
+                            set_tracing(false);
+                        }
+                        std::size_t count = write_trace(trace_path);
+                        bundle["text/plain"] = std::to_string(count) + " spans written to " + trace_path + ".";
+                    } else {
+                        throw std::runtime_error("invalid input: " + code);
+                    }
+                    publish_execution_result(execution_counter, std::move(bundle), nl::json::object());
+                    cb(ok());
+                    return;
+                } else if (xv_bindings::case_insentive_equals("SLOW_LOG", tokenized_input[0])) {
+                    if (tokenized_input.size() < 2) {
+                        throw std::runtime_error("invalid input: " + code);
+                    }
+                    std::string path = tokenized_input.size() > 2 ? tokenized_input[2] : slow_log.path();
+                    auto bundle = nl::json::object();
+                    if (xv_bindings::case_insentive_equals("OFF", tokenized_input[1])) {
+                        slow_log.configure(path, std::chrono::milliseconds(-1));
+                        bundle["text/plain"] = "Slow query log disabled.";
+                    } else {
+                        std::chrono::milliseconds threshold(std::stoll(tokenized_input[1]));
+                        slow_log.configure(path, threshold);
+                        bundle["text/plain"] = "Queries slower than " + tokenized_input[1]
+                                               + " ms will be logged to " + path + ".";
+                    }
+                    publish_execution_result(execution_counter, std::move(bundle), nl::json::object());
+                    cb(ok());
+                    return;
+                } else if (xv_bindings::case_insentive_equals("SPILL", tokenized_input[0])) {
+                    if (tokenized_input.size() > 1) {
+                        spill_options spill = get_spill_options();
+                        spill.budget = xv_bindings::case_insentive_equals("OFF", tokenized_input[1])
+                                       ? 0 : std::stoull(tokenized_input[1]) << 20;
+                        if (tokenized_input.size() > 2) {
+                            spill.directory = tokenized_input[2];
+                        }
+                        const std::string warning = set_spill_options(spill);
+                        if (!warning.empty()) {
+                            publish_stream("stderr", warning + "\n");
+                        }
+                    }
+                    const spill_options spill = get_spill_options();
+                    std::string text = spill.budget == 0
+                        ? std::string("Results are not spilled")
+                        : "Results are spilled to " + spill.directory + " beyond "
+                          + std::to_string(spill.budget >> 20) + " MB";
+                    text += ", " + std::to_string(resident_arena_bytes() >> 20) + " MB of results in memory.";
+                    auto bundle = nl::json::object();
+                    bundle["text/plain"] = text;
+                    publish_execution_result(execution_counter, std::move(bundle), nl::json::object());
+                    cb(ok());
+                    return;
+                } else if (xv_bindings::case_insentive_equals("CACHE", tokenized_input[0])) {
+                    const std::string ttl_prefix = "TTL=";
+                    if (tokenized_input.size() > 2 &&
+                        xv_bindings::case_insentive_equals(ttl_prefix, tokenized_input[1].substr(0, ttl_prefix.size()))) {
+                        /* %CACHE ttl=DURATION query */
+                        const std::chrono::seconds ttl = parse_ttl(tokenized_input[1].substr(ttl_prefix.size()));
+                        const std::string query = strip_first_word(strip_magic(code));
+                        if (persistent_connection(connection_alias)) {
+                            cache_ttl = ttl;
+                        } else {
+                            publish_stream("stderr", "Results of in-memory databases are not cached.\n");
+                        }
+                        try {
+                            process_SQL_cell(execution_counter, query, profile_always);
+                        } catch (...) {
+                            cache_ttl = std::chrono::seconds(0);
+                            throw;
+                        }
+                        cache_ttl = std::chrono::seconds(0);
+                        cb(ok());
+                        return;
+                    }
+                    auto bundle = nl::json::object();
+                    if (tokenized_input.size() == 2 &&
+                        xv_bindings::case_insentive_equals("CLEAR", tokenized_input[1])) {
+                        bundle["text/plain"] = std::to_string(cache.clear()) + " bytes freed.";
+                    } else if (tokenized_input.size() == 1) {
+                        bundle["text/plain"] = std::to_string(cache.entries()) + " results ("
+                                               + std::to_string(cache.size() >> 20) + " MB of "
+                                               + std::to_string(cache.capacity() >> 20) + " MB) cached in "
+                                               + cache.directory() + ".";
+                    } else {
+                        throw std::runtime_error("invalid input: " + code);
+                    }
+                    publish_execution_result(execution_counter, std::move(bundle), nl::json::object());
+                    cb(ok());
+                    return;
+                } else if (xv_bindings::case_insentive_equals("WATCH", tokenized_input[0])) {
+                    /* %WATCH interval [KEY column[,column...]] query */
+                    if (tokenized_input.size() < 3) {
+                        throw std::runtime_error("invalid input: " + code);
+                    }
+                    const std::chrono::seconds interval = parse_ttl(tokenized_input[1]);
+                    std::string query = strip_first_word(strip_magic(code));
+                    std::vector<std::string> key;
+                    if (tokenized_input.size() > 4 &&
+                        xv_bindings::case_insentive_equals("KEY", tokenized_input[2])) {
+                        std::stringstream columns(tokenized_input[3]);
+                        for (std::string column; std::getline(columns, column, ',');) {
+                            key.push_back(column);
+                        }
+                        query = strip_first_word(strip_first_word(query));
+                    }
+                    watch_SQL_result(execution_counter, query, key, interval);
+                    cb(ok());
+                    return;
+                } else if (xv_bindings::case_insentive_equals("EXPLAIN", tokenized_input[0])) {
+                    /* %EXPLAIN [ANALYZE] query */
+                    if (tokenized_input.size() < 2) {
+                        throw std::runtime_error("invalid input: " + code);
+                    }
+                    const bool analyze = tokenized_input.size() > 2 &&
+                                         xv_bindings::case_insentive_equals("ANALYZE", tokenized_input[1]);
+                    const std::string query = analyze ? strip_first_word(strip_magic(code)) : strip_magic(code);
+                    if (!this->sql) {
+                        throw std::runtime_error(this->duckdb ? "%EXPLAIN can't show the plans of DuckDB."
+                                                              : "Database was not loaded.");
+                    }
+                    query_plan plan;
                     {
-                        nl::json data = process_SQL_input(code, xv_sql_df);
-
-                        publish_execution_result(execution_counter,
-                                                 std::move(data),
-                                                 nl::json::object());
-
+                        trace_span span("explain");
+                        try {
+                            plan = explain_query(*this->sql, query, analyze);
+                        } catch (...) {
+                            metrics.record_error(query);
+                            throw;
+                        }
+                    }
+                    auto bundle = nl::json::object();
+                    bundle["text/plain"] = plan_to_text(plan);
+                    bundle["text/html"] = plan_to_html(plan);
+                    publish_execution_result(execution_counter, std::move(bundle), nl::json::object());
+                    cb(ok());
+                    return;
+                } else if (xv_bindings::case_insentive_equals("GUARD", tokenized_input[0])) {
+                    /* %GUARD max_rows [LIMIT|ASK] or %GUARD OFF */
+                    if (tokenized_input.size() > 1) {
+                        if (xv_bindings::case_insentive_equals("OFF", tokenized_input[1])) {
+                            guard.max_rows = 0;
+                        } else {
+                            guard.max_rows = std::stoull(tokenized_input[1]);
+                            guard.action = guard_options::limit;
+                            if (tokenized_input.size() > 2 &&
+                                xv_bindings::case_insentive_equals("ASK", tokenized_input[2])) {
+                                guard.action = guard_options::ask;
+                            } else if (tokenized_input.size() > 2 &&
+                                       !xv_bindings::case_insentive_equals("LIMIT", tokenized_input[2])) {
+                                throw std::runtime_error("invalid input: " + code);
+                            }
+                        }
+                    }
+                    auto bundle = nl::json::object();
+                    bundle["text/plain"] = guard.max_rows == 0
+                        ? std::string("Queries are not guarded.")
+                        : "SELECT statements estimated above " + std::to_string(guard.max_rows) + " rows are "
+                          + (guard.action == guard_options::ask ? "confirmed first." : "limited.");
+                    publish_execution_result(execution_counter, std::move(bundle), nl::json::object());
+                    cb(ok());
+                    return;
+                } else if (xv_bindings::case_insentive_equals("DISPLAY", tokenized_input[0])) {
+                    for (std::size_t i = 1; i + 1 < tokenized_input.size(); i += 2) {
+                        std::size_t value = std::stoul(tokenized_input[i + 1]);
+                        if (xv_bindings::case_insentive_equals("MAX_ROWS", tokenized_input[i])) {
+                            text_options.max_rows = value;
+                        } else if (xv_bindings::case_insentive_equals("MAX_CELL_WIDTH", tokenized_input[i])) {
+                            text_options.max_cell_width = value;
+                        } else {
+                            throw std::runtime_error("invalid display option: " + tokenized_input[i]);
+                        }
+                    }
+                    auto bundle = nl::json::object();
+                    bundle["text/plain"] = "MAX_ROWS " + std::to_string(text_options.max_rows)
+                                           + " MAX_CELL_WIDTH " + std::to_string(text_options.max_cell_width);
+                    publish_execution_result(execution_counter, std::move(bundle), nl::json::object());
+                    cb(ok());
+                    return;
+                } else if (xv_bindings::case_insentive_equals("STATS", tokenized_input[0])) {
+                    auto bundle = nl::json::object();
+                    if (tokenized_input.size() > 1 &&
+                        xv_bindings::case_insentive_equals("RESET", tokenized_input[1]))
+                    {
+                        metrics.reset();
+                        bundle["text/plain"] = "Statistics reset.";
+                    }
+                    else if (tokenized_input.size() > 1 &&
+                             xv_bindings::case_insentive_equals("PROMETHEUS", tokenized_input[1]))
+                    {
+                        bundle["text/plain"] = metrics.to_prometheus();
                     }
-                    /* Execute all SQL commands that don't output tables */
                     else
                     {
-                        *this->sql << code;
+                        bundle = metrics.to_bundle();
+                    }
+                    publish_execution_result(execution_counter, std::move(bundle), nl::json::object());
+                    cb(ok());
+                    return;
+                } else if (xv_bindings::case_insentive_equals("STORE", tokenized_input[0])) {
+                    auto bundle = nl::json::object();
+                    if (tokenized_input.size() == 1 ||
+                        xv_bindings::case_insentive_equals("LIST", tokenized_input[1])) {
+                        bundle = stored_results_bundle();
+                    } else if (xv_bindings::case_insentive_equals("DROP", tokenized_input[1])) {
+                        if (tokenized_input.size() < 3) {
+                            throw std::runtime_error("invalid input: " + code);
+                        }
+                        std::size_t freed = 0;
+                        for (auto it = stored_results.begin(); it != stored_results.end();) {
+                            if (xv_bindings::case_insentive_equals("ALL", tokenized_input[2]) ||
+                                it->first == tokenized_input[2]) {
+                                freed += it->second.result->memory();
+                                it = stored_results.erase(it);
+                            } else {
+                                ++it;
+                            }
+                        }
+                        bundle["text/plain"] = std::to_string(freed) + " bytes freed.";
+                    } else {
+                        if (tokenized_input.size() < 3) {
+                            throw std::runtime_error("invalid input: " + code);
+                        }
+                        const std::string& name = tokenized_input[1];
+                        std::string query = strip_first_word(strip_magic(code));
+                        const auto start = query_profile::clock::now();
+                        auto result = fetch_SQL_result(query, profile);
+                        if (stored_result_name(query).empty()) {
+                            metrics.record_query(query, query_profile::clock::now() - start, result->rows(), 0);
+                        }
+                        stored_results[name] = {query, result};
+                        bundle["text/plain"] = "Stored " + std::to_string(result->rows()) + " rows as "
+                                               + name + " (" + std::to_string(result->memory()) + " bytes).";
+                    }
+                    publish_execution_result(execution_counter, std::move(bundle), nl::json::object());
+                    cb(ok());
+                    return;
+                } else if (xv_bindings::case_insentive_equals("FROM", tokenized_input[0])) {
+                    process_SQL_cell(execution_counter, code, profile_always);
+                    cb(ok());
+                    return;
+                } else if (xv_bindings::case_insentive_equals("LOCAL", tokenized_input[0])) {
+                    auto bundle = nl::json::object();
+                    if (tokenized_input.size() == 1) {
+                        std::stringstream tables;
+                        for (const auto& table : scratch.tables()) {
+                            tables << table.first << " (" << table.second << " rows)\n";
+                        }
+                        bundle["text/plain"] = tables.str();
+                    } else {
+                        /* %LOCAL table [ON connection] query */
+                        const std::string& table = tokenized_input[1];
+                        std::string query = strip_first_word(strip_magic(code));
+                        std::shared_ptr<soci::session> source = this->sql;
+                        std::string source_alias = connection_alias;
+                        if (tokenized_input.size() > 3 &&
+                            xv_bindings::case_insentive_equals("ON", tokenized_input[2])) {
+                            auto connection = connections.find(tokenized_input[3]);
+                            if (connection == connections.end()) {
+                                throw std::runtime_error("unknown connection: " + tokenized_input[3]);
+                            }
+                            source = connection->second;
+                            source_alias = connection->first;
+                            query = strip_first_word(strip_first_word(query));
+                        }
+                        if (!source) {
+                            throw std::runtime_error(this->duckdb ? "%LOCAL can't copy results of DuckDB."
+                                                                  : "Database was not loaded.");
+                        }
+                        /* The copy runs in its own transaction on the scratch
+                           database, which can't nest in a batch opened by %%LOCAL */
+                        transaction.before_statement(
+                            std::shared_ptr<soci::session>(&scratch.session(), [](soci::session*) {}),
+                            nullptr, false);
+                        const auto start = query_profile::clock::now();
+                        materialize_stats stats;
+                        {
+                            trace_span materialize_span("materialize");
+                            try {
+                                stats = scratch.materialize(*source, query, table);
+                            } catch (...) {
+                                metrics.record_error(query);
+                                throw;
+                            }
+                        }
+                        metrics.record_query(query, query_profile::clock::now() - start, stats.rows, 0);
+                        std::stringstream message;
+                        message << std::fixed << std::setprecision(2) << stats.rows << " rows of "
+                                << source_alias << " copied to " << table << " (" << stats.seconds
+                                << " sec, " << std::setprecision(0) << stats.rows_per_second() << " rows/sec)";
+                        bundle["text/plain"] = message.str();
+                    }
+                    publish_execution_result(execution_counter, std::move(bundle), nl::json::object());
+                    cb(ok());
+                    return;
+                } else if (xv_bindings::case_insentive_equals("%LOCAL", tokenized_input[0])) {
+                    /* Runs the cell on the scratch database */
+                    std::string query = strip_magic(code);
+                    scratch.index_join_keys(query);
+                    std::shared_ptr<soci::session> previous = this->sql;
+                    std::shared_ptr<duckdb_session> previous_duckdb = std::move(this->duckdb);
+                    std::string previous_alias = connection_alias;
+                    this->sql = std::shared_ptr<soci::session>(&scratch.session(), [](soci::session*) {});
+                    connection_alias = "local";
+                    try {
+                        process_SQL_cell(execution_counter, query, profile_always);
+                    } catch (...) {
+                        this->sql = previous;
+                        this->duckdb = std::move(previous_duckdb);
+                        connection_alias = previous_alias;
+                        throw;
+                    }
+                    this->sql = previous;
+                    this->duckdb = std::move(previous_duckdb);
+                    connection_alias = previous_alias;
+                    cb(ok());
+                    return;
+                } else if (xv_bindings::case_insentive_equals("%SWEEP", tokenized_input[0])) {
+                    process_SQL_sweep(execution_counter, code, profile_always);
+                    cb(ok());
+                    return;
+                } else if (xv_bindings::case_insentive_equals("BEGIN", tokenized_input[0])) {
+                    if (this->duckdb) {
+                        transaction.begin(this->duckdb);
+                    } else if (this->sql) {
+                        transaction.begin(this->sql);
+                    } else {
+                        throw std::runtime_error("Database was not loaded.");
+                    }
+                    auto bundle = nl::json::object();
+                    bundle["text/plain"] = "Transaction begun, %COMMIT or %ROLLBACK ends it.";
+                    publish_execution_result(execution_counter, std::move(bundle), nl::json::object());
+                    cb(ok());
+                    return;
+                } else if (xv_bindings::case_insentive_equals("COMMIT", tokenized_input[0]) ||
+                           xv_bindings::case_insentive_equals("ROLLBACK", tokenized_input[0])) {
+                    if (!transaction.open()) {
+                        throw std::runtime_error("No transaction is open.");
+                    }
+                    const bool commit = xv_bindings::case_insentive_equals("COMMIT", tokenized_input[0]);
+                    const std::size_t statements = commit ? transaction.commit() : transaction.rollback();
+                    auto bundle = nl::json::object();
+                    bundle["text/plain"] = std::string(commit ? "Committed " : "Rolled back ")
+                                           + std::to_string(statements)
+                                           + (statements == 1 ? " statement." : " statements.");
+                    publish_execution_result(execution_counter, std::move(bundle), nl::json::object());
+                    cb(ok());
+                    return;
+                } else if (xv_bindings::case_insentive_equals("BATCH", tokenized_input[0])) {
+                    /* %BATCH statements [interval], %BATCH OFF */
+                    if (tokenized_input.size() == 2 &&
+                        xv_bindings::case_insentive_equals("OFF", tokenized_input[1])) {
+                        transaction.set_batch(batch_options());
+                    } else if (tokenized_input.size() == 2 || tokenized_input.size() == 3) {
+                        batch_options batch;
+                        batch.statements = std::stoull(tokenized_input[1]);
+                        if (tokenized_input.size() == 3) {
+                            batch.interval = parse_ttl(tokenized_input[2]);
+                        }
+                        if (!batch.enabled()) {
+                            throw std::runtime_error("invalid input: " + code);
+                        }
+                        transaction.set_batch(batch);
+                    } else if (tokenized_input.size() != 1) {
+                        throw std::runtime_error("invalid input: " + code);
+                    }
+                    const batch_options& batch = transaction.batch();
+                    std::string message = "DML statements run in autocommit mode.";
+                    if (batch.enabled()) {
+                        message = "DML statements are committed by batches";
+                        if (batch.statements != 0) {
+                            message += " of " + std::to_string(batch.statements) + " statements";
+                        }
+                        if (batch.interval.count() != 0) {
+                            message += (batch.statements != 0 ? " or " : " ")
+                                       + std::string("every ") + std::to_string(batch.interval.count()) + " s";
+                        }
+                        message += ".";
+                    }
+                    if (transaction.open()) {
+                        message += "\n" + transaction.footer();
+                    }
+                    auto bundle = nl::json::object();
+                    bundle["text/plain"] = message;
+                    publish_execution_result(execution_counter, std::move(bundle), nl::json::object());
+                    cb(ok());
+                    return;
+                } else if (xv_bindings::case_insentive_equals("GRID", tokenized_input[0])) {
+                    process_SQL_grid(execution_counter, strip_magic(code), profile_always);
+                    cb(ok());
+                    return;
+                } else if (xv_bindings::case_insentive_equals("PROFILE", tokenized_input[0])) {
+                    if (tokenized_input.size() == 2 &&
+                        (xv_bindings::case_insentive_equals("ON", tokenized_input[1]) ||
+                         xv_bindings::case_insentive_equals("OFF", tokenized_input[1])))
+                    {
+                        profile_always = xv_bindings::case_insentive_equals("ON", tokenized_input[1]);
+                        auto bundle = nl::json::object();
+                        bundle["text/plain"] = std::string("Profiling ")
+                                               + (profile_always ? "enabled." : "disabled.");
+                        publish_execution_result(execution_counter, std::move(bundle), nl::json::object());
+                        cb(ok());
+                        return;
+                    }
+                    process_SQL_cell(execution_counter, strip_magic(code), true);
+                    cb(ok());
+                    return;
+                } else if (xv_bindings::case_insentive_equals("TRANSFORM", tokenized_input[0])) {
+                    /* Shows the data a chart would get: %TRANSFORM steps... <> query */
+                    tokenized_input = xv_bindings::tokenizer(code);
+                    tokenized_input.erase(tokenized_input.begin());
+                    std::vector<std::string> steps, sql_input;
+                    std::tie(steps, sql_input) = split_xv_sql_input(tokenized_input);
+                    std::stringstream stringfied_sql_input;
+                    for (size_t i = 0; i < sql_input.size(); i++) {
+                        stringfied_sql_input << " " << sql_input[i];
+                    }
+                    transform_pipeline pipeline = transform_pipeline::parse(steps);
+                    const auto before = clock::now();
+                    const auto start = query_profile::clock::now();
+                    auto result = fetch_SQL_result(stringfied_sql_input.str(), profile);
+                    result_set transformed = pipeline.apply(*result);
+                    const sec duration = clock::now() - before;
+                    const std::string rows_info = rows_in_set(transformed.rows(), duration.count());
+                    const std::string plain_str = render_text_table(transformed, text_options);
+                    const std::string html_str = html_table(transformed);
+                    if (stored_result_name(stringfied_sql_input.str()).empty()) {
+                        metrics.record_query(stringfied_sql_input.str(), query_profile::clock::now() - start,
+                                             profile.rows, 2 * rows_info.size() + plain_str.size() + html_str.size());
+                    }
+                    auto bundle = nl::json::object();
+                    bundle["text/plain"] = rows_info + plain_str;
+                    bundle["text/html"] = rows_info + html_str;
+                    publish_execution_result(execution_counter, std::move(bundle), nl::json::object());
+                    cb(ok());
+                    return;
+                } else if (xv_bindings::case_insentive_equals("SUMMARY", tokenized_input[0])) {
+                    if (tokenized_input.size() == 2 &&
+                        (xv_bindings::case_insentive_equals("ON", tokenized_input[1]) ||
+                         xv_bindings::case_insentive_equals("OFF", tokenized_input[1])))
+                    {
+                        summary_always = xv_bindings::case_insentive_equals("ON", tokenized_input[1]);
+                        auto bundle = nl::json::object();
+                        bundle["text/plain"] = std::string("Column summaries ")
+                                               + (summary_always ? "enabled." : "disabled.");
+                        publish_execution_result(execution_counter, std::move(bundle), nl::json::object());
+                        cb(ok());
+                        return;
                     }
+                    process_SQL_cell(execution_counter, strip_magic(code), profile_always, true);
+                    cb(ok());
+                    return;
                 }
-                else
-                {
-                    throw std::runtime_error("Database was not loaded.");
+
+                /* Parses LOAD magic, "AS name" keeps the connection for %LOCAL */
+                std::string name;
+                const std::size_t count = tokenized_input.size();
+                if (count > 3 && xv_bindings::case_insentive_equals("AS", tokenized_input[count - 2])) {
+                    name = tokenized_input.back();
+                    tokenized_input.resize(count - 2);
+                }
+                const bool duckdb_database = tokenized_input.size() > 1 &&
+                                             xv_bindings::case_insentive_equals("DUCKDB", tokenized_input[1]);
+                if (duckdb_database && !name.empty()) {
+                    throw std::runtime_error("DuckDB databases can't be kept with AS.");
+                }
+                if (transaction.open() && !transaction.batched()) {
+                    throw std::runtime_error("A transaction is open, %COMMIT or %ROLLBACK it before loading another database.");
+                }
+                transaction.commit();
+                trace_span span("acquire_connection");
+                if (duckdb_database) {
+                    /* In-process analytical database, in memory without a path */
+                    const std::string path = tokenized_input.size() > 2 ? tokenized_input[2] : ":memory:";
+                    this->duckdb = std::make_shared<duckdb_session>(path);
+                    this->sql.reset();
+                    connection_alias = "duckdb " + path;
+                } else if (tokenized_input.size() > 2 && xv_bindings::case_insentive_equals("FILES", tokenized_input[1])) {
+                    /* CSV files of a directory as tables of a SQLite session */
+                    std::string directory = tokenized_input[2];
+                    for (std::size_t i = 3; i < tokenized_input.size(); ++i) {
+                        directory += " " + tokenized_input[i];
+                    }
+                    auto files = std::make_shared<soci::session>("sqlite3", ":memory:");
+                    std::vector<std::string> tables = load_file_tables(*files, directory);
+                    this->sql = files;
+                    this->duckdb.reset();
+                    connection_alias = "files " + directory;
+                    std::string message = std::to_string(tables.size()) + " tables loaded from " + directory;
+                    for (std::size_t i = 0; i < tables.size(); ++i) {
+                        message += (i ? ", " : ": ") + tables[i];
+                    }
+                    auto bundle = nl::json::object();
+                    bundle["text/plain"] = message + ".";
+                    publish_execution_result(execution_counter, std::move(bundle), nl::json::object());
+                } else {
+                    this->sql = parse_SQL_magic(tokenized_input);
+                    this->duckdb.reset();
+                    connection_alias = redacted_connection(tokenized_input);
                 }
+                if (!name.empty()) {
+                    connections[name] = this->sql;
+                }
+            }
+            /* Runs SQL code */
+            else
+            {
+                process_SQL_cell(execution_counter, code, profile_always);
             }
         } catch (const std::runtime_error &err) {
             cb(handle_exception((std::string)err.what()));
@@ -469,11 +1659,25 @@ namespace xeus_sql
 
     nl::json interpreter::shutdown_request_impl(bool /*restart*/)
     {
+        // the pending batch would have been committed without batching,
+        // unless a cell still runs on the connection
+        std::unique_lock<std::mutex> lock(transaction.mutex(), std::try_to_lock);
+        try {
+            if (lock.owns_lock() && transaction.batched()) {
+                transaction.commit();
+            }
+        } catch (...) {
+        }
         return xeus::create_shutdown_reply(false);
     }
 
     nl::json interpreter::interrupt_request_impl()
     {
+        {
+            std::lock_guard<std::mutex> lock(watch_mutex);
+            watch_interrupted = true;
+        }
+        watch_cv.notify_all();
         return xeus::create_interrupt_reply();
     }
 